@@ -100,82 +100,111 @@ static Value *readDmaReg(IRBuilder<> &B, unsigned RegIdx) {
   return B.CreateLoad(RegTy, RegAddr, /* isVolatile */ true);
 }
 
-static void startDmaTransfer1D(IRBuilder<> &B, Value *DstAddr, Value *SrcAddr,
-                               Value *Size) {
+// Allocate a DMA descriptor on the stack, which is held in TCDM. The
+// descriptor is allocated in the entry block so that it is a static alloca.
+static AllocaInst *createDmaDescriptor(IRBuilder<> &B) {
+  BasicBlock &EntryBB = B.GetInsertBlock()->getParent()->getEntryBlock();
+  IRBuilder<> AllocaBuilder(&EntryBB, EntryBB.getFirstInsertionPt());
+  Type *const DescTy =
+      ArrayType::get(getDmaRegTy(B.getContext()), REFSI_DMA_DESC_NUM_FIELDS);
+  return AllocaBuilder.CreateAlloca(DescTy, nullptr, "dma_desc");
+}
+
+// Write a value to the DMA descriptor field specified by the field index.
+static Instruction *writeDmaDescField(IRBuilder<> &B, AllocaInst *Desc,
+                                      unsigned FieldIdx, Value *Val) {
+  auto *const FieldAddr = B.CreateConstInBoundsGEP2_32(
+      Desc->getAllocatedType(), Desc, 0, FieldIdx);
+  Val = getDmaRegVal(B, Val);
+  return B.CreateStore(Val, FieldAddr, /* isVolatile */ true);
+}
+
+// Start a chain made of a single DMA descriptor. Only two DMA registers need to
+// be written, regardless of how many fields the transfer uses.
+static void startDmaChain(IRBuilder<> &B, AllocaInst *Desc, uint64_t Config) {
   Type *const DmaRegTy = getDmaRegTy(B.getContext());
 
-  // Set the destination address.
-  writeDmaReg(B, REFSI_REG_DMADSTADDR, DstAddr);
+  // Configure the transfer and terminate the chain.
+  writeDmaDescField(B, Desc, REFSI_DMA_DESC_CTRL,
+                    ConstantInt::get(DmaRegTy, Config));
+  writeDmaDescField(B, Desc, REFSI_DMA_DESC_NEXT,
+                    ConstantInt::get(DmaRegTy, 0));
 
-  // Set the source address.
-  writeDmaReg(B, REFSI_REG_DMASRCADDR, SrcAddr);
+  // Set the descriptor address and start the chain.
+  writeDmaReg(B, REFSI_REG_DMADESCADDR, Desc);
+  uint64_t ChainConfig = REFSI_DMA_CHAIN | REFSI_DMA_START;
+  writeDmaReg(B, REFSI_REG_DMACTRL, ConstantInt::get(DmaRegTy, ChainConfig));
+}
+
+static void startDmaTransfer1D(IRBuilder<> &B, Value *DstAddr, Value *SrcAddr,
+                               Value *Size) {
+  auto *const Desc = createDmaDescriptor(B);
+
+  // Set the destination and source addresses.
+  writeDmaDescField(B, Desc, REFSI_DMA_DESC_DSTADDR, DstAddr);
+  writeDmaDescField(B, Desc, REFSI_DMA_DESC_SRCADDR, SrcAddr);
 
   // Set the transfer size.
-  writeDmaReg(B, REFSI_REG_DMAXFERSIZE0, Size);  // Bytes
+  writeDmaDescField(B, Desc, REFSI_DMA_DESC_XFERSIZE0, Size);  // Bytes
 
   // Configure and start a 1D DMA transfer.
-  uint64_t Config = REFSI_DMA_1D | REFSI_DMA_STRIDE_NONE | REFSI_DMA_START;
-  writeDmaReg(B, REFSI_REG_DMACTRL, ConstantInt::get(DmaRegTy, Config));
+  startDmaChain(B, Desc, REFSI_DMA_1D | REFSI_DMA_STRIDE_NONE);
 }
 
 static void startDmaTransfer2D(IRBuilder<> &B, Value *DstAddr, Value *SrcAddr,
                                Value *Width, Value *Height, Value *DstStride,
                                Value *SrcStride, unsigned StrideMode) {
-  // Set the destination address.
-  writeDmaReg(B, REFSI_REG_DMADSTADDR, DstAddr);
+  auto *const Desc = createDmaDescriptor(B);
 
-  // Set the source address.
-  writeDmaReg(B, REFSI_REG_DMASRCADDR, SrcAddr);
+  // Set the destination and source addresses.
+  writeDmaDescField(B, Desc, REFSI_DMA_DESC_DSTADDR, DstAddr);
+  writeDmaDescField(B, Desc, REFSI_DMA_DESC_SRCADDR, SrcAddr);
 
   // Set the transfer size for each dimension.
-  writeDmaReg(B, REFSI_REG_DMAXFERSIZE0 + 0, Width);   // Bytes
-  writeDmaReg(B, REFSI_REG_DMAXFERSIZE0 + 1, Height);  // Rows
+  writeDmaDescField(B, Desc, REFSI_DMA_DESC_XFERSIZE0 + 0, Width);   // Bytes
+  writeDmaDescField(B, Desc, REFSI_DMA_DESC_XFERSIZE0 + 1, Height);  // Rows
 
   // Set the transfer stride.
-  switch (StrideMode) {
-    case REFSI_DMA_STRIDE_NONE:
-      break;
-    case REFSI_DMA_STRIDE_SRC:
-      writeDmaReg(B, REFSI_REG_DMAXFERSRCSTRIDE0, SrcStride);  // Bytes
-      break;
-    case REFSI_DMA_STRIDE_DST:
-      writeDmaReg(B, REFSI_REG_DMAXFERDSTSTRIDE0, DstStride);  // Bytes
-      break;
-    case REFSI_DMA_STRIDE_BOTH:
-      writeDmaReg(B, REFSI_REG_DMAXFERSRCSTRIDE0, SrcStride);  // Bytes
-      writeDmaReg(B, REFSI_REG_DMAXFERDSTSTRIDE0, DstStride);  // Bytes
-      break;
+  if (StrideMode & REFSI_DMA_STRIDE_SRC) {
+    writeDmaDescField(B, Desc, REFSI_DMA_DESC_XFERSRCSTRIDE0,
+                      SrcStride);  // Bytes
+  }
+  if (StrideMode & REFSI_DMA_STRIDE_DST) {
+    writeDmaDescField(B, Desc, REFSI_DMA_DESC_XFERDSTSTRIDE0,
+                      DstStride);  // Bytes
   }
 
   // Configure and start a write or read 2D DMA transfer.
-  uint64_t config = REFSI_DMA_2D | StrideMode | REFSI_DMA_START;
-  writeDmaReg(B, REFSI_REG_DMACTRL, B.getInt64(config));
+  startDmaChain(B, Desc, REFSI_DMA_2D | StrideMode);
 }
 
 static void startDmaTransfer3D(IRBuilder<> &B, Value *DstAddr, Value *SrcAddr,
                                Value *Width, Value *Height, Value *Depth,
                                Value *LineStrideDst, Value *LineStrideSrc,
                                Value *PlaneStrideDst, Value *PlaneStrideSrc) {
-  // Set the destination address.
-  writeDmaReg(B, REFSI_REG_DMADSTADDR, DstAddr);
+  auto *const Desc = createDmaDescriptor(B);
 
-  // Set the source address.
-  writeDmaReg(B, REFSI_REG_DMASRCADDR, SrcAddr);
+  // Set the destination and source addresses.
+  writeDmaDescField(B, Desc, REFSI_DMA_DESC_DSTADDR, DstAddr);
+  writeDmaDescField(B, Desc, REFSI_DMA_DESC_SRCADDR, SrcAddr);
 
   // Set the transfer size for each dimension.
-  writeDmaReg(B, REFSI_REG_DMAXFERSIZE0 + 0, Width);   // Bytes
-  writeDmaReg(B, REFSI_REG_DMAXFERSIZE0 + 1, Height);  // Rows
-  writeDmaReg(B, REFSI_REG_DMAXFERSIZE0 + 2, Depth);   // Planes
+  writeDmaDescField(B, Desc, REFSI_DMA_DESC_XFERSIZE0 + 0, Width);   // Bytes
+  writeDmaDescField(B, Desc, REFSI_DMA_DESC_XFERSIZE0 + 1, Height);  // Rows
+  writeDmaDescField(B, Desc, REFSI_DMA_DESC_XFERSIZE0 + 2, Depth);   // Planes
 
   // Set the transfer strides.
-  writeDmaReg(B, REFSI_REG_DMAXFERSRCSTRIDE0, LineStrideSrc);  // Bytes
-  writeDmaReg(B, REFSI_REG_DMAXFERSRCSTRIDE0 + 1, PlaneStrideSrc);
-  writeDmaReg(B, REFSI_REG_DMAXFERDSTSTRIDE0, LineStrideDst);  // Bytes
-  writeDmaReg(B, REFSI_REG_DMAXFERDSTSTRIDE0 + 1, PlaneStrideDst);
+  writeDmaDescField(B, Desc, REFSI_DMA_DESC_XFERSRCSTRIDE0,
+                    LineStrideSrc);  // Bytes
+  writeDmaDescField(B, Desc, REFSI_DMA_DESC_XFERSRCSTRIDE0 + 1,
+                    PlaneStrideSrc);
+  writeDmaDescField(B, Desc, REFSI_DMA_DESC_XFERDSTSTRIDE0,
+                    LineStrideDst);  // Bytes
+  writeDmaDescField(B, Desc, REFSI_DMA_DESC_XFERDSTSTRIDE0 + 1,
+                    PlaneStrideDst);
 
   // Configure and start a 3D DMA transfer.
-  uint64_t Config = REFSI_DMA_3D | REFSI_DMA_STRIDE_BOTH | REFSI_DMA_START;
-  writeDmaReg(B, REFSI_REG_DMACTRL, B.getInt64(Config));
+  startDmaChain(B, Desc, REFSI_DMA_3D | REFSI_DMA_STRIDE_BOTH);
 }
 
 static void fetchAndReturnLastTransferID(IRBuilder<> &B, Function &F) {
@@ -25,12 +25,24 @@ declare spir_func %__mux_dma_event_t* @__mux_dma_read_1D(i8 addrspace(3)*, i8 ad
 
 
 ; CHECK: define spir_func ptr @__refsi_dma_start_seq_read(ptr addrspace(3) [[argDstDmaPointer:%.*]], ptr addrspace(1) [[argSrcDmaPointer:%.*]], i64 [[argWidth:%.*]], ptr [[argEvent:%.*]]) #0 {
+; CHECK: entry:
+; CHECK-NEXT:   [[desc:%.*]] = alloca [11 x i64], align 8
+; CHECK: body:
+; CHECK:   [[dst_field:%.*]] = getelementptr inbounds [11 x i64], ptr [[desc]], i32 0, i32 2
 ; CHECK:   [[argDstDmaInt:%.*]] = ptrtoint ptr addrspace(3) [[argDstDmaPointer]] to i64
-; CHECK:   store volatile i64 [[argDstDmaInt]], ptr inttoptr (i64 536879136 to ptr), align 8
+; CHECK:   store volatile i64 [[argDstDmaInt]], ptr [[dst_field]], align 8
+; CHECK:   [[src_field:%.*]] = getelementptr inbounds [11 x i64], ptr [[desc]], i32 0, i32 1
 ; CHECK:   [[argSrcDmaInt:%.*]] = ptrtoint ptr addrspace(1) [[argSrcDmaPointer]] to i64
-; CHECK:   store volatile i64 [[argSrcDmaInt]], ptr inttoptr (i64 536879128 to ptr), align 8
-; CHECK:   store volatile i64 [[argWidth]], ptr inttoptr (i64 536879144 to ptr), align 8
-; CHECK:   store volatile i64 17, ptr inttoptr (i64 536879104 to ptr), align 8
+; CHECK:   store volatile i64 [[argSrcDmaInt]], ptr [[src_field]], align 8
+; CHECK:   [[size0_field:%.*]] = getelementptr inbounds [11 x i64], ptr [[desc]], i32 0, i32 3
+; CHECK:   store volatile i64 [[argWidth]], ptr [[size0_field]], align 8
+; CHECK:   [[ctrl_field:%.*]] = getelementptr inbounds [11 x i64], ptr [[desc]], i32 0, i32 0
+; CHECK:   store volatile i64 16, ptr [[ctrl_field]], align 8
+; CHECK:   [[next_field:%.*]] = getelementptr inbounds [11 x i64], ptr [[desc]], i32 0, i32 10
+; CHECK:   store volatile i64 0, ptr [[next_field]], align 8
+; CHECK:   [[desc_int:%.*]] = ptrtoint ptr [[desc]] to i64
+; CHECK:   store volatile i64 [[desc_int]], ptr inttoptr (i64 536879272 to ptr), align 8
+; CHECK:   store volatile i64 1025, ptr inttoptr (i64 536879104 to ptr), align 8
 ; CHECK:   [[load:%.*]] = load volatile i64, ptr inttoptr (i64 536879112 to ptr), align 8
 ; CHECK:   [[reinterpret:%.*]] = inttoptr i64 [[load]] to ptr
 ; CHECK:   ret ptr [[reinterpret]]
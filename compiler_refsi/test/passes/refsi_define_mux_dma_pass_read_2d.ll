@@ -25,15 +25,30 @@ declare spir_func %__mux_dma_event_t* @__mux_dma_read_2D(i8 addrspace(3)*, i8 ad
 
 
 ; CHECK: define spir_func ptr @__refsi_dma_start_2d_read(ptr addrspace(3) [[dstDmaPointer:%.*]], ptr addrspace(1) [[srcDmaPointer:%.*]], i64 [[width:%.*]], i64 [[dstStride:%.*]], i64 [[srcStride:%.*]], i64 [[height:%.*]], ptr [[event:%.*]]) #0 {
+; CHECK: entry:
+; CHECK-NEXT:   [[desc:%.*]] = alloca [11 x i64], align 8
+; CHECK: body:
+; CHECK:   [[dst_field:%.*]] = getelementptr inbounds [11 x i64], ptr [[desc]], i32 0, i32 2
 ; CHECK:   [[dst_int:%.*]] = ptrtoint ptr addrspace(3) [[dstDmaPointer]] to i64
-; CHECK:   store volatile i64 [[dst_int]], ptr inttoptr (i64 536879136 to ptr), align 8
+; CHECK:   store volatile i64 [[dst_int]], ptr [[dst_field]], align 8
+; CHECK:   [[src_field:%.*]] = getelementptr inbounds [11 x i64], ptr [[desc]], i32 0, i32 1
 ; CHECK:   [[src_int:%.*]] = ptrtoint ptr addrspace(1) [[srcDmaPointer]] to i64
-; CHECK:   store volatile i64 [[src_int]], ptr inttoptr (i64 536879128 to ptr), align 8
-; CHECK:   store volatile i64 [[width]], ptr inttoptr (i64 536879144 to ptr), align 8
-; CHECK:   store volatile i64 [[height]], ptr inttoptr (i64 536879152 to ptr), align 8
-; CHECK:   store volatile i64 [[srcStride]], ptr inttoptr (i64 536879168 to ptr), align 8
-; CHECK:   store volatile i64 [[dstStride]], ptr inttoptr (i64 536879184 to ptr), align 8
-; CHECK:   store volatile i64 225, ptr inttoptr (i64 536879104 to ptr), align 8
+; CHECK:   store volatile i64 [[src_int]], ptr [[src_field]], align 8
+; CHECK:   [[size0_field:%.*]] = getelementptr inbounds [11 x i64], ptr [[desc]], i32 0, i32 3
+; CHECK:   store volatile i64 [[width]], ptr [[size0_field]], align 8
+; CHECK:   [[size1_field:%.*]] = getelementptr inbounds [11 x i64], ptr [[desc]], i32 0, i32 4
+; CHECK:   store volatile i64 [[height]], ptr [[size1_field]], align 8
+; CHECK:   [[src_stride0_field:%.*]] = getelementptr inbounds [11 x i64], ptr [[desc]], i32 0, i32 6
+; CHECK:   store volatile i64 [[srcStride]], ptr [[src_stride0_field]], align 8
+; CHECK:   [[dst_stride0_field:%.*]] = getelementptr inbounds [11 x i64], ptr [[desc]], i32 0, i32 8
+; CHECK:   store volatile i64 [[dstStride]], ptr [[dst_stride0_field]], align 8
+; CHECK:   [[ctrl_field:%.*]] = getelementptr inbounds [11 x i64], ptr [[desc]], i32 0, i32 0
+; CHECK:   store volatile i64 224, ptr [[ctrl_field]], align 8
+; CHECK:   [[next_field:%.*]] = getelementptr inbounds [11 x i64], ptr [[desc]], i32 0, i32 10
+; CHECK:   store volatile i64 0, ptr [[next_field]], align 8
+; CHECK:   [[desc_int:%.*]] = ptrtoint ptr [[desc]] to i64
+; CHECK:   store volatile i64 [[desc_int]], ptr inttoptr (i64 536879272 to ptr), align 8
+; CHECK:   store volatile i64 1025, ptr inttoptr (i64 536879104 to ptr), align 8
 ; CHECK:   [[load:%.*]] = load volatile i64, ptr inttoptr (i64 536879112 to ptr), align 8
 ; CHECK:   [[reinterpret:%.*]] = inttoptr i64 [[load]] to ptr
 ; CHECK:   ret ptr [[reinterpret]]
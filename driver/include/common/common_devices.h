@@ -17,6 +17,7 @@
 #ifndef _REFSIDRV_COMMON_COMMON_DEVICES_H
 #define _REFSIDRV_COMMON_COMMON_DEVICES_H
 
+#include <atomic>
 #include <map>
 #include <string>
 #include <vector>
@@ -239,25 +240,47 @@ public:
   /// @return true on success and false on failure.
   bool copy(reg_t dst_addr, reg_t src_addr, size_t len, unit_id_t unit);
 
+  /// @brief Identifies the current state of the device map. Two calls return
+  /// the same value only if no device was added or removed in between.
+  uint64_t get_generation() const {
+    return generation.load(std::memory_order_acquire);
+  }
+
 private:
+  /// @brief Return a new, globally unique, memory map generation.
+  static uint64_t new_generation();
+
   std::map<reg_t, MemoryDevice*> devices;
+  /// @brief Identifies the current state of the device map. It changes every
+  /// time a device is added or removed, which invalidates cached lookups.
+  std::atomic<uint64_t> generation{new_generation()};
 };
 
 class RAMDevice : public MemoryDeviceBase {
  public:
-  RAMDevice(size_t size);
-  virtual ~RAMDevice() {
-    if (data) free(data);
-  }
+  /// @brief Create a new RAM device.
+  /// @param size Size of the memory, in bytes.
+  /// @param sparse Whether to reserve address space for the memory without
+  /// committing it. Pages are then committed when they are first touched and
+  /// can be returned to the host using discard().
+  RAMDevice(size_t size, bool sparse = false);
+  virtual ~RAMDevice();
 
   uint8_t *contents() { return data; }
   size_t mem_size() const override { return size; }
   uint8_t *addr_to_mem(reg_t dev_offset, size_t size,
                        unit_id_t unit_id) override;
 
+  /// @brief Release the host pages backing the given range of memory. The
+  /// released memory reads as zero afterwards. Only pages that are entirely
+  /// contained in the range are released.
+  /// @return true if pages were released and false otherwise.
+  bool discard(reg_t dev_offset, size_t size);
+
  private:
   uint8_t *data;
   size_t size;
+  bool sparse;
 };
 
 class HostRAMDevice : public MemoryDeviceBase {
@@ -38,6 +38,7 @@ struct elf_segment {
   const uint8_t *data;
   uint64_t file_size;
   uint64_t memory_size;
+  bool writable;
 };
 
 class ELFProgram {
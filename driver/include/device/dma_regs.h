@@ -25,6 +25,9 @@
 #define REFSI_REG_DMAXFERSIZE0          0x05
 #define REFSI_REG_DMAXFERSRCSTRIDE0     0x08
 #define REFSI_REG_DMAXFERDSTSTRIDE0     0x0a
+#define REFSI_REG_DMAFILLSIZE           0x0c
+#define REFSI_REG_DMAFILLPATTERN0       0x0d
+#define REFSI_REG_DMADESCADDR           0x15
 
 #define REFSI_DMA_REG_ADDR(base, reg)  ((base) + ((reg) << 3))
 #define REFSI_DMA_GET_REG(base, addr)  (((addr) - (base)) >> 3)
@@ -46,4 +49,34 @@
 #define REFSI_DMA_STRIDE_BOTH           ((REFSI_DMA_STRIDE_DST) | (REFSI_DMA_STRIDE_SRC))
 #define REFSI_DMA_STRIDE_MODE_MASK      REFSI_DMA_STRIDE_BOTH
 
+// Copy rows from the source to the destination.
+#define REFSI_DMA_COPY                  0x000
+// Fill destination rows with the pattern held in the DMAFILLPATTERN registers.
+// The source address is not used.
+#define REFSI_DMA_FILL                  0x100
+// Copy the same source row to every destination row. Source strides are not
+// used.
+#define REFSI_DMA_BROADCAST             0x200
+#define REFSI_DMA_MODE_MASK             0x300
+
+// Start the chain of transfers described by the list of descriptors whose
+// address is held by the DMADESCADDR register. All transfers in the chain
+// share a single transfer ID.
+#define REFSI_DMA_CHAIN                 0x400
+
+// Indices of the 64-bit fields of a DMA descriptor. Fields mirror the DMA
+// registers with the same name. The NEXT field holds the address of the next
+// descriptor in the chain, or zero for the last descriptor.
+#define REFSI_DMA_DESC_CTRL             0x00
+#define REFSI_DMA_DESC_SRCADDR          0x01
+#define REFSI_DMA_DESC_DSTADDR          0x02
+#define REFSI_DMA_DESC_XFERSIZE0        0x03
+#define REFSI_DMA_DESC_XFERSRCSTRIDE0   0x06
+#define REFSI_DMA_DESC_XFERDSTSTRIDE0   0x08
+#define REFSI_DMA_DESC_NEXT             0x0a
+#define REFSI_DMA_DESC_NUM_FIELDS       0x0b
+
+// Maximum size of a fill pattern, in bytes.
+#define REFSI_DMA_MAX_FILL_PATTERN_SIZE 64
+
 #endif // _REFSIDRV_DEVICE_DMA_REGS_H
@@ -17,18 +17,109 @@
 #ifndef _REFSIDRV_REFSI_KERNEL_DMA_H
 #define _REFSIDRV_REFSI_KERNEL_DMA_H
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include "devices.h"
 #include "elf_loader.h"
 #include "common_devices.h"
+#include "device/dma_regs.h"
+
+/// @brief Transfer whose completion is delayed by the timing model.
+struct dma_timed_transfer {
+  uint32_t xfer_id = 0;
+  /// @brief Cycle of the unit at which the transfer completes.
+  uint64_t done_cycle = 0;
+};
+
+/// @brief Parameters of the timing model for kernel DMA transfers. Transfers
+/// complete as soon as their data has been copied when @p bytes_per_cycle is
+/// zero.
+struct dma_timing_config {
+  /// @brief Number of bytes transferred by an engine in a cycle.
+  uint64_t bytes_per_cycle = 0;
+  /// @brief Number of cycles needed to start a transfer or chain.
+  uint64_t setup_cycles = 0;
+  /// @brief Number of transfers a unit can have in flight at the same time.
+  unsigned num_engines = 1;
+};
+
+/// @brief DMA state of a single execution unit, e.g. a hart.
+struct dma_channel {
+  /// @brief Contents of the unit's DMA registers.
+  uint64_t regs[REFSI_DMA_NUM_REGS] = {};
+  /// @brief ID of the most recent transfer to have completed. This is updated
+  /// by DMA threads, which is why it is not stored in @p regs.
+  std::atomic<uint32_t> done_seq{0};
+  /// @brief ID of the oldest transfer that could not access its buffers when
+  /// it was executed and that has not been reported to the unit yet, or zero.
+  /// Written by DMA threads before @p done_seq.
+  std::atomic<uint32_t> failed_seq{0};
+  /// @brief ID of the transfer the unit tried to wait for when writing to
+  /// DMADONESEQ, if the transfer had not completed yet.
+  uint32_t pending_wait_id = 0;
+  /// @brief Transfers that have been started with the timing model enabled and
+  /// that the unit has not seen complete yet, in order.
+  std::deque<dma_timed_transfer> timed_xfers;
+  /// @brief Cycle at which each of the unit's engines becomes available.
+  std::vector<uint64_t> engine_busy_until;
+  /// @brief Cycle at which the most recent timed transfer completes.
+  uint64_t last_done_cycle = 0;
+};
+
+/// @brief Cycles accumulated by the timing model across all units.
+struct dma_timing_stats {
+  /// @brief Cycles during which engines were performing transfers.
+  uint64_t busy_cycles = 0;
+  /// @brief Cycles during which engines were waiting for a new transfer.
+  uint64_t idle_cycles = 0;
+};
+
+/// @brief Transfer that has been started but not necessarily completed.
+struct dma_transfer {
+  dma_channel *channel = nullptr;
+  uint32_t xfer_id = 0;
+  unsigned num_dims = 1;
+  /// @brief Host pointers to the destination and source buffers. These are
+  /// null when the buffers are not contiguous RAM, in which case they are
+  /// accessed through @p dst_addr and @p src_addr instead.
+  uint8_t *dst_mem = nullptr;
+  uint8_t *src_mem = nullptr;
+  reg_t dst_addr = 0;
+  reg_t src_addr = 0;
+  /// @brief Unit that started the transfer, on whose behalf memory is accessed.
+  unit_id_t unit_id = 0;
+  reg_t sizes[3] = {0, 0, 0};
+  reg_t src_strides[3] = {0, 0, 0};
+  reg_t dst_strides[3] = {0, 0, 0};
+  /// @brief Whether to copy, fill or broadcast data.
+  reg_t mode = REFSI_DMA_COPY;
+  /// @brief Pattern to write to the destination rows for fill transfers.
+  uint8_t fill_pattern[REFSI_DMA_MAX_FILL_PATTERN_SIZE] = {};
+  /// @brief Size of @p fill_pattern, in bytes.
+  size_t fill_size = 0;
+  /// @brief Whether executing this transfer completes the transfer identified
+  /// by @p xfer_id. This is only false for parts of a chain but the last.
+  bool completes_transfer = true;
+};
 
 class DMADevice : public MemoryDeviceBase {
 public:
+  /// @brief Create a new kernel DMA device.
+  /// @param num_threads Number of host threads used to perform transfers in
+  /// the background. When zero, transfers are performed synchronously by the
+  /// unit that starts them.
   DMADevice(elf_machine machine, reg_t base_addr, MemoryInterface &mem_if,
-            bool debug = false)
-     : machine(machine), base_addr(base_addr), mem_if(mem_if), debug(debug) {}
+            bool debug = false, unsigned num_threads = 0)
+     : machine(machine), base_addr(base_addr), mem_if(mem_if), debug(debug),
+       num_threads(num_threads) {}
   virtual ~DMADevice();
 
   reg_t get_base() const { return base_addr; }
@@ -41,20 +132,137 @@ public:
   bool store(reg_t addr, size_t len, const uint8_t* bytes,
              unit_id_t unit_id) override;
 
+  /// @brief Whether the address refers to the DMADONESEQ register.
+  bool is_wait_reg(reg_t addr) const;
+
+  /// @brief Retrieve the ID of the transfer that a hart tried to wait for,
+  /// when its write to DMADONESEQ failed because the transfer had not
+  /// completed yet. Harts are expected to be parked until the transfer has
+  /// completed, after which the write can be retried.
+  /// @return true if the unit is waiting for a transfer.
+  bool get_pending_wait(unit_id_t unit_id, uint32_t &xfer_id);
+
+  /// @brief Whether the unit's transfer identified by @p xfer_id is complete.
+  bool is_transfer_done(unit_id_t unit_id, uint32_t xfer_id);
+
+  /// @brief Block until the unit's transfer identified by @p xfer_id is
+  /// complete.
+  void wait_for_transfer(unit_id_t unit_id, uint32_t xfer_id);
+
+  /// @brief Block until all transfers that have been started are complete.
+  void wait_idle();
+
+  /// @brief Enable the timing model for transfers started by harts. Timed
+  /// transfers are only reported as complete through DMADONESEQ once the
+  /// hart's cycle counter has reached their completion cycle, and harts that
+  /// wait for such transfers are stalled until then.
+  /// @param config Parameters of the timing model.
+  /// @param read_cycles Return the value of a unit's cycle counter.
+  /// @param write_cycles Set the value of a unit's cycle counter.
+  void set_timing(const dma_timing_config &config,
+                  std::function<uint64_t(unit_id_t)> read_cycles,
+                  std::function<void(unit_id_t, uint64_t)> write_cycles);
+
+  /// @brief Retrieve the cycles accumulated by the timing model.
+  dma_timing_stats get_timing_stats() const;
+
+  /// @brief Replace the cycles accumulated by the timing model.
+  void set_timing_stats(const dma_timing_stats &stats);
+
 private:
+  dma_channel *get_channel(unit_id_t unit_id);
   bool get_dma_reg(reg_t rel_addr, size_t &dma_reg) const;
   bool read_dma_reg(size_t dma_reg, uint64_t *val, unit_id_t unit_id);
   bool write_dma_reg(size_t dma_reg, uint64_t val, unit_id_t unit_id);
   bool do_kernel_dma(unit_id_t unit_id);
-  bool do_kernel_dma_1d(unit_id_t unit_id, uint8_t *dst_mem, uint8_t *src_mem);
-  bool do_kernel_dma_2d(unit_id_t unit_id, uint8_t *dst_mem, uint8_t *src_mem);
-  bool do_kernel_dma_3d(unit_id_t unit_id, uint8_t *dst_mem, uint8_t *src_mem);
+  /// @brief Validate the transfer described by the given registers and fill in
+  /// @p xfer. Empty transfers have zero dimensions.
+  bool prepare_transfer(unit_id_t unit_id, const uint64_t *dma_regs,
+                        dma_transfer &xfer);
+  /// @brief Validate a chain of transfers described by the list of
+  /// descriptors whose address is held by the DMADESCADDR register.
+  bool prepare_chain(unit_id_t unit_id, const uint64_t *dma_regs,
+                     std::vector<dma_transfer> &xfers);
+  bool do_kernel_dma_1d(const uint64_t *dma_regs, dma_transfer &xfer);
+  bool do_kernel_dma_2d(const uint64_t *dma_regs, dma_transfer &xfer);
+  bool do_kernel_dma_3d(const uint64_t *dma_regs, dma_transfer &xfer);
+  /// @brief Allocate a transfer ID for the transfers and start them. The
+  /// transfer is complete once all of them have been executed.
+  void start_transfers(unit_id_t unit_id, dma_transfer *xfers,
+                       size_t num_xfers);
+  /// @brief Whether transfers started by the unit use the timing model.
+  bool is_timed(unit_id_t unit_id) const;
+  /// @brief Compute when the transfers that make up @p xfer_id complete.
+  void time_transfers(unit_id_t unit_id, dma_channel *channel, uint32_t xfer_id,
+                      const dma_transfer *xfers, size_t num_xfers);
+  /// @brief Return the ID of the most recent transfer the unit can see as
+  /// complete.
+  uint32_t get_done_seq(unit_id_t unit_id, dma_channel *channel);
+  /// @brief Advance the unit's cycle counter to the completion cycle of the
+  /// given transfer, which must have been executed.
+  void stall_for_transfer(unit_id_t unit_id, dma_channel *channel,
+                          uint32_t xfer_id);
+  /// @brief Perform the transfer, either right away or on a DMA thread.
+  void submit_transfer(unit_id_t unit_id, const dma_transfer &xfer);
+  /// @brief Return the number of bytes spanned by a buffer of the transfer.
+  static reg_t get_extent(const dma_transfer &xfer, const reg_t *strides);
+  /// @brief Check that a buffer of the transfer can be accessed by the unit
+  /// and retrieve a host pointer to it, if it is contiguous RAM. Buffers that
+  /// have no host pointer must be read-only memory that is only read from.
+  bool resolve_buffer(reg_t addr, reg_t size, unit_id_t unit_id, bool is_dst,
+                      uint8_t *&mem);
+  /// @brief Whether a transfer up to @p xfer_id failed and has not been
+  /// reported to the unit yet. The failure is reported only once.
+  bool check_failed(dma_channel *channel, uint32_t xfer_id);
+  /// @brief Copy the data for a transfer and mark it as completed, even when
+  /// the data could not be copied.
+  void execute_transfer(const dma_transfer &xfer);
+  /// @brief Copy the data for a transfer whose buffers have host pointers.
+  void execute_direct_transfer(const dma_transfer &xfer);
+  /// @brief Copy the data for a transfer, accessing buffers that do not have
+  /// host pointers through the memory interface.
+  bool execute_indirect_transfer(const dma_transfer &xfer);
+  /// @brief Entry point for DMA threads, which execute transfers from their
+  /// queue in order.
+  void dma_worker_main(size_t worker_idx);
 
   elf_machine machine;
   reg_t base_addr;
   MemoryInterface &mem_if;
   bool debug;
-  std::map<unit_id_t, uint64_t *> dma_reg_contents;
+  /// @brief Protects the map of channels.
+  std::mutex channel_lock;
+  std::map<unit_id_t, std::unique_ptr<dma_channel>> channels;
+
+  /// @brief Queue of transfers executed by a single DMA thread. All transfers
+  /// started by a given unit are executed by the same thread, which means
+  /// that they complete in order.
+  struct dma_queue {
+    std::deque<dma_transfer> transfers;
+    std::thread thread;
+  };
+  unsigned num_threads;
+  /// @brief Maximum number of descriptors in a chain, which guards against
+  /// descriptor lists that loop.
+  static constexpr size_t max_chain_length = 4096;
+  /// @brief Size of the buffer used to transfer data between buffers that do
+  /// not have host pointers.
+  static constexpr size_t max_bounce_size = 64 * 1024;
+  /// @brief Protects the transfer queues.
+  std::mutex queue_lock;
+  /// @brief Signalled when a transfer has been queued or when stopping.
+  std::condition_variable queued;
+  /// @brief Signalled when a transfer has completed.
+  std::condition_variable completed;
+  std::vector<std::unique_ptr<dma_queue>> queues;
+  size_t num_pending = 0;
+  bool stopping = false;
+
+  dma_timing_config timing;
+  std::function<uint64_t(unit_id_t)> read_cycles;
+  std::function<void(unit_id_t, uint64_t)> write_cycles;
+  std::atomic<uint64_t> busy_cycles{0};
+  std::atomic<uint64_t> idle_cycles{0};
 };
 
 #endif
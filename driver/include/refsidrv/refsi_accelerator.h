@@ -21,27 +21,79 @@
 #include "slim_sim.h"
 #include "trap_handlers.h"
 
+#include <atomic>
 #include <memory>
+#include <vector>
 
 struct RefSiDevice;
 
+class DMADevice;
 class processor_t;
 class csr_t;
 
 /// @brief Contains per-hart data needed to execute a kernel entry point on
 /// accelerator cores.
 struct hart_state_entry {
+  /// @brief Maximum number of extra arguments, which are passed in registers
+  /// a1 to a7.
+  static constexpr uint32_t max_extra_args = 7;
+
   /// @brief Address of the Kernel Thread Block for the given hart.
-  uint64_t ktb_addr;
+  uint64_t ktb_addr = 0;
   /// @brief Address to use for the hart's stack pointer.
-  uint64_t stack_top_addr;
+  uint64_t stack_top_addr = 0;
   /// @brief Extra arguments to pass to the entry point function.
-  std::vector<uint64_t> extra_args;
+  uint64_t extra_args[max_extra_args] = {};
+  /// @brief Number of valid entries in @p extra_args.
+  uint32_t num_extra_args = 0;
+
+  /// @brief Append an extra argument, if there is room for it.
+  /// @return true on success and false when all extra arguments are used.
+  bool addExtraArg(uint64_t value) {
+    if (num_extra_args >= max_extra_args) {
+      return false;
+    }
+    extra_args[num_extra_args++] = value;
+    return true;
+  }
+};
+
+/// @brief Queue of kernel instances that still need to be executed as part of
+/// a kernel slice. Harts pull the next instance from the queue as soon as they
+/// return from the entry point function, until the queue has been drained.
+struct RefSiInstanceQueue {
+  /// @brief Total number of instances in the kernel slice.
+  uint64_t num_instances = 0;
+  /// @brief When non-zero, the queue spans several slices which each contain
+  /// this many instances. Instance IDs restart from zero for every slice and
+  /// the slice ID is passed to the entry point as the first extra argument.
+  uint64_t instances_per_slice = 0;
+  /// @brief ID of the next instance to dispatch to a hart. Harts from all
+  /// cores take instances from the same queue, possibly concurrently.
+  std::atomic<uint64_t> next_instance{0};
+  /// @brief Address of the entry point function.
+  reg_t entry_point = 0;
+  /// @brief Address to jump to when the kernel function returns.
+  reg_t return_addr = 0;
+  /// @brief Array of hart-specific data, indexed by hart ID.
+  const hart_state_entry *hart_data = nullptr;
+
+  /// @brief Whether all instances have been dispatched to harts.
+  bool empty() const { return next_instance.load() >= num_instances; }
+
+  /// @brief Set up the given hart's registers so that it executes the next
+  /// instance in the queue.
+  /// @param hart Hart to set up.
+  /// @param hart_id Global index of the hart, across all cores.
+  /// @return true if an instance was dispatched, false if the queue is empty.
+  bool dispatch(processor_t *hart, size_t hart_id);
 };
 
 /// @brief Represents a RefSi accelerator in a RefSi platform. The accelerator
 /// contains several RISC-V cores, each containing several harts, and can be
-/// used to execute kernels in parallel fashion.
+/// used to execute kernels in parallel fashion. Each core is modelled by its
+/// own simulator. Harts are identified by a global index, which means that the
+/// first hart of core N has the index N * getNumHartsPerCore().
 struct RefSiAccelerator {
   RefSiAccelerator(RefSiDevice &soc);
 
@@ -60,9 +112,16 @@ struct RefSiAccelerator {
   unsigned getVectorElemLen() const { return elen; }
   void setVectorElemLen(unsigned new_len) { elen = new_len; }
 
+  /// @brief Number of RISC-V cores in the accelerator.
+  unsigned getNumCores() const { return num_cores; }
+  void setNumCores(unsigned new_num_cores) { num_cores = new_num_cores; }
+
+  /// @brief Number of RISC-V harts in each core of the accelerator.
+  unsigned getNumHartsPerCore() const { return harts_per_core; }
+  void setNumHartsPerCore(unsigned num_harts) { harts_per_core = num_harts; }
+
   /// @brief Total number of RISC-V harts in the accelerator.
-  unsigned getNumHarts() const { return total_harts; }
-  void setNumHarts(unsigned num_harts) { total_harts = num_harts; }
+  unsigned getNumHarts() const { return num_cores * harts_per_core; }
 
   slim_sim_callback get_pre_run_callback() const { return pre_run_callback; }
   void set_pre_run_callback(slim_sim_callback cb) { pre_run_callback = cb; }
@@ -71,7 +130,10 @@ struct RefSiAccelerator {
 
   /// @brief Run a kernel slice command on the RefSi accelerator. The kernel's
   /// entry point function is executed @p num_instances times, distributed
-  /// between the harts in the accelerator.
+  /// between the harts in the accelerator. Instances are handed out
+  /// dynamically: a hart picks up the next instance as soon as it has finished
+  /// executing the previous one. When the harts span several cores, each core
+  /// is simulated on its own host thread.
   /// @param num_instances Number of times to execute the entry point function.
   /// @param entry_point Address of the entry point function.
   /// @param return_addr Address to jump to when the kernel function returns.
@@ -83,14 +145,40 @@ struct RefSiAccelerator {
                               reg_t return_addr, uint32_t num_harts,
                               const hart_state_entry *hart_data);
 
+  /// @brief Run all slices of an N-dimensional kernel on the RefSi
+  /// accelerator. This is equivalent to running @p num_slices kernel slices of
+  /// @p num_instances each, except that instances from different slices can
+  /// be executed concurrently.
+  /// @param num_instances Number of instances in each slice.
+  /// @param num_slices Number of slices to execute.
+  /// @param entry_point Address of the entry point function.
+  /// @param return_addr Address to jump to when the kernel function returns.
+  /// @param num_harts Number of harts to use for executing the kernel.
+  /// @param hart_data Array of hart-specific data needed to execute the entry
+  /// point function on each hart. The first extra argument is replaced by the
+  /// slice ID.
+  refsi_result runKernelNDRange(uint64_t num_instances, uint64_t num_slices,
+                                reg_t entry_point, reg_t return_addr,
+                                uint32_t num_harts,
+                                const hart_state_entry *hart_data);
+
   /// @brief Run a kernel on the RefSi G1 accelerator. This resets all of the
   /// accelerator's harts, so that the bootloader can execute the kernel. It is
   /// the bootloader's responsibility to schedule the work between the harts.
+  /// Only the first core is used.
   refsi_result runKernelGeneric(uint32_t num_harts);
 
   /// @brief Synchronize the RefSi M1 accelerator with the rest of the system
-  /// by flushing and/or invalidating its caches.
-  refsi_result syncCache(uint32_t flags);
+  /// by flushing and/or invalidating its caches. Harts access memory directly
+  /// through their TLBs, which are only flushed when the memory map has
+  /// changed since the last flush. When @p code_size is not zero, decoded
+  /// instructions are only invalidated when the contents of the given code
+  /// range differ from the code that was executed since the last invalidation.
+  /// @param flags Combination of CMP_CACHE_SYNC_ACC_* flags.
+  /// @param code_addr Start address of the code executed by the harts.
+  /// @param code_size Size of the code executed by the harts, in bytes.
+  refsi_result syncCache(uint32_t flags, refsi_addr_t code_addr = 0,
+                         uint64_t code_size = 0);
 
   /// @brief Read a specific hart's performance counter.
   /// @param counter_id Index of the counter to read.
@@ -99,6 +187,14 @@ struct RefSiAccelerator {
   refsi_result readPerfCounter(uint32_t counter_id, uint32_t hart_id,
                                uint64_t &value);
 
+  /// @brief Read several consecutive performance counters of a specific hart.
+  /// @param first_counter_id Index of the first counter to read.
+  /// @param count Number of counters to read.
+  /// @param hart_id Index of the hart that owns the counters.
+  /// @param values On success, values read from the performance counters.
+  refsi_result readPerfCounters(uint32_t first_counter_id, uint32_t count,
+                                uint32_t hart_id, uint64_t *values);
+
   /// @brief Write a value to a specific hart's performance counter.
   /// @param counter_id Index of the counter to write to.
   /// @param hart_id Index of the hart that owns the counter.
@@ -107,8 +203,23 @@ struct RefSiAccelerator {
                                 uint64_t &value);
 
  private:
+  /// @brief Execute all instances in the queue using up to @p num_harts harts.
+  refsi_result runInstanceQueue(RefSiInstanceQueue &instances,
+                                uint32_t num_harts);
+  /// @brief Run the simulators for the first @p num_active_cores cores until
+  /// all of them have exited.
+  refsi_result runCores(size_t num_active_cores);
+  /// @brief Find the simulator and the core-local index for a global hart.
+  slim_sim_t *getCoreForHart(uint32_t hart_id, size_t &local_hart_id) const;
   /// @brief Perform common hart initialization.
   void initializeHart(processor_t *hart);
+  /// @brief Wait for kernel DMA transfers started by harts to complete.
+  void waitForKernelDMA();
+  /// @brief Compute a hash of the code in the given buffer.
+  static uint64_t hashCode(const uint8_t *code, size_t size);
+  /// @brief Determine whether the code in the given buffer may contain atomic
+  /// memory operations (AMOs or LR/SC).
+  static bool codeUsesAtomics(const uint8_t *code, size_t size);
   /// @brief Maps a performance counter index to a CSR register index.
   refsi_result getPerfCounterReg(uint32_t counter_idx, reg_t &reg_idx);
   csr_t *getCSR(uint32_t hart_id, uint32_t csr_idx);
@@ -117,26 +228,55 @@ struct RefSiAccelerator {
   std::string isa;
   unsigned vlen;
   unsigned elen;
-  unsigned total_harts;
+  unsigned num_cores;
+  unsigned harts_per_core;
   slim_sim_callback pre_run_callback;
   slim_sim_config kernel_config;
-  std::unique_ptr<slim_sim_t> sim;
+  /// @brief Simulator for each core of the accelerator.
+  std::vector<std::unique_ptr<slim_sim_t>> cores;
+  /// @brief Memory map generation the harts' TLBs were last flushed for.
+  uint64_t tlb_generation = 0;
+  /// @brief Identifies the code the harts' decoded instructions belong to.
+  struct code_cache_key {
+    refsi_addr_t addr = 0;
+    uint64_t size = 0;
+    uint64_t hash = 0;
+
+    bool operator==(const code_cache_key &other) const {
+      return (addr == other.addr) && (size == other.size) &&
+             (hash == other.hash);
+    }
+  } code_key;
+  /// @brief Whether the code identified by code_key may use atomics. This is
+  /// assumed to be the case when the code is not known.
+  bool code_uses_atomics = true;
 };
 
 /// @brief Trap handler that detects traps which are the result of returning
 /// from the kernel's entry point function. When such a trap is detected, the
 /// simulator is notified that the currently-executing hart has exited
-/// gracefully.
+/// gracefully, unless there are instances left in the instance queue. In that
+/// case the hart is restarted to execute the next instance. Harts that wait for
+/// a kernel DMA transfer which has not completed yet are parked until it has.
 class RefSiTrapHandler : public default_trap_handler {
 public:
   bool handle_trap(trap_t &trap, reg_t pc, slim_sim_t &sim) override;
   bool handle_return(trap_t &trap, reg_t pc, slim_sim_t &sim);
+  bool handle_dma_wait(trap_t &trap, reg_t pc, slim_sim_t &sim);
 
   reg_t get_return_addr() const { return return_addr; }
   void set_return_addr(reg_t new_addr) { return_addr = new_addr; }
 
+  RefSiInstanceQueue *get_instance_queue() const { return instances; }
+  void set_instance_queue(RefSiInstanceQueue *queue) { instances = queue; }
+
+  DMADevice *get_dma_device() const { return dma_device; }
+  void set_dma_device(DMADevice *device) { dma_device = device; }
+
 private:
   reg_t return_addr = 0;
+  RefSiInstanceQueue *instances = nullptr;
+  DMADevice *dma_device = nullptr;
 };
 
 #endif  // _REFSIDRV_REFSI_ACCELERATOR_H
@@ -18,19 +18,72 @@
 #define _REFSIDRV_REFSI_COMMAND_PROCESSOR_H
 
 #include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include "refsi_accelerator.h"
 #include "refsi_device.h"
 
 struct RefSiDevice;
 
+/// @brief Command header that has been decoded and validated when preparing a
+/// command buffer.
+struct RefSiDecodedCommand {
+  /// @brief Decoded opcode for the command.
+  refsi_cmp_command_id opcode = CMP_NOP;
+  /// @brief Number of chunks following the command header.
+  uint32_t num_chunks = 0;
+  /// @brief Contents of the command's inline chunk.
+  uint32_t inline_chunk = 0;
+  /// @brief Index of the command's first chunk in the command buffer.
+  size_t chunk_offset = 0;
+};
+
+/// @brief Command buffer whose commands have been decoded ahead of execution,
+/// so that it can be executed several times without decoding it again.
+struct RefSiPreparedCommandBuffer {
+  /// @brief Size of the command buffer, in bytes.
+  size_t command_buffer_size = 0;
+  /// @brief Identifies this version of the prepared command buffer.
+  uint64_t generation = 0;
+  /// @brief Commands to execute, up to and including the first FINISH.
+  std::vector<RefSiDecodedCommand> commands;
+};
+
 /// @brief Represents a request to execute a command buffer on the CMP.
 struct RefSiCommandRequest {
   /// @brief Address where the command buffer is located in device memory.
   refsi_addr_t command_buffer_addr;
   /// @brief Size of the command buffer, in bytes.
   size_t command_buffer_size;
+  /// @brief Fence signaled once the command buffer has been executed.
+  uint64_t fence = 0;
+  /// @brief Decoded commands, if the command buffer has been prepared.
+  std::shared_ptr<const RefSiPreparedCommandBuffer> prepared;
+};
+
+/// @brief Holds the state of one of the CMP's command queues. Each queue has
+/// its own registers and worker thread, so that command buffers enqueued on
+/// different queues can be executed concurrently.
+struct RefSiCommandQueue {
+  /// @brief Identifies the queue.
+  refsi_cmp_queue_id id = CMP_QUEUE_COMPUTE;
+  /// @brief Unit used by the queue to access device memory. Each queue uses a
+  /// different CMP unit so that e.g. DMA channels are not shared.
+  unit_id_t unit = make_unit(unit_kind::cmp);
+  /// @brief Requests that have been added to the queue and not yet executed.
+  /// The request at the front of the queue is the one being executed.
+  std::deque<RefSiCommandRequest> requests;
+  /// @brief Values of the CMP registers for this queue.
+  std::vector<uint64_t> registers;
+  /// @brief Signaled when a request has been added to the queue.
+  std::condition_variable dispatched;
+  /// @brief Thread that executes requests from this queue.
+  std::thread *worker_thread = nullptr;
 };
 
 /// @brief Utility structure holding the state needed to execute a CMP command.
@@ -43,19 +96,50 @@ struct RefSiCommandContext {
   uint32_t num_chunks = 0;
   /// @brief Contents of the command's inline chunk.
   uint32_t inline_chunk = 0;
-  /// @brief Reference to a mutex held while executing CMP commands.
-  RefSiLock &lock;
+  /// @brief Queue the command is executed on.
+  RefSiCommandQueue &queue;
 
   /// @brief Create a new CMP command context.
-  /// @param lock Mutex to hold while executing CMP commands.
-  RefSiCommandContext(RefSiLock &lock) : lock(lock) {}
+  /// @param queue Queue the command is executed on.
+  RefSiCommandContext(RefSiCommandQueue &queue) : queue(queue) {}
+};
+
+/// @brief Identifies the contents of the per-hart table built when executing a
+/// kernel command. The table is only rebuilt when the key changes, e.g. when
+/// the stack register or the command's extra arguments change.
+struct RefSiHartTableKey {
+  /// @brief Kernel command the table was built for.
+  refsi_cmp_command_id opcode = CMP_NOP;
+  /// @brief Number of entries in the table.
+  size_t num_harts = 0;
+  /// @brief Value of the STACK_TOP register.
+  uint64_t stack_top = 0;
+  /// @brief Command-specific parameters that the table depends on.
+  uint64_t params[hart_state_entry::max_extra_args] = {};
+  /// @brief Number of valid entries in @p params.
+  uint32_t num_params = 0;
+
+  bool operator==(const RefSiHartTableKey &other) const {
+    if ((opcode != other.opcode) || (num_harts != other.num_harts) ||
+        (stack_top != other.stack_top) || (num_params != other.num_params)) {
+      return false;
+    }
+    for (uint32_t i = 0; i < num_params; i++) {
+      if (params[i] != other.params[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
 };
 
 /// @brief Represents a RefSi command processor (CMP) in a RefSi platform. The
 /// command processor is responsible for executing command buffers when requests
-/// are added to its command request queue. The CMP can coordinate access to
-/// different processing elements in the RefSi platform, such as RISC-V
-/// accelerator cores or the DMA controller.
+/// are added to one of its command request queues. The CMP can coordinate
+/// access to different processing elements in the RefSi platform, such as
+/// RISC-V accelerator cores or the DMA controller. Queues are executed
+/// concurrently, but only one command at a time can use the accelerator.
+/// Commands on the high-priority queue are given the accelerator first.
 struct RefSiCommandProcessor {
   /// @brief Create a new CMP device.
   /// @param soc RefSi device to use when executing commands.
@@ -69,16 +153,53 @@ struct RefSiCommandProcessor {
   /// @param lock Mutex to hold while executing CMP commands.
   void stop(RefSiLock &lock);
 
-  /// @brief Add a command request to the CMP's queue.
+  /// @brief Add a command request to one of the CMP's queues.
+  /// @param queue_id Queue to add the request to.
   /// @param lock Mutex to hold while executing CMP commands.
-  void enqueueRequest(RefSiCommandRequest request, RefSiLock &lock);
+  /// @return Fence that is signaled once the request, as well as all requests
+  /// previously added to any queue, have been executed.
+  uint64_t enqueueRequest(RefSiCommandRequest request,
+                          refsi_cmp_queue_id queue_id, RefSiLock &lock);
+
+  /// @brief Validate and decode a command buffer that is going to be executed
+  /// several times. The contents of the command buffer must not change until
+  /// it is released. The device lock must be held when this is called.
+  /// @param addr Address of the command buffer in device memory.
+  /// @param size Size of the command buffer, in bytes.
+  /// @param generation Populated with the generation of the prepared buffer.
+  refsi_result prepareCommandBuffer(refsi_addr_t addr, size_t size,
+                                    uint64_t &generation);
+
+  /// @brief Look up a prepared command buffer. The device lock must be held
+  /// when this is called.
+  /// @param addr Address of the command buffer in device memory.
+  /// @param generation Generation returned by @p prepareCommandBuffer.
+  /// @return Prepared command buffer or null if there is none at this address
+  /// with the given generation.
+  std::shared_ptr<const RefSiPreparedCommandBuffer>
+  findPreparedCommandBuffer(refsi_addr_t addr, uint64_t generation) const;
+
+  /// @brief Release a prepared command buffer. The device lock must be held
+  /// when this is called.
+  /// @param addr Address of the command buffer in device memory.
+  refsi_result releaseCommandBuffer(refsi_addr_t addr);
 
-  /// @brief Wait for the CMP's queue to be empty. This can be used to wait for
-  /// the CMP to have finished executing all command requests that have been
-  /// previously added to its queue.
+  /// @brief Wait for all of the CMP's queues to be empty. This can be used to
+  /// wait for the CMP to have finished executing all command requests that have
+  /// been previously added to its queues.
   /// @param lock Mutex to hold while executing CMP commands.
   void waitEmptyQueue(RefSiLock &lock);
 
+  /// @brief Wait for the request identified by @p fence to have been executed.
+  /// @param fence Fence returned by @p enqueueRequest.
+  /// @param lock Mutex to hold while executing CMP commands.
+  refsi_result waitForFence(uint64_t fence, RefSiLock &lock);
+
+  /// @brief Most recent fence to have been signaled. A fence is only signaled
+  /// once all requests with a lower fence have been executed, therefore all
+  /// fences up to this value have been signaled.
+  uint64_t getSignaledFence() const { return signaled_fence; }
+
   /// @brief Build a textual representation of the register ID.
   /// @param reg_id Register to get a textual representation for.
   static std::string getRegisterName(refsi_cmp_register_id reg_id);
@@ -88,17 +209,46 @@ struct RefSiCommandProcessor {
   std::string formatDeviceAddress(refsi_addr_t address);
 
  private:
-  /// @brief Function called when the CMP's worker thread is started, which
-  /// removes command requests from the CMP queue and executes them.
-  /// @param cmp Command processor object..
-  static void workerMain(RefSiCommandProcessor *cmp);
+  /// @brief Function called when a CMP queue's worker thread is started, which
+  /// removes command requests from the queue and executes them.
+  /// @param cmp Command processor object.
+  /// @param queue Queue to execute requests from.
+  static void workerMain(RefSiCommandProcessor *cmp, RefSiCommandQueue *queue);
   /// @brief Execute a command request on the CMP.
   /// @param request Command request to execute.
-  /// @param lock Mutex to hold while executing CMP commands.
-  refsi_result execute(RefSiCommandRequest request, RefSiLock &lock);
-  /// @brief Execute a decoded command on the CMP.
+  /// @param queue Queue the request was added to.
+  refsi_result execute(RefSiCommandRequest request, RefSiCommandQueue &queue);
+  /// @brief Decode the command at the given position in a command buffer.
+  /// @param command_buffer Chunks of the command buffer.
+  /// @param total_chunks Number of chunks in the command buffer.
+  /// @param pos Position of the command header in the command buffer.
+  /// @param decoded Populated with the decoded command.
+  static refsi_result decodeCommand(const uint64_t *command_buffer,
+                                    size_t total_chunks, size_t pos,
+                                    RefSiDecodedCommand &decoded);
+  /// @brief Execute a decoded command on the CMP, holding the locks it needs.
   /// @param cmd State needed to execute the command.
   refsi_result executeCommand(RefSiCommandContext &cmd);
+  /// @brief Execute a decoded command on the CMP.
+  /// @param cmd State needed to execute the command.
+  refsi_result dispatchCommand(RefSiCommandContext &cmd);
+  /// @brief Determine whether the command needs exclusive use of the
+  /// accelerator, i.e. whether the execution lock must be held.
+  /// @param cmd Decoded command.
+  bool needsExecutionLock(const RefSiCommandContext &cmd);
+  /// @brief Determine whether the command accesses memory-mapped devices,
+  /// which are also accessed by running kernels.
+  /// @param cmd Decoded command.
+  bool accessesIODevices(const RefSiCommandContext &cmd);
+  /// @brief Acquire the execution lock on behalf of a queue. Queues other than
+  /// the high-priority queue yield to it when it is waiting for the lock.
+  /// @param queue Queue that needs to execute a command.
+  RefSiLock lockExecution(const RefSiCommandQueue &queue);
+  /// @brief Recompute the most recent fence to have been signaled after a
+  /// request has been removed from one of the queues.
+  void updateSignaledFence();
+  /// @brief Return the name of the queue, for debugging purposes.
+  static const char *getQueueName(refsi_cmp_queue_id queue_id);
   /// @brief Execute a WRITE_REG64 command on the CMP.
   /// @param cmd State needed to execute the command.
   refsi_result executeWRITE_REG64(RefSiCommandContext &cmd);
@@ -120,19 +270,59 @@ struct RefSiCommandProcessor {
   /// @brief Execute a RUN_INSTANCES command on the CMP.
   /// @param cmd State needed to execute the command.
   refsi_result executeRUN_INSTANCES(RefSiCommandContext &cmd);
+  /// @brief Execute a RUN_NDRANGE command on the CMP.
+  /// @param cmd State needed to execute the command.
+  refsi_result executeRUN_NDRANGE(RefSiCommandContext &cmd);
   /// @brief Execute a SYNC_CACHE command on the CMP.
   /// @param cmd State needed to execute the command.
   refsi_result executeSYNC_CACHE(RefSiCommandContext &cmd);
+  /// @brief Execute a SIGNAL_SEMAPHORE command on the CMP.
+  /// @param cmd State needed to execute the command.
+  refsi_result executeSIGNAL_SEMAPHORE(RefSiCommandContext &cmd);
+  /// @brief Execute a WAIT_SEMAPHORE command on the CMP.
+  /// @param cmd State needed to execute the command.
+  refsi_result executeWAIT_SEMAPHORE(RefSiCommandContext &cmd);
+  /// @brief Prepare the per-hart table for a kernel command.
+  /// @param key Identifies the contents of the table.
+  /// @return true if the cached table can be reused as is, false if it has
+  /// been reset and needs to be filled in by the caller.
+  bool prepareHartTable(const RefSiHartTableKey &key);
+  /// @brief Build a per-hart table where all harts use the same stack and
+  /// extra arguments, unless the cached table can be reused.
+  void prepareUniformHartTable(refsi_cmp_command_id opcode, size_t num_harts,
+                               uint64_t stack_top, const uint64_t *extra_args,
+                               uint32_t num_extra_args);
 
-  std::condition_variable dispatched;
   std::condition_variable executed;
-  std::vector<RefSiCommandRequest> requests;
-  std::vector<uint64_t> registers;
+  RefSiCommandQueue queues[CMP_NUM_QUEUES];
+  /// @brief Command buffers that have been prepared, indexed by address.
+  std::unordered_map<refsi_addr_t,
+                     std::shared_ptr<const RefSiPreparedCommandBuffer>>
+      prepared_buffers;
+  uint64_t next_prepared_generation = 1;
+  /// @brief Values of the semaphores shared by all queues. Protected by the
+  /// device lock.
+  uint64_t semaphores[CMP_NUM_SEMAPHORES] = {};
+  /// @brief Signaled when the value of a semaphore has changed.
+  std::condition_variable semaphore_signaled;
+  /// @brief Protects priority_waiters.
+  std::mutex priority_mutex;
+  /// @brief Number of high-priority commands waiting for the execution lock.
+  uint32_t priority_waiters = 0;
+  /// @brief Signaled when no high-priority command is waiting for the
+  /// execution lock anymore.
+  std::condition_variable priority_idle;
+  /// @brief Per-hart data passed to the accelerator when running kernels. It
+  /// is cached between kernel commands to avoid allocating memory for each.
+  /// Only accessed while holding the execution lock.
+  std::vector<hart_state_entry> hart_table;
+  RefSiHartTableKey hart_table_key;
   const size_t max_requests = 4;
+  uint64_t next_fence = 1;
+  uint64_t signaled_fence = 0;
   RefSiDevice &soc;
   bool started = false;
   bool stopping = false;
-  std::thread *worker_thread = nullptr;
   bool debug = false;
 };
 
@@ -19,6 +19,8 @@
 
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
 #include <vector>
 
 #include "allocator.h"
@@ -32,10 +34,14 @@ struct RefSiAccelerator;
 struct RefSiMemoryController;
 
 using RefSiLock = std::unique_lock<std::mutex>;
+using RefSiMemoryMapReadLock = std::shared_lock<std::shared_mutex>;
+using RefSiMemoryMapWriteLock = std::unique_lock<std::shared_mutex>;
 
 /// @brief Constants used to describe the configure of a RefSi device.
 enum refsi_device_constants {
-  num_cores = 1,  // TODO: Multi-core support
+  default_num_cores = 1,
+  max_num_cores = 16,
+  default_interleave = 5000,
   num_harts_per_core = 4,
   core_vlen = 512,
   core_elen = 64,
@@ -101,12 +107,39 @@ struct RefSiDevice {
   /// @brief Access the device's memory interface.
   RefSiMemoryController &getMemory();
 
-  /// @brief Return the lock used to protect device state.
+  /// @brief Return the lock used to protect device state, such as the command
+  /// processor's request queue. This lock is not held while commands execute.
   std::mutex &getLock() { return mutex; }
 
+  /// @brief Return the lock held by the command processor while it executes
+  /// commands, e.g. while kernels are being simulated.
+  std::mutex &getExecutionLock() { return exec_mutex; }
+
+  /// @brief Return the lock that protects the layout of the memory map. Host
+  /// accesses to device memory hold it in shared mode, while changes to the
+  /// memory map (e.g. moving memory windows) hold it in exclusive mode.
+  /// Changes to the memory map also hold the execution lock, which means that
+  /// the threads simulating the accelerator can look up devices without
+  /// taking this lock.
+  std::shared_mutex &getMemoryMapLock() { return mem_map_mutex; }
+
   /// @brief Whether debug output is enabled or not.
   bool getDebug() const { return debug; }
 
+  /// @brief Number of accelerator cores in the device. This can be set with
+  /// the REFSI_NUM_CORES environment variable.
+  unsigned getNumCores() const { return num_cores; }
+
+  /// @brief Number of instructions a hart executes before the simulator
+  /// switches to another hart of the same core. This can be set with the
+  /// REFSI_INTERLEAVE environment variable.
+  size_t getInterleave() const { return interleave; }
+
+  /// @brief Whether the simulator adjusts the interleave quantum at run-time,
+  /// depending on how often harts synchronize. This can be enabled with the
+  /// REFSI_ADAPTIVE_INTERLEAVE environment variable.
+  bool getAdaptiveInterleave() const { return adaptive_interleave; }
+
   /// @brief Perform device initialization.
   virtual refsi_result initialize() { return refsi_success; }
 
@@ -172,13 +205,26 @@ struct RefSiDevice {
   refsi_result writeDeviceMemory(refsi_addr_t phys_addr, const uint8_t *source,
                                  size_t size, uint32_t unit_id);
 
+  /// @brief Determine whether the given range of device memory is backed by
+  /// memory, as opposed to memory-mapped devices (e.g. DMA registers) that
+  /// running kernels also access. The memory map lock must be held.
+  bool isMemoryRange(refsi_addr_t phys_addr, size_t size, unit_id_t unit_id);
+
  protected:
   std::mutex mutex;
+  std::mutex exec_mutex;
+  std::shared_mutex mem_map_mutex;
+  std::mutex alloc_mutex;
   refsi_soc_family family;
   hal::allocator_t allocator;
+  /// @brief Size of each live DRAM allocation, indexed by address.
+  std::unordered_map<refsi_addr_t, size_t> dram_allocs;
   std::unique_ptr<RefSiAccelerator> accelerator;
   std::unique_ptr<RefSiMemoryController> mem_ctl;
   bool debug = false;
+  unsigned num_cores = default_num_cores;
+  size_t interleave = default_interleave;
+  bool adaptive_interleave = false;
 };
 
 #endif  // _REFSIDRV_REFSI_DEVICE_H
@@ -38,11 +38,41 @@ public:
   /// @brief Asynchronously execute a series of commands on the device.
   /// @param cb_addr Address of the command buffer in device memory.
   /// @param size Size of the command buffer, in bytes.
-  refsi_result executeCommandBuffer(refsi_addr_t cb_addr, size_t size);
+  /// @param fence If not null, populated with the command buffer's fence.
+  /// @param queue Command queue to execute the command buffer on.
+  refsi_result executeCommandBuffer(
+      refsi_addr_t cb_addr, size_t size, uint64_t *fence = nullptr,
+      refsi_cmp_queue_id queue = CMP_QUEUE_COMPUTE);
+
+  /// @brief Validate and decode a command buffer ahead of its execution.
+  /// @param cb_addr Address of the command buffer in device memory.
+  /// @param size Size of the command buffer, in bytes.
+  /// @param generation Populated with the generation of the prepared buffer.
+  refsi_result prepareCommandBuffer(refsi_addr_t cb_addr, size_t size,
+                                    uint64_t &generation);
+
+  /// @brief Asynchronously execute a prepared command buffer.
+  /// @param cb_addr Address of the command buffer in device memory.
+  /// @param generation Generation returned by @p prepareCommandBuffer.
+  /// @param fence If not null, populated with the command buffer's fence.
+  /// @param queue Command queue to execute the command buffer on.
+  refsi_result executePreparedCommandBuffer(
+      refsi_addr_t cb_addr, uint64_t generation, uint64_t *fence = nullptr,
+      refsi_cmp_queue_id queue = CMP_QUEUE_COMPUTE);
+
+  /// @brief Release the decoded form of a prepared command buffer.
+  /// @param cb_addr Address of the command buffer in device memory.
+  refsi_result releaseCommandBuffer(refsi_addr_t cb_addr);
 
   /// @brief Wait for all previously enqueued command buffers to be finished.
   void waitForDeviceIdle();
 
+  /// @brief Wait for the command buffer identified by @p fence to be finished.
+  refsi_result waitForFence(uint64_t fence);
+
+  /// @brief Most recent fence to have been signaled by the command processor.
+  uint64_t getSignaledFence();
+
  private:
   void preRunSim(slim_sim_t &sim);
 
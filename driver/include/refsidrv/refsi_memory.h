@@ -40,12 +40,24 @@ struct RefSiMemoryController : public MemoryController {
   const std::vector<refsi_memory_map_entry> &getMemoryMap() const;
 
   RAMDevice *createMemRange(refsi_memory_map_kind kind, reg_t address,
-                            size_t size);
+                            size_t size, bool sparse = false);
   void addMemDevice(reg_t address, size_t size, refsi_memory_map_kind kind,
                     MemoryDevice *device);
 
   RefSiMemoryWindow * getWindow(unsigned index) const;
 
+  /// @brief Kernel DMA device attached to the memory map, if any.
+  DMADevice *getDMADevice() const { return dma_device; }
+
+  /// @brief Performance counter device attached to the memory map, if any.
+  PerfCounterDevice *getPerfCounterDevice() const {
+    return perf_counter_device;
+  }
+
+  /// @brief Release the host memory backing the given range of sparse memory,
+  /// e.g. after it has been freed. The range then reads as zero.
+  void discardMemRange(reg_t address, size_t size);
+
   refsi_result handleWindowRegWrite(refsi_cmp_register_id reg_idx,
                                     uint64_t value);
 
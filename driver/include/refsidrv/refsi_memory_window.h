@@ -74,6 +74,12 @@ public:
              unit_id_t unit) override;
   uint8_t *addr_to_mem(reg_t addr, size_t size, unit_id_t unit) override;
 
+  /// @brief Find the device that a range of the window maps to for the unit.
+  /// @param target_addr On success, offset of the range in the returned device.
+  /// @return Mapped device, or null if the range cannot be accessed.
+  MemoryDevice *resolve(reg_t addr, size_t size, unit_id_t unit,
+                        reg_t &target_addr);
+
   static bool splitCmpRegister(refsi_cmp_register_id reg_idx,
                               refsi_cmp_register_id &canon_reg_idx,
                               uint32_t &window_id);
@@ -40,9 +40,20 @@ public:
   bool store(reg_t addr, size_t len, const uint8_t* bytes,
              unit_id_t unit_id) override;
 
+  /// @brief Read several consecutive counters with a single call. Per-hart
+  /// counters are read from the hart identified by @p unit_id.
+  /// @param addr Offset of the first counter to read.
+  /// @param count Number of counters to read.
+  /// @param bytes Buffer to copy the 64-bit counter values to.
+  /// @param unit_id ID of the execution unit requesting the read.
+  bool load_counters(reg_t addr, size_t count, uint8_t *bytes,
+                     unit_id_t unit_id);
+
 private:
   bool get_perf_counter_index(reg_t rel_addr, size_t &counter_idx,
                               bool &is_per_hart) const;
+  uint64_t read_global_counter(size_t counter_idx);
+  void write_global_counter(size_t counter_idx, uint64_t val);
 
   RefSiDevice &soc;
   std::vector<uint64_t> global_counters;
@@ -242,10 +242,97 @@ REFSI_API refsi_result refsiExecuteCommandBuffer(refsi_device_t device,
                                                  refsi_addr_t cb_addr,
                                                  size_t size);
 
+/// @brief Asynchronously execute a series of commands on the device and return
+/// a fence that can be used to wait for the commands to be finished.
+/// @param device Device to execute a command buffer on.
+/// @param cb_addr Address of the command buffer in device memory.
+/// @param size Size of the command buffer, in bytes.
+/// @param fence On success, populated with a sequence number that identifies
+/// the command buffer. Fences are signaled in the order command buffers were
+/// enqueued.
+REFSI_API refsi_result refsiExecuteCommandBufferAsync(refsi_device_t device,
+                                                      refsi_addr_t cb_addr,
+                                                      size_t size,
+                                                      uint64_t *fence);
+
+/// @brief Identifies a command queue of the command processor. Each queue
+/// executes its command buffers in order, but command buffers on different
+/// queues may execute concurrently. Use CMP_SIGNAL_SEMAPHORE and
+/// CMP_WAIT_SEMAPHORE commands to order command buffers across queues.
+enum refsi_cmp_queue_id {
+  /// @brief Queue used for kernel execution and general commands.
+  CMP_QUEUE_COMPUTE = 0,
+  /// @brief Queue used for memory copies, which can overlap with kernels.
+  CMP_QUEUE_COPY = 1,
+  /// @brief Queue whose commands take precedence over the other queues when
+  /// they need the accelerator.
+  CMP_QUEUE_HIGH_PRIORITY = 2,
+  CMP_NUM_QUEUES = 3
+};
+
+/// @brief Asynchronously execute a series of commands on a specific command
+/// queue of the device.
+/// @param device Device to execute a command buffer on.
+/// @param queue Command queue to execute the command buffer on.
+/// @param cb_addr Address of the command buffer in device memory.
+/// @param size Size of the command buffer, in bytes.
+/// @param fence If not null, populated with a sequence number that identifies
+/// the command buffer. A fence is only signaled once all command buffers
+/// enqueued before it, on any queue, have been executed.
+REFSI_API refsi_result refsiExecuteCommandBufferOnQueue(
+    refsi_device_t device, refsi_cmp_queue_id queue, refsi_addr_t cb_addr,
+    size_t size, uint64_t *fence);
+
+/// @brief Validate and decode a command buffer that is going to be executed
+/// several times, so that its commands do not need to be decoded again each
+/// time it is executed. The contents of the command buffer must not change
+/// until it is released with refsiReleaseCommandBuffer.
+/// @param device Device to execute the command buffer on.
+/// @param cb_addr Address of the command buffer in device memory.
+/// @param size Size of the command buffer, in bytes.
+/// @param generation On success, populated with a value that identifies this
+/// version of the prepared command buffer.
+REFSI_API refsi_result refsiPrepareCommandBuffer(refsi_device_t device,
+                                                 refsi_addr_t cb_addr,
+                                                 size_t size,
+                                                 uint64_t *generation);
+
+/// @brief Asynchronously execute a command buffer that has been prepared with
+/// refsiPrepareCommandBuffer.
+/// @param device Device to execute the command buffer on.
+/// @param queue Command queue to execute the command buffer on.
+/// @param cb_addr Address of the command buffer in device memory.
+/// @param generation Value returned when preparing the command buffer.
+/// @param fence If not null, populated with the command buffer's fence.
+REFSI_API refsi_result refsiExecutePreparedCommandBuffer(
+    refsi_device_t device, refsi_cmp_queue_id queue, refsi_addr_t cb_addr,
+    uint64_t generation, uint64_t *fence);
+
+/// @brief Release the decoded form of a prepared command buffer. Executions
+/// that have already been enqueued are not affected.
+/// @param device Device the command buffer was prepared for.
+/// @param cb_addr Address of the command buffer in device memory.
+REFSI_API refsi_result refsiReleaseCommandBuffer(refsi_device_t device,
+                                                 refsi_addr_t cb_addr);
+
 /// @brief Wait for all previously enqueued command buffers to be finished.
 /// @param device Device to wait for.
 REFSI_API void refsiWaitForDeviceIdle(refsi_device_t device);
 
+/// @brief Wait for the command buffer identified by a fence to be finished,
+/// as well as all command buffers enqueued before it.
+/// @param device Device to wait for.
+/// @param fence Fence returned by refsiExecuteCommandBufferAsync.
+REFSI_API refsi_result refsiWaitForFence(refsi_device_t device,
+                                         uint64_t fence);
+
+/// @brief Retrieve the most recent fence to have been signaled, without
+/// waiting. Any fence less than or equal to this value has been signaled.
+/// @param device Device to query.
+/// @param fence Populated with the most recently signaled fence.
+REFSI_API refsi_result refsiGetSignaledFence(refsi_device_t device,
+                                             uint64_t *fence);
+
 /// @brief Synchronously execute a kernel on the device. Only supported on RefSi
 /// G1 devices.
 REFSI_API refsi_result refsiExecuteKernel(refsi_device_t device,
@@ -263,7 +350,10 @@ enum refsi_cmp_command_id {
   CMP_COPY_MEM64 = 6,
   CMP_RUN_KERNEL_SLICE = 7,
   CMP_RUN_INSTANCES = 8,
-  CMP_SYNC_CACHE = 9
+  CMP_SYNC_CACHE = 9,
+  CMP_RUN_NDRANGE = 10,
+  CMP_SIGNAL_SEMAPHORE = 11,
+  CMP_WAIT_SEMAPHORE = 12
 };
 
 /// @brief Try to decode a CMP command header.
@@ -285,6 +375,11 @@ REFSI_API uint64_t refsiEncodeCMPCommand(refsi_cmp_command_id opcode,
 
 #define CMP_NUM_WINDOWS 8
 
+// Number of semaphores shared by all command queues. Semaphores hold a 64-bit
+// value that only increases. CMP_SIGNAL_SEMAPHORE raises the value and
+// CMP_WAIT_SEMAPHORE blocks the queue until the value is reached.
+#define CMP_NUM_SEMAPHORES 16
+
 #define REFSI_NUM_GLOBAL_PERF_COUNTERS      32
 #define REFSI_NUM_PER_HART_PERF_COUNTERS    32
 #define REFSI_NUM_PERF_COUNTERS    (REFSI_NUM_GLOBAL_PERF_COUNTERS + \
@@ -374,6 +469,16 @@ enum refsi_perf_counter_id {
   REFSI_PERF_CNTR_BRANCH_INSN = 17,
 };
 
+/// @brief Identifies a RefSi global performance counter.
+enum refsi_global_perf_counter_id {
+  /// @brief Cycles during which kernel DMA engines were performing transfers.
+  /// Only counted when the DMA timing model is enabled.
+  REFSI_PERF_CNTR_DMA_BUSY_CYCLE = 0,
+  /// @brief Cycles during which kernel DMA engines were waiting for a new
+  /// transfer. Only counted when the DMA timing model is enabled.
+  REFSI_PERF_CNTR_DMA_IDLE_CYCLE = 1,
+};
+
 // Create a new unit ID from a unit kind and unit index.
 #define REFSI_UNIT_ID(kind, index) ((((kind) & 0xff) << 24) | (index))
 
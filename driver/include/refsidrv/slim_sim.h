@@ -30,6 +30,8 @@
 #include <bitset>
 #include <string>
 #include <memory>
+#include <mutex>
+#include <condition_variable>
 #include <functional>
 #include <sys/types.h>
 
@@ -43,7 +45,24 @@ struct slim_sim_config {
   bool debug = false;
   bool log = false;
   bool hal_debug = false;
+  // Step each hart on its own host thread instead of interleaving all harts on
+  // the calling thread. Only used when neither debugging nor logging, and when
+  // the harts' code is known not to use atomic memory operations.
+  bool parallel = false;
   size_t num_harts = 0;
+  // Global ID of the first hart, used for hart IDs and memory accesses when
+  // several simulators model different cores of the same device.
+  size_t hart_id_base = 0;
+  // Number of instructions a hart executes before switching to another hart.
+  size_t interleave = 5000;
+  // Adjust the interleave quantum at run-time, between min_interleave and
+  // max_interleave. The quantum shrinks when harts frequently wait on barriers
+  // or DMA transfers and grows when harts run independently.
+  bool adaptive_interleave = false;
+  size_t min_interleave = 100;
+  size_t max_interleave = 50000;
+  // Report changes to the interleave quantum.
+  bool log_interleave = false;
   unsigned pmp_num = 0;
   unsigned pmp_granularity = 0;
   bool log_commits = false;
@@ -56,6 +75,15 @@ struct slim_sim_config {
 
 using slim_sim_callback = std::function<void (slim_sim_t &)>;
 
+// Event that a parked hart is waiting on, such as the completion of a DMA
+// transfer. Events can happen on other host threads.
+struct slim_sim_event {
+  // Return whether the event has happened, without blocking.
+  std::function<bool ()> is_done;
+  // Block the calling thread until the event has happened.
+  std::function<void ()> wait;
+};
+
 // this class encapsulates the processors and memory in a RISC-V machine.
 class slim_sim_t : public simif_t
 {
@@ -86,17 +114,30 @@ public:
   // function will print an error message and abort).
   void configure_log(bool enable_log, bool enable_commitlog);
 
-  size_t get_current_hart_id() const { return current_hart_id; }
+  size_t get_current_hart_id() const;
+  size_t get_hart_id_base() const { return hart_id_base; }
   processor_t* get_hart(size_t index) const;
   size_t get_hart_number() const;
   size_t get_max_active_harts() const { return max_harts; }
   void set_max_active_harts(size_t max_harts);
+  size_t get_interleave() const { return interleave; }
+  // Whether the code executed by the harts may contain AMOs or LR/SC. Spike
+  // does not make these atomic with respect to other host threads, which is
+  // why harts are never stepped in parallel when this is set.
+  bool get_may_use_atomics() const { return may_use_atomics; }
+  void set_may_use_atomics(bool value) { may_use_atomics = value; }
 
   trap_handler_t* get_trap_handler() const { return trap_handler; }
   void set_trap_handler(trap_handler_t *handler) { trap_handler = handler; }
 
   void set_exited(reg_t exit_code);
   bool handle_barrier(reg_t link_address);
+  // Put the current hart to sleep until the event has happened. Other harts
+  // keep running in the meantime.
+  void park_hart(const slim_sim_event &event);
+
+  // Clear the hart's trap state and resume execution at new_pc.
+  void return_from_trap(state_t *hart_state, reg_t new_pc);
 
   // Callback for processors to let the simulation know they were reset.
   void proc_reset(unsigned id) override;
@@ -111,25 +152,60 @@ public:
  private:
   std::vector<processor_t*> harts;
   size_t max_harts = 0;
+  size_t hart_id_base = 0;
   reg_t entry = DRAM_BASE;
   MemoryInterface &mem_if;
   log_file_t log_file;
 
   void step(size_t n); // step through simulation
+  void run_parallel(); // step each hart on its own host thread
+  void run_hart_worker(size_t hart_id);
+  void step_hart(processor_t *hart, size_t n);
+  bool handle_hart_events(processor_t *hart);
   void handle_trap(processor_t *hart);
   void handle_breakpoint(processor_t *hart);
-  void return_from_trap(state_t *hart_state, reg_t new_pc);
+  void wake_parked_harts();
+  bool is_hart_alive() const;
+  // Return the first running hart at or after start, wrapping around, or
+  // get_hart_number() when no hart is running.
+  size_t find_running_hart(size_t start) const;
+  void end_time_slice();
+  void adapt_interleave();
 
-  static const size_t INTERLEAVE = 5000;
   static const size_t INSNS_PER_RTC_TICK = 100; // 10 MHz clock for 1 BIPS core
   static const size_t CPU_HZ = 1000000000; // 1GHz CPU
   size_t current_step;
   size_t current_hart_id;
+  // Number of instructions in a time slice, i.e. executed by a hart before
+  // switching to another hart.
+  size_t interleave;
+  bool adaptive_interleave;
+  size_t min_interleave;
+  size_t max_interleave;
+  bool log_interleave;
+  // Number of time slices and synchronization events (barriers and parked
+  // harts) seen since the interleave quantum was last adapted.
+  size_t window_slices = 0;
+  size_t window_sync_events = 0;
   bool debug;
   bool log;
   bool signal_exit = false;
+  bool parallel = false;
+  bool parallel_running = false;
+  bool may_use_atomics = true;
+  // In parallel mode, protects the hart scheduling state (running bits,
+  // barrier addresses, exit status) as well as trap handling.
+  std::mutex sync_lock;
+  // Signalled when a hart is woken up or when the simulation exits.
+  std::condition_variable hart_woken;
+  // In parallel mode, serializes accesses to memory-mapped devices.
+  std::mutex mmio_lock;
   std::bitset<REFSI_SIM_MAX_HARTS> is_hart_running;
   std::vector<reg_t> hart_barrier_address;
+  // Harts that are parked until an event happens. Parked harts are not
+  // running, but they have not reached a barrier or exited either.
+  std::bitset<REFSI_SIM_MAX_HARTS> is_hart_parked;
+  std::vector<slim_sim_event> hart_events;
   int64_t exit_code = 0;
   trap_handler_t *trap_handler;
   isa_parser_t isa_parser;
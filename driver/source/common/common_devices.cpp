@@ -21,6 +21,7 @@
 #include <stdexcept>
 #include <sstream>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <cassert>
 
@@ -31,6 +32,9 @@ std::string format_unit(unit_id_t unit_id) {
   case unit_kind::external:
     return "external";
   case unit_kind::cmp:
+    if (get_unit_index(unit_id) > 0) {
+      return "cmp:" + std::to_string(get_unit_index(unit_id));
+    }
     return "cmp";
   case unit_kind::acc_hart:
     return "hart:" + std::to_string(get_unit_index(unit_id));
@@ -84,14 +88,36 @@ uint8_t *HostRAMDevice::addr_to_mem(reg_t dev_offset, size_t size,
 
 ////////////////////////////////////////////////////////////////////////////////
 
-RAMDevice::RAMDevice(size_t size) : size(size) {
-  data = (uint8_t *)calloc(1, size);
+RAMDevice::RAMDevice(size_t size, bool sparse)
+    : data(nullptr), size(size), sparse(sparse && size) {
+  if (this->sparse) {
+    // Only reserve address space. The kernel commits zero-filled pages the
+    // first time they are touched.
+    void *mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapping != MAP_FAILED) {
+      data = (uint8_t *)mapping;
+    }
+  } else {
+    data = (uint8_t *)calloc(1, size);
+  }
   if (size && !data) {
     throw std::runtime_error("couldn't allocate " + std::to_string(size) +
                              " bytes of target memory");
   }
 }
 
+RAMDevice::~RAMDevice() {
+  if (!data) {
+    return;
+  }
+  if (sparse) {
+    munmap(data, size);
+  } else {
+    free(data);
+  }
+}
+
 uint8_t *RAMDevice::addr_to_mem(reg_t dev_offset, size_t size,
                                 unit_id_t unit_id) {
   if ((dev_offset + size) <= mem_size()) {
@@ -100,6 +126,21 @@ uint8_t *RAMDevice::addr_to_mem(reg_t dev_offset, size_t size,
   return nullptr;
 }
 
+bool RAMDevice::discard(reg_t dev_offset, size_t size) {
+  if (!sparse || (dev_offset + size) > mem_size()) {
+    return false;
+  }
+  // Round the range inwards to whole pages, so that neighbouring data that
+  // shares the first or last page is preserved.
+  const reg_t page_size = sysconf(_SC_PAGESIZE);
+  reg_t start = (dev_offset + page_size - 1) & ~(page_size - 1);
+  reg_t end = (dev_offset + size) & ~(page_size - 1);
+  if (start >= end) {
+    return false;
+  }
+  return madvise(data + start, end - start, MADV_DONTNEED) == 0;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 uint8_t *ROMDevice::addr_to_mem(reg_t dev_offset, size_t size,
@@ -208,6 +249,31 @@ uint8_t *BufferDevice::addr_to_mem(reg_t dev_offset, size_t size,
 
 ////////////////////////////////////////////////////////////////////////////////
 
+namespace {
+/// @brief Recent find_device lookup, mapping the address range [base, limit)
+/// to a device. The range extends to the next device's base address, which
+/// matches the result of searching the device map.
+struct device_cache_entry {
+  uint64_t generation = 0;
+  reg_t base = 0;
+  reg_t limit = 0;
+  MemoryDevice *device = nullptr;
+};
+
+constexpr size_t device_cache_size = 8;
+
+// Each thread keeps its own cache of lookups, which means that simulated
+// harts and host threads never contend on cache entries. Entries are only
+// valid for the memory map generation they were created for.
+thread_local device_cache_entry device_cache[device_cache_size];
+
+std::atomic<uint64_t> last_generation{0};
+}  // namespace
+
+uint64_t MemoryController::new_generation() {
+  return ++last_generation;
+}
+
 MemoryController::MemoryController(MemoryDevice*root_device) {
   add_device(0, root_device);
 }
@@ -227,6 +293,7 @@ bool MemoryController::add_device(reg_t addr, MemoryDevice* device) {
   // iteration over this sort, which it does. (python's
   // SortedDict is a good analogy)
   devices[addr] = device;
+  generation = new_generation();
   return true;
 }
 
@@ -237,10 +304,20 @@ MemoryDevice *MemoryController::remove_device(reg_t addr) {
   }
   MemoryDevice *device = it->second;
   devices.erase(it);
+  generation = new_generation();
   return device;
 }
 
 std::pair<reg_t, MemoryDevice*> MemoryController::find_device(reg_t addr) {
+  // Fast path: the address is in a range that was recently looked up.
+  uint64_t current_gen = generation.load(std::memory_order_acquire);
+  device_cache_entry &entry =
+      device_cache[((addr >> 20) ^ current_gen) % device_cache_size];
+  if ((entry.generation == current_gen) && (addr >= entry.base) &&
+      (addr < entry.limit)) {
+    return std::make_pair(entry.base, entry.device);
+  }
+
   // Find the device with the base address closest to but
   // less than addr (price-is-right search)
   auto it = devices.upper_bound(addr);
@@ -252,7 +329,12 @@ std::pair<reg_t, MemoryDevice*> MemoryController::find_device(reg_t addr) {
   // Found at least one item with base address <= addr
   // The iterator points to the device after this, so
   // go back by one item.
+  reg_t limit = (it == devices.end()) ? ~(reg_t)0 : it->first;
   it--;
+  entry.generation = current_gen;
+  entry.base = it->first;
+  entry.limit = limit;
+  entry.device = it->second;
   return std::make_pair(it->first, it->second);
 }
 
@@ -23,6 +23,8 @@
 
 #define STB_GLOBAL 1
 
+#define PF_W (1 << 1)
+
 #define ELF32_ST_BIND(i)    ((i)>>4)
 #define ELF32_ST_TYPE(i)    ((i)&0xf)
 #define ELF32_ST_INFO(b,t)  (((b)<<4)+((t)&0xf))
@@ -80,6 +82,7 @@ bool ELFProgram::read(MemoryDevice &src, unit_id_t unit) {
       segment.file_size = header.p_filesz;
       segment.memory_size = header.p_memsz;
       segment.data = nullptr;
+      segment.writable = (header.p_flags & PF_W) != 0;
 
       // Load segment data from the ELF file.
       if (header.p_filesz > 0) {
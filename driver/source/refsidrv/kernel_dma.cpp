@@ -15,14 +15,22 @@
 // SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
 
 #include "kernel_dma.h"
+#include "refsi_memory_window.h"
 #include "slim_sim.h"
 #include "device/dma_regs.h"
 
+#include <algorithm>
+
 DMADevice::~DMADevice() {
-  for (auto &mapping : dma_reg_contents) {
-    delete [] mapping.second;
+  // Let the DMA threads finish any outstanding transfers before stopping.
+  {
+    std::unique_lock<std::mutex> lock(queue_lock);
+    stopping = true;
+    queued.notify_all();
+  }
+  for (auto &queue : queues) {
+    queue->thread.join();
   }
-  dma_reg_contents.clear();
 }
 
 bool DMADevice::load(reg_t addr, size_t len, uint8_t *bytes,
@@ -87,18 +95,171 @@ size_t DMADevice::mem_size() const {
   return REFSI_DMA_NUM_REGS * sizeof(uint64_t);
 }
 
+dma_channel * DMADevice::get_channel(unit_id_t unit_id) {
+  std::unique_lock<std::mutex> lock(channel_lock);
+  std::unique_ptr<dma_channel> &channel = channels[unit_id];
+  if (!channel) {
+    channel.reset(new dma_channel());
+  }
+  return channel.get();
+}
+
 uint64_t * DMADevice::get_dma_regs(unit_id_t unit_id) {
-  uint64_t *contents = nullptr;
-  auto it = dma_reg_contents.find(unit_id);
-  if (it == dma_reg_contents.end()) {
-    constexpr const size_t num_regs = REFSI_DMA_NUM_REGS;
-    contents = new uint64_t[num_regs];
-    memset(contents, 0, num_regs * sizeof(uint64_t));
-    dma_reg_contents[unit_id] = contents;
-  } else {
-    contents = it->second;
+  return get_channel(unit_id)->regs;
+}
+
+bool DMADevice::is_wait_reg(reg_t addr) const {
+  return addr == REFSI_DMA_REG_ADDR(base_addr, REFSI_REG_DMADONESEQ);
+}
+
+bool DMADevice::get_pending_wait(unit_id_t unit_id, uint32_t &xfer_id) {
+  dma_channel *channel = get_channel(unit_id);
+  xfer_id = channel->pending_wait_id;
+  return xfer_id != 0;
+}
+
+bool DMADevice::is_transfer_done(unit_id_t unit_id, uint32_t xfer_id) {
+  dma_channel *channel = get_channel(unit_id);
+  return channel->done_seq.load(std::memory_order_acquire) >= xfer_id;
+}
+
+void DMADevice::wait_for_transfer(unit_id_t unit_id, uint32_t xfer_id) {
+  dma_channel *channel = get_channel(unit_id);
+  std::unique_lock<std::mutex> lock(queue_lock);
+  completed.wait(lock, [&] {
+    return channel->done_seq.load(std::memory_order_acquire) >= xfer_id;
+  });
+}
+
+void DMADevice::wait_idle() {
+  std::unique_lock<std::mutex> lock(queue_lock);
+  completed.wait(lock, [&] { return num_pending == 0; });
+}
+
+void DMADevice::set_timing(
+    const dma_timing_config &config,
+    std::function<uint64_t(unit_id_t)> read_cycles,
+    std::function<void(unit_id_t, uint64_t)> write_cycles) {
+  timing = config;
+  timing.num_engines = std::max(timing.num_engines, 1u);
+  this->read_cycles = read_cycles;
+  this->write_cycles = write_cycles;
+}
+
+dma_timing_stats DMADevice::get_timing_stats() const {
+  dma_timing_stats stats;
+  stats.busy_cycles = busy_cycles.load(std::memory_order_relaxed);
+  stats.idle_cycles = idle_cycles.load(std::memory_order_relaxed);
+  return stats;
+}
+
+void DMADevice::set_timing_stats(const dma_timing_stats &stats) {
+  busy_cycles.store(stats.busy_cycles, std::memory_order_relaxed);
+  idle_cycles.store(stats.idle_cycles, std::memory_order_relaxed);
+}
+
+bool DMADevice::is_timed(unit_id_t unit_id) const {
+  // Only harts have a cycle counter that transfers can be timed against.
+  return (timing.bytes_per_cycle > 0) && read_cycles && write_cycles &&
+         (get_unit_kind(unit_id) == unit_kind::acc_hart);
+}
+
+void DMADevice::time_transfers(unit_id_t unit_id, dma_channel *channel,
+                               uint32_t xfer_id, const dma_transfer *xfers,
+                               size_t num_xfers) {
+  // Forget about transfers the unit can already see as complete.
+  get_done_seq(unit_id, channel);
+
+  // The setup latency is paid once per chain.
+  uint64_t num_bytes = 0;
+  for (size_t i = 0; i < num_xfers; i++) {
+    uint64_t xfer_bytes = xfers[i].sizes[0];
+    for (unsigned j = 1; j < xfers[i].num_dims; j++) {
+      xfer_bytes *= xfers[i].sizes[j];
+    }
+    num_bytes += xfer_bytes;
+  }
+  uint64_t num_cycles = timing.setup_cycles +
+      ((num_bytes + timing.bytes_per_cycle - 1) / timing.bytes_per_cycle);
+
+  // Start the transfer on the engine that becomes available first. Engines
+  // that were used before and have been waiting since count as idle.
+  uint64_t now = read_cycles(unit_id);
+  std::vector<uint64_t> &engines = channel->engine_busy_until;
+  engines.resize(timing.num_engines, 0);
+  auto engine = std::min_element(engines.begin(), engines.end());
+  uint64_t start_cycle = std::max(now, *engine);
+  if (*engine != 0) {
+    idle_cycles.fetch_add(start_cycle - *engine, std::memory_order_relaxed);
+  }
+  busy_cycles.fetch_add(num_cycles, std::memory_order_relaxed);
+  *engine = start_cycle + num_cycles;
+
+  // Transfers started by a unit complete in order, even when they are
+  // performed by different engines.
+  uint64_t done_cycle = std::max(*engine, channel->last_done_cycle);
+  channel->last_done_cycle = done_cycle;
+  channel->timed_xfers.push_back({xfer_id, done_cycle});
+  if (debug) {
+    fprintf(stderr, "dma_device_t::do_kernel_dma() Transfer with ID %d "
+            "completes at cycle %zd (%zd bytes, %zd cycles)\n", xfer_id,
+            done_cycle, num_bytes, num_cycles);
+  }
+}
+
+uint32_t DMADevice::get_done_seq(unit_id_t unit_id, dma_channel *channel) {
+  uint32_t done_seq = channel->done_seq.load(std::memory_order_acquire);
+  std::deque<dma_timed_transfer> &timed_xfers = channel->timed_xfers;
+  if (timed_xfers.empty() || !is_timed(unit_id)) {
+    return done_seq;
+  }
+
+  // Timed transfers are only complete once they have been executed and the
+  // unit has reached their completion cycle.
+  uint64_t now = read_cycles(unit_id);
+  while (!timed_xfers.empty() && (timed_xfers.front().xfer_id <= done_seq) &&
+         (timed_xfers.front().done_cycle <= now)) {
+    timed_xfers.pop_front();
+  }
+  if (timed_xfers.empty()) {
+    return done_seq;
+  }
+  return std::min(done_seq, timed_xfers.front().xfer_id - 1);
+}
+
+void DMADevice::stall_for_transfer(unit_id_t unit_id, dma_channel *channel,
+                                   uint32_t xfer_id) {
+  if (!is_timed(unit_id)) {
+    return;
+  }
+  uint64_t done_cycle = 0;
+  std::deque<dma_timed_transfer> &timed_xfers = channel->timed_xfers;
+  while (!timed_xfers.empty() && (timed_xfers.front().xfer_id <= xfer_id)) {
+    done_cycle = timed_xfers.front().done_cycle;
+    timed_xfers.pop_front();
+  }
+  uint64_t now = read_cycles(unit_id);
+  if (done_cycle > now) {
+    if (debug) {
+      fprintf(stderr, "dma_device_t::write_dma_reg() Stalled for %zd cycles "
+              "waiting for transfer ID %d\n", done_cycle - now, xfer_id);
+    }
+    write_cycles(unit_id, done_cycle);
+  }
+}
+
+bool DMADevice::check_failed(dma_channel *channel, uint32_t xfer_id) {
+  uint32_t failed_seq = channel->failed_seq.load(std::memory_order_relaxed);
+  if ((failed_seq == 0) || (failed_seq > xfer_id)) {
+    return false;
   }
-  return contents;
+  // DMA threads only record a failure once the previous one was reported.
+  channel->failed_seq.store(0, std::memory_order_relaxed);
+  if (debug) {
+    fprintf(stderr, "dma_device_t::write_dma_reg() Transfer with ID %d "
+            "failed\n", failed_seq);
+  }
+  return true;
 }
 
 bool DMADevice::get_dma_reg(reg_t rel_addr, size_t &dma_reg) const {
@@ -114,8 +275,12 @@ bool DMADevice::get_dma_reg(reg_t rel_addr, size_t &dma_reg) const {
 
 bool DMADevice::read_dma_reg(size_t dma_reg, uint64_t *val,
                                 unit_id_t unit_id) {
-  uint64_t *dma_regs = get_dma_regs(unit_id);
-  *val = dma_regs[dma_reg];
+  dma_channel *channel = get_channel(unit_id);
+  if (dma_reg == REFSI_REG_DMADONESEQ) {
+    *val = get_done_seq(unit_id, channel);
+  } else {
+    *val = channel->regs[dma_reg];
+  }
   if (debug) {
     if (dma_reg == REFSI_REG_DMASTARTSEQ) {
       uint32_t xfer_id = (uint32_t)*val;
@@ -128,21 +293,32 @@ bool DMADevice::read_dma_reg(size_t dma_reg, uint64_t *val,
 
 bool DMADevice::write_dma_reg(size_t dma_reg, uint64_t val,
                                  unit_id_t unit_id) {
-  uint64_t *dma_regs = get_dma_regs(unit_id);
+  dma_channel *channel = get_channel(unit_id);
+  uint64_t *dma_regs = channel->regs;
 
   if (dma_reg == REFSI_REG_DMADONESEQ) {
-    // Writing to DMADONESEQ has special behaviour. The current hart is blocked
-    // until the transfer identified by val is complete.
+    // Writing to DMADONESEQ has special behaviour. The current unit is blocked
+    // until the transfer identified by val is complete. The write fails when a
+    // transfer the unit waited for could not access memory.
     uint32_t xfer_id = (uint32_t)val;
-    uint32_t last_done_id = (uint32_t)dma_regs[REFSI_REG_DMADONESEQ];
-    // TODO Implement the waiting logic. This can be implemented in a similar
-    // way as waiting for barriers. Waiting is not required at the moment, as
-    // DMA transfers happen instantaneously from the perspective of the hart.
+    channel->pending_wait_id = 0;
+    if (is_transfer_done(unit_id, xfer_id)) {
+      stall_for_transfer(unit_id, channel, xfer_id);
+      return !check_failed(channel, xfer_id);
+    }
     if (debug) {
       fprintf(stderr, "dma_device_t::write_dma_reg() Waiting for transfer "
               "ID %d\n", xfer_id);
     }
-    return last_done_id >= xfer_id;
+    if (get_unit_kind(unit_id) == unit_kind::acc_hart) {
+      // Blocking here would stop other harts from running. Instead, fail the
+      // store and record the transfer, so that the hart can be parked (like
+      // for barriers) and retry the store once the transfer has completed.
+      channel->pending_wait_id = xfer_id;
+      return false;
+    }
+    wait_for_transfer(unit_id, xfer_id);
+    return !check_failed(channel, xfer_id);
   }
 
   // Determine the write mask for the register, i.e. which bits can be written
@@ -223,32 +399,61 @@ bool DMADevice::write_dma_reg(size_t dma_reg, uint64_t val,
 bool DMADevice::do_kernel_dma(unit_id_t unit_id) {
   uint64_t *dma_regs = get_dma_regs(unit_id);
 
-  // Get a pointer to the source buffer.
-  reg_t src_addr = dma_regs[REFSI_REG_DMASRCADDR];
-  uint8_t *src_mem = (uint8_t *)mem_if.addr_to_mem(src_addr, 0, unit_id);
-  if (!src_mem) {
-    // This should only happen for 'special' memory like hart-local memory or
-    // ROM, neither of which are currently supported by in-kernel DMA.
+  // Chained transfers are described by a list of descriptors in memory.
+  if (dma_regs[REFSI_REG_DMACTRL] & REFSI_DMA_CHAIN) {
+    std::vector<dma_transfer> xfers;
+    if (!prepare_chain(unit_id, dma_regs, xfers)) {
+      return false;
+    }
+    start_transfers(unit_id, xfers.data(), xfers.size());
+    return true;
+  }
+
+  // Otherwise the transfer is described by the DMA registers.
+  dma_transfer xfer;
+  if (!prepare_transfer(unit_id, dma_regs, xfer)) {
     return false;
+  } else if (xfer.num_dims > 0) {
+    start_transfers(unit_id, &xfer, 1);
   }
+  return true;
+}
 
-  // Get a pointer to the destination buffer.
-  reg_t dst_addr = dma_regs[REFSI_REG_DMADSTADDR];
-  uint8_t *dst_mem = (uint8_t *)mem_if.addr_to_mem(dst_addr, 0, unit_id);
-  if (!dst_mem) {
-    // This should only happen for 'special' memory like hart-local memory or
-    // ROM, neither of which are currently supported by in-kernel DMA.
+bool DMADevice::prepare_transfer(unit_id_t unit_id, const uint64_t *dma_regs,
+                                 dma_transfer &xfer) {
+  // Validate the transfer mode.
+  reg_t mode = dma_regs[REFSI_REG_DMACTRL] & REFSI_DMA_MODE_MASK;
+  if (mode == REFSI_DMA_FILL) {
+    reg_t fill_size = dma_regs[REFSI_REG_DMAFILLSIZE];
+    if ((fill_size == 0) || (fill_size > REFSI_DMA_MAX_FILL_PATTERN_SIZE)) {
+      if (debug) {
+        fprintf(stderr, "dma_device_t::do_kernel_dma() Invalid fill pattern "
+                "size: %zd\n", fill_size);
+      }
+      return false;
+    }
+    // Capture the fill pattern, since the registers can be changed as soon as
+    // the transfer has been started.
+    xfer.fill_size = fill_size;
+    memcpy(xfer.fill_pattern, &dma_regs[REFSI_REG_DMAFILLPATTERN0], fill_size);
+  } else if ((mode != REFSI_DMA_COPY) && (mode != REFSI_DMA_BROADCAST)) {
+    if (debug) {
+      fprintf(stderr, "dma_device_t::do_kernel_dma() Invalid mode: 0x%zx\n",
+              mode);
+    }
     return false;
   }
+  xfer.mode = mode;
 
   // Validate the transfer dimension.
+  bool valid = false;
   reg_t dim = dma_regs[REFSI_REG_DMACTRL] & REFSI_DMA_DIM_MASK;
   if (dim == REFSI_DMA_1D) {
-    return do_kernel_dma_1d(unit_id, dst_mem, src_mem);
+    valid = do_kernel_dma_1d(dma_regs, xfer);
   } else if (dim == REFSI_DMA_2D) {
-    return do_kernel_dma_2d(unit_id, dst_mem, src_mem);
+    valid = do_kernel_dma_2d(dma_regs, xfer);
   } else if (dim == REFSI_DMA_3D) {
-    return do_kernel_dma_3d(unit_id, dst_mem, src_mem);
+    valid = do_kernel_dma_3d(dma_regs, xfer);
   } else {
     if (debug) {
       fprintf(stderr, "dma_device_t::do_kernel_dma() Invalid dimension: %zd\n",
@@ -256,15 +461,154 @@ bool DMADevice::do_kernel_dma(unit_id_t unit_id) {
     }
     return false;
   }
+
+  if (!valid || (xfer.num_dims == 0)) {
+    return valid;
+  }
+
+  // Fills have no source and follow the layout of the destination.
+  if (mode == REFSI_DMA_FILL) {
+    for (unsigned i = 0; i < 3; i++) {
+      xfer.src_strides[i] = xfer.dst_strides[i];
+    }
+  }
+
+  // Resolve the buffers on behalf of the unit that started the transfer, so
+  // that per-hart memory windows map to that hart's memory. Transfers to and
+  // from contiguous RAM use host pointers, while other memory is accessed
+  // through the memory interface when the transfer is executed.
+  xfer.unit_id = unit_id;
+  xfer.dst_addr = dma_regs[REFSI_REG_DMADSTADDR];
+  if (!resolve_buffer(xfer.dst_addr, get_extent(xfer, xfer.dst_strides),
+                      unit_id, true, xfer.dst_mem)) {
+    return false;
+  }
+  if (mode != REFSI_DMA_FILL) {
+    xfer.src_addr = dma_regs[REFSI_REG_DMASRCADDR];
+    if (!resolve_buffer(xfer.src_addr, get_extent(xfer, xfer.src_strides),
+                        unit_id, false, xfer.src_mem)) {
+      return false;
+    }
+  }
+  return true;
 }
 
-bool DMADevice::do_kernel_dma_1d(unit_id_t unit_id, uint8_t *dst_mem,
-                                    uint8_t *src_mem) {
-  uint64_t *dma_regs = get_dma_regs(unit_id);
+reg_t DMADevice::get_extent(const dma_transfer &xfer, const reg_t *strides) {
+  reg_t extent = xfer.sizes[0];
+  for (unsigned i = 1; i < xfer.num_dims; i++) {
+    extent += (xfer.sizes[i] - 1) * strides[i - 1];
+  }
+  return extent;
+}
+
+bool DMADevice::resolve_buffer(reg_t addr, reg_t size, unit_id_t unit_id,
+                               bool is_dst, uint8_t *&mem) {
+  mem = mem_if.addr_to_mem(addr, size, unit_id);
+  if (mem) {
+    return true;
+  }
+
+  // Other buffers are accessed through the device they start in, looking
+  // through memory windows. Only ROM is accessed this way: memory-mapped
+  // registers have side effects that must not happen on a DMA thread, out of
+  // order with the unit's own accesses. The buffer must fit in the device.
+  reg_t dev_offset = 0;
+  MemoryDevice *device = mem_if.find_device(addr, dev_offset);
+  if (auto *window = dynamic_cast<RefSiMemoryWindow *>(device)) {
+    device = window->resolve(dev_offset, size, unit_id, dev_offset);
+  }
+  if (is_dst || !dynamic_cast<ROMDevice *>(device) ||
+      ((dev_offset + size) > device->mem_size())) {
+    if (debug) {
+      fprintf(stderr, "dma_device_t::do_kernel_dma() Invalid buffer at "
+              "0x%zx (size %zd) for unit %s\n", addr, size,
+              format_unit(unit_id).c_str());
+    }
+    return false;
+  }
+  return true;
+}
+
+bool DMADevice::prepare_chain(unit_id_t unit_id, const uint64_t *dma_regs,
+                              std::vector<dma_transfer> &xfers) {
+  // Descriptors override the transfer registers. Other registers, such as the
+  // fill pattern, are taken from the unit's DMA registers.
+  uint64_t desc_regs[REFSI_DMA_NUM_REGS];
+  memcpy(desc_regs, dma_regs, sizeof(desc_regs));
+  reg_t desc_addr = dma_regs[REFSI_REG_DMADESCADDR];
+  for (size_t i = 0; desc_addr != 0; i++) {
+    if (i >= max_chain_length) {
+      if (debug) {
+        fprintf(stderr, "dma_device_t::do_kernel_dma() Chain has more than "
+                "%zd descriptors\n", max_chain_length);
+      }
+      return false;
+    }
+    uint64_t desc[REFSI_DMA_DESC_NUM_FIELDS];
+    if (!mem_if.load(desc_addr, sizeof(desc), (uint8_t *)desc, unit_id)) {
+      return false;
+    }
+    desc_regs[REFSI_REG_DMACTRL] = desc[REFSI_DMA_DESC_CTRL];
+    desc_regs[REFSI_REG_DMASRCADDR] = desc[REFSI_DMA_DESC_SRCADDR];
+    desc_regs[REFSI_REG_DMADSTADDR] = desc[REFSI_DMA_DESC_DSTADDR];
+    for (unsigned j = 0; j < 3; j++) {
+      desc_regs[REFSI_REG_DMAXFERSIZE0 + j] = desc[REFSI_DMA_DESC_XFERSIZE0 + j];
+    }
+    for (unsigned j = 0; j < 2; j++) {
+      desc_regs[REFSI_REG_DMAXFERSRCSTRIDE0 + j] =
+          desc[REFSI_DMA_DESC_XFERSRCSTRIDE0 + j];
+      desc_regs[REFSI_REG_DMAXFERDSTSTRIDE0 + j] =
+          desc[REFSI_DMA_DESC_XFERDSTSTRIDE0 + j];
+    }
+    if (desc_regs[REFSI_REG_DMACTRL] & REFSI_DMA_CHAIN) {
+      return false;  // Descriptors cannot start other chains.
+    }
+
+    dma_transfer xfer;
+    if (!prepare_transfer(unit_id, desc_regs, xfer)) {
+      return false;
+    } else if (xfer.num_dims > 0) {
+      xfers.push_back(xfer);
+    }
+    desc_addr = desc[REFSI_DMA_DESC_NEXT];
+  }
+  return true;
+}
+
+void DMADevice::start_transfers(unit_id_t unit_id, dma_transfer *xfers,
+                                size_t num_xfers) {
+  if (num_xfers == 0) {
+    return;
+  }
+
+  // Allocate a new ID for the transfer. All transfers in a chain share it.
+  dma_channel *channel = get_channel(unit_id);
+  uint64_t *dma_regs = channel->regs;
+  uint32_t xfer_id = (uint32_t)dma_regs[REFSI_REG_DMASTARTSEQ] + 1;
+  dma_regs[REFSI_REG_DMASTARTSEQ] = xfer_id;
+  if (is_timed(unit_id)) {
+    time_transfers(unit_id, channel, xfer_id, xfers, num_xfers);
+  }
+
+  // Perform the transfer. Transfers started by a unit are executed in order,
+  // so the transfer is complete once the last part has been executed.
+  if (debug) {
+    fprintf(stderr, "dma_device_t::do_kernel_dma() Started transfer with ID "
+            "%d (%zd part(s))\n", xfer_id, num_xfers);
+  }
+  for (size_t i = 0; i < num_xfers; i++) {
+    xfers[i].xfer_id = xfer_id;
+    xfers[i].completes_transfer = ((i + 1) == num_xfers);
+    submit_transfer(unit_id, xfers[i]);
+  }
+}
 
+bool DMADevice::do_kernel_dma_1d(const uint64_t *dma_regs,
+                                 dma_transfer &xfer) {
   // Retrieve the size of the transfer.
   reg_t size = dma_regs[REFSI_REG_DMAXFERSIZE0];
   if (size == 0) {
+    xfer.num_dims = 0;
     return true;
   }
 
@@ -279,20 +623,8 @@ bool DMADevice::do_kernel_dma_1d(unit_id_t unit_id, uint8_t *dst_mem,
     return false;
   }
 
-  // Allocate a new ID for the transfer.
-  uint32_t xfer_id = (uint32_t)dma_regs[REFSI_REG_DMASTARTSEQ] + 1;
-  dma_regs[REFSI_REG_DMASTARTSEQ] = xfer_id;
-
-  // Perform the transfer.
-  if (debug) {
-    fprintf(stderr, "dma_device_t::do_kernel_dma_1d() Started transfer with ID "
-            "%d\n", xfer_id);
-  }
-  memcpy(dst_mem, src_mem, size);
-
-  // Mark the transfer as completed.
-  dma_regs[REFSI_REG_DMADONESEQ] = xfer_id;
-
+  xfer.num_dims = 1;
+  xfer.sizes[0] = size;
   return true;
 }
 
@@ -310,9 +642,8 @@ static const char * get_stride_mode_text(reg_t stride_mode) {
   }
 }
 
-bool DMADevice::do_kernel_dma_2d(unit_id_t unit_id, uint8_t *dst_mem,
-                                    uint8_t *src_mem) {
-  uint64_t *dma_regs = get_dma_regs(unit_id);
+bool DMADevice::do_kernel_dma_2d(const uint64_t *dma_regs,
+                                 dma_transfer &xfer) {
   reg_t sizes[2];
   reg_t src_strides[2];
   reg_t dst_strides[2];
@@ -321,6 +652,7 @@ bool DMADevice::do_kernel_dma_2d(unit_id_t unit_id, uint8_t *dst_mem,
   sizes[0] = dma_regs[REFSI_REG_DMAXFERSIZE0 + 0];
   sizes[1] = dma_regs[REFSI_REG_DMAXFERSIZE0 + 1];
   if (sizes[0] == 0 || sizes[1] == 0) {
+    xfer.num_dims = 0;
     return true;
   }
   for (uint i = 0; i < 2; i++) {
@@ -355,30 +687,27 @@ bool DMADevice::do_kernel_dma_2d(unit_id_t unit_id, uint8_t *dst_mem,
     }
   }
 
-  // Allocate a new ID for the transfer.
-  uint32_t xfer_id = (uint32_t)dma_regs[REFSI_REG_DMASTARTSEQ] + 1;
-  dma_regs[REFSI_REG_DMASTARTSEQ] = xfer_id;
+  // Broadcast transfers read the same row for each destination row.
+  reg_t mode = dma_regs[REFSI_REG_DMACTRL] & REFSI_DMA_MODE_MASK;
+  if (mode == REFSI_DMA_BROADCAST) {
+    src_strides[0] = 0;
+  }
 
-  // Perform the transfer.
   if (debug) {
-    fprintf(stderr, "dma_device_t::do_kernel_dma_2d() Started %s transfer with "
-                    "ID %d\n", mode_text, xfer_id);
+    fprintf(stderr, "dma_device_t::do_kernel_dma_2d() Prepared %s transfer\n",
+            mode_text);
   }
-  for (uint y = 0; y < sizes[1]; y++) {
-    memcpy(dst_mem, src_mem, sizes[0]);
-    dst_mem += dst_strides[0];
-    src_mem += src_strides[0];
+  xfer.num_dims = 2;
+  for (uint i = 0; i < 2; i++) {
+    xfer.sizes[i] = sizes[i];
+    xfer.src_strides[i] = src_strides[i];
+    xfer.dst_strides[i] = dst_strides[i];
   }
-
-  // Mark the transfer as completed.
-  dma_regs[REFSI_REG_DMADONESEQ] = xfer_id;
-
   return true;
 }
 
-bool DMADevice::do_kernel_dma_3d(unit_id_t unit_id, uint8_t *dst_mem,
-                                    uint8_t *src_mem) {
-  uint64_t *dma_regs = get_dma_regs(unit_id);
+bool DMADevice::do_kernel_dma_3d(const uint64_t *dma_regs,
+                                 dma_transfer &xfer) {
   reg_t sizes[3];
   reg_t src_strides[3];
   reg_t dst_strides[3];
@@ -388,11 +717,14 @@ bool DMADevice::do_kernel_dma_3d(unit_id_t unit_id, uint8_t *dst_mem,
   sizes[1] = dma_regs[REFSI_REG_DMAXFERSIZE0 + 1];
   sizes[2] = dma_regs[REFSI_REG_DMAXFERSIZE0 + 2];
   if (sizes[0] == 0 || sizes[1] == 0|| sizes[2] == 0) {
+    xfer.num_dims = 0;
     return true;
   }
+  // Rows and planes are contiguous unless strides are specified.
   for (uint i = 0; i < 3; i++) {
     src_strides[i] = dst_strides[i] = sizes[i];
   }
+  src_strides[1] = dst_strides[1] = sizes[0] * sizes[1];
 
   // Retrieve the stride mode.
   reg_t stride_mode = dma_regs[REFSI_REG_DMACTRL] & REFSI_DMA_STRIDE_MODE_MASK;
@@ -424,27 +756,265 @@ bool DMADevice::do_kernel_dma_3d(unit_id_t unit_id, uint8_t *dst_mem,
     }
   }
 
-  // Allocate a new ID for the transfer.
-  uint32_t xfer_id = (uint32_t)dma_regs[REFSI_REG_DMASTARTSEQ] + 1;
-  dma_regs[REFSI_REG_DMASTARTSEQ] = xfer_id;
+  // Broadcast transfers read the same row for each destination row.
+  reg_t mode = dma_regs[REFSI_REG_DMACTRL] & REFSI_DMA_MODE_MASK;
+  if (mode == REFSI_DMA_BROADCAST) {
+    src_strides[0] = src_strides[1] = 0;
+  }
 
-  // Perform the transfer.
   if (debug) {
-    fprintf(stderr, "dma_device_t::do_kernel_dma_3d() Started %s transfer with "
-                    "ID %d\n", mode_text, xfer_id);
+    fprintf(stderr, "dma_device_t::do_kernel_dma_3d() Prepared %s transfer\n",
+            mode_text);
+  }
+  xfer.num_dims = 3;
+  for (uint i = 0; i < 3; i++) {
+    xfer.sizes[i] = sizes[i];
+    xfer.src_strides[i] = src_strides[i];
+    xfer.dst_strides[i] = dst_strides[i];
+  }
+  return true;
+}
+
+/// @brief Merge dimensions of a transfer that are contiguous in both the
+/// source and destination buffers, e.g. a 2D transfer whose strides are equal
+/// to the row size becomes a single 1D copy.
+static void coalesce_transfer(dma_transfer &xfer) {
+  // Merge rows into the first dimension while they are contiguous. The fill
+  // pattern restarts at each row, so rows can only be merged for fills when
+  // they hold a whole number of patterns.
+  bool can_merge_rows = (xfer.mode != REFSI_DMA_FILL) ||
+                        ((xfer.sizes[0] % xfer.fill_size) == 0);
+  while (can_merge_rows && (xfer.num_dims > 1) &&
+         (xfer.src_strides[0] == xfer.sizes[0]) &&
+         (xfer.dst_strides[0] == xfer.sizes[0])) {
+    xfer.sizes[0] *= xfer.sizes[1];
+    for (unsigned i = 1; (i + 1) < xfer.num_dims; i++) {
+      xfer.sizes[i] = xfer.sizes[i + 1];
+      xfer.src_strides[i - 1] = xfer.src_strides[i];
+      xfer.dst_strides[i - 1] = xfer.dst_strides[i];
+    }
+    xfer.num_dims--;
+  }
+
+  // Merge planes into rows when planes follow each other without a gap.
+  if ((xfer.num_dims == 3) &&
+      (xfer.src_strides[1] == (xfer.sizes[1] * xfer.src_strides[0])) &&
+      (xfer.dst_strides[1] == (xfer.sizes[1] * xfer.dst_strides[0]))) {
+    xfer.sizes[1] *= xfer.sizes[2];
+    xfer.num_dims = 2;
+  }
+}
+
+/// @brief Copy rows whose size is known at compile time, which lets the
+/// compiler replace calls to memcpy with a few loads and stores.
+template <size_t RowSize>
+static void copy_fixed_rows(uint8_t *dst_mem, const uint8_t *src_mem,
+                            reg_t num_rows, reg_t dst_stride,
+                            reg_t src_stride) {
+  for (reg_t i = 0; i < num_rows; i++) {
+    memcpy(dst_mem, src_mem, RowSize);
+    dst_mem += dst_stride;
+    src_mem += src_stride;
+  }
+}
+
+/// @brief Copy a number of equally-sized rows between strided buffers. Narrow
+/// rows are common for tiles and are copied without calling memcpy per row.
+static void copy_rows(uint8_t *dst_mem, const uint8_t *src_mem,
+                      reg_t row_size, reg_t num_rows, reg_t dst_stride,
+                      reg_t src_stride) {
+  switch (row_size) {
+  case 1:
+    return copy_fixed_rows<1>(dst_mem, src_mem, num_rows, dst_stride,
+                              src_stride);
+  case 2:
+    return copy_fixed_rows<2>(dst_mem, src_mem, num_rows, dst_stride,
+                              src_stride);
+  case 4:
+    return copy_fixed_rows<4>(dst_mem, src_mem, num_rows, dst_stride,
+                              src_stride);
+  case 8:
+    return copy_fixed_rows<8>(dst_mem, src_mem, num_rows, dst_stride,
+                              src_stride);
+  case 16:
+    return copy_fixed_rows<16>(dst_mem, src_mem, num_rows, dst_stride,
+                               src_stride);
+  case 32:
+    return copy_fixed_rows<32>(dst_mem, src_mem, num_rows, dst_stride,
+                               src_stride);
+  case 64:
+    return copy_fixed_rows<64>(dst_mem, src_mem, num_rows, dst_stride,
+                               src_stride);
+  default:
+    break;
+  }
+  for (reg_t i = 0; i < num_rows; i++) {
+    memcpy(dst_mem, src_mem, row_size);
+    dst_mem += dst_stride;
+    src_mem += src_stride;
+  }
+}
+
+/// @brief Fill a row with copies of a pattern. The pattern is written once and
+/// the filled part of the row is then doubled until the row is full.
+static void fill_row(uint8_t *dst_mem, reg_t row_size, const uint8_t *pattern,
+                     size_t pattern_size) {
+  if (pattern_size == 1) {
+    memset(dst_mem, pattern[0], row_size);
+    return;
+  }
+  reg_t filled = std::min(row_size, (reg_t)pattern_size);
+  memcpy(dst_mem, pattern, filled);
+  while (filled < row_size) {
+    reg_t to_copy = std::min(filled, row_size - filled);
+    memcpy(dst_mem + filled, dst_mem, to_copy);
+    filled += to_copy;
+  }
+}
+
+void DMADevice::submit_transfer(unit_id_t unit_id, const dma_transfer &xfer) {
+  dma_transfer queued_xfer(xfer);
+  queued_xfer.channel = get_channel(unit_id);
+
+  coalesce_transfer(queued_xfer);
+  if (num_threads == 0) {
+    execute_transfer(queued_xfer);
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(queue_lock);
+  if (queues.empty()) {
+    // Start the DMA threads the first time a transfer is submitted.
+    for (size_t i = 0; i < num_threads; i++) {
+      queues.emplace_back(new dma_queue());
+      queues.back()->thread = std::thread(&DMADevice::dma_worker_main, this, i);
+    }
   }
-  for (uint z = 0; z < sizes[2]; z++) {
-    for (uint y = 0; y < sizes[1]; y++) {
-      memcpy(dst_mem, src_mem, sizes[0]);
-      dst_mem += dst_strides[0];
-      src_mem += src_strides[0];
+  queues[unit_id % queues.size()]->transfers.push_back(queued_xfer);
+  num_pending++;
+  queued.notify_all();
+}
+
+void DMADevice::execute_transfer(const dma_transfer &xfer) {
+  if (!xfer.dst_mem || (!xfer.src_mem && (xfer.mode != REFSI_DMA_FILL))) {
+    // Buffers have been validated when the transfer was started, but the
+    // memory map may have changed since then.
+    if (!execute_indirect_transfer(xfer)) {
+      if (debug) {
+        fprintf(stderr, "dma_device_t::execute_transfer() Transfer with ID %d "
+                "could not access memory\n", xfer.xfer_id);
+      }
+      uint32_t no_failure = 0;
+      xfer.channel->failed_seq.compare_exchange_strong(
+          no_failure, xfer.xfer_id, std::memory_order_relaxed);
     }
-    dst_mem += dst_strides[1] - (sizes[1] * dst_strides[0]);
-    src_mem += src_strides[1] - (sizes[1] * src_strides[0]);
+  } else {
+    execute_direct_transfer(xfer);
   }
 
-  // Mark the transfer as completed.
-  dma_regs[REFSI_REG_DMADONESEQ] = xfer_id;
+  // Mark the transfer as completed, unless other parts of a chained transfer
+  // still need to be executed. Units that wait for a failed transfer are not
+  // blocked forever, but their wait fails.
+  if (xfer.completes_transfer) {
+    xfer.channel->done_seq.store(xfer.xfer_id, std::memory_order_release);
+  }
+}
+
+void DMADevice::execute_direct_transfer(const dma_transfer &xfer) {
+  uint8_t *dst_mem = xfer.dst_mem;
+  uint8_t *src_mem = xfer.src_mem;
+  const reg_t *sizes = xfer.sizes;
+  const reg_t *src_strides = xfer.src_strides;
+  const reg_t *dst_strides = xfer.dst_strides;
+  if (xfer.mode == REFSI_DMA_FILL) {
+    // Fill the first row, then copy it to the other rows.
+    fill_row(dst_mem, sizes[0], xfer.fill_pattern, xfer.fill_size);
+    if (xfer.num_dims >= 2) {
+      copy_rows(dst_mem + dst_strides[0], dst_mem, sizes[0], sizes[1] - 1,
+                dst_strides[0], 0);
+    }
+    if (xfer.num_dims == 3) {
+      for (reg_t z = 1; z < sizes[2]; z++) {
+        copy_rows(dst_mem + (z * dst_strides[1]), dst_mem, sizes[0], sizes[1],
+                  dst_strides[0], 0);
+      }
+    }
+  } else if (xfer.num_dims == 1) {
+    memcpy(dst_mem, src_mem, sizes[0]);
+  } else if (xfer.num_dims == 2) {
+    copy_rows(dst_mem, src_mem, sizes[0], sizes[1], dst_strides[0],
+              src_strides[0]);
+  } else if (xfer.num_dims == 3) {
+    for (reg_t z = 0; z < sizes[2]; z++) {
+      copy_rows(dst_mem, src_mem, sizes[0], sizes[1], dst_strides[0],
+                src_strides[0]);
+      dst_mem += dst_strides[1];
+      src_mem += src_strides[1];
+    }
+  }
+}
 
+bool DMADevice::execute_indirect_transfer(const dma_transfer &xfer) {
+  // Rows are transferred in chunks through a bounce buffer. For fills, chunks
+  // hold a whole number of patterns so that the buffer only needs to be filled
+  // once.
+  const reg_t row_size = xfer.sizes[0];
+  const reg_t num_rows = (xfer.num_dims >= 2) ? xfer.sizes[1] : 1;
+  const reg_t num_planes = (xfer.num_dims == 3) ? xfer.sizes[2] : 1;
+  const bool is_fill = (xfer.mode == REFSI_DMA_FILL);
+  reg_t chunk_size = max_bounce_size;
+  if (is_fill) {
+    chunk_size -= (max_bounce_size % xfer.fill_size);
+  }
+  chunk_size = std::min(row_size, chunk_size);
+  std::vector<uint8_t> buffer(chunk_size);
+  if (is_fill) {
+    fill_row(buffer.data(), chunk_size, xfer.fill_pattern, xfer.fill_size);
+  }
+
+  for (reg_t z = 0; z < num_planes; z++) {
+    for (reg_t y = 0; y < num_rows; y++) {
+      reg_t src_offset = (z * xfer.src_strides[1]) + (y * xfer.src_strides[0]);
+      reg_t dst_offset = (z * xfer.dst_strides[1]) + (y * xfer.dst_strides[0]);
+      for (reg_t x = 0; x < row_size; x += chunk_size) {
+        reg_t len = std::min(chunk_size, row_size - x);
+        if (is_fill) {
+          // The buffer already holds the pattern.
+        } else if (xfer.src_mem) {
+          memcpy(buffer.data(), xfer.src_mem + src_offset + x, len);
+        } else if (!mem_if.load(xfer.src_addr + src_offset + x, len,
+                                buffer.data(), xfer.unit_id)) {
+          return false;
+        }
+        if (xfer.dst_mem) {
+          memcpy(xfer.dst_mem + dst_offset + x, buffer.data(), len);
+        } else if (!mem_if.store(xfer.dst_addr + dst_offset + x, len,
+                                 buffer.data(), xfer.unit_id)) {
+          return false;
+        }
+      }
+    }
+  }
   return true;
 }
+
+void DMADevice::dma_worker_main(size_t worker_idx) {
+  std::unique_lock<std::mutex> lock(queue_lock);
+  dma_queue &queue = *queues[worker_idx];
+  while (true) {
+    queued.wait(lock, [&] { return stopping || !queue.transfers.empty(); });
+    if (queue.transfers.empty()) {
+      break;  // Stopping and there are no transfers left.
+    }
+    dma_transfer xfer = queue.transfers.front();
+    queue.transfers.pop_front();
+
+    // Copy the data without holding the lock, so that other units can start
+    // new transfers in the meantime.
+    lock.unlock();
+    execute_transfer(xfer);
+    lock.lock();
+    num_pending--;
+    completed.notify_all();
+  }
+}
@@ -23,10 +23,14 @@
 #include "riscv/mmu.h"
 #include "trap.h"
 
+#include <cstring>
+#include <thread>
+
 RefSiAccelerator::RefSiAccelerator(RefSiDevice &soc) : soc(soc) {
   vlen = core_vlen;
   elen = core_elen;
-  total_harts = num_harts_per_core;
+  num_cores = soc.getNumCores();
+  harts_per_core = num_harts_per_core;
 }
 
 std::string RefSiAccelerator::getVectorArch() const {
@@ -46,8 +50,17 @@ refsi_result RefSiAccelerator::getPerfCounterReg(uint32_t counter_idx,
   return refsi_success;
 }
 
+slim_sim_t *RefSiAccelerator::getCoreForHart(uint32_t hart_id,
+                                             size_t &local_hart_id) const {
+  size_t core_idx = hart_id / harts_per_core;
+  local_hart_id = hart_id % harts_per_core;
+  return (core_idx < cores.size()) ? cores[core_idx].get() : nullptr;
+}
+
 csr_t *RefSiAccelerator::getCSR(uint32_t hart_id, uint32_t csr_idx) {
-  processor_t *hart = sim->get_hart(hart_id);
+  size_t local_hart_id = 0;
+  slim_sim_t *sim = getCoreForHart(hart_id, local_hart_id);
+  processor_t *hart = sim ? sim->get_hart(local_hart_id) : nullptr;
   if (!hart) {
     return nullptr;
   }
@@ -75,6 +88,38 @@ refsi_result RefSiAccelerator::readPerfCounter(uint32_t counter_id,
   return refsi_success;
 }
 
+refsi_result RefSiAccelerator::readPerfCounters(uint32_t first_counter_id,
+                                                uint32_t count,
+                                                uint32_t hart_id,
+                                                uint64_t *values) {
+  if ((first_counter_id + count) > num_per_hart_perf_counters) {
+    return refsi_failure;
+  }
+  // Look up the hart once for all counters.
+  size_t local_hart_id = 0;
+  slim_sim_t *sim = getCoreForHart(hart_id, local_hart_id);
+  processor_t *hart = sim ? sim->get_hart(local_hart_id) : nullptr;
+  for (uint32_t i = 0; i < count; i++) {
+    reg_t reg_idx = 0;
+    if (refsi_result result = getPerfCounterReg(first_counter_id + i,
+                                                reg_idx)) {
+      return result;
+    }
+    values[i] = 0;
+    if (!hart) {
+      continue;
+    }
+    const auto &csrmap = hart->get_state()->csrmap;
+    auto csr_it = csrmap.find(reg_idx);
+    if (csr_it != csrmap.end()) {
+      values[i] = csr_it->second->read();
+    } else {
+      // 'Missing' performance counter CSRs always read zero.
+    }
+  }
+  return refsi_success;
+}
+
 refsi_result RefSiAccelerator::writePerfCounter(uint32_t counter_id,
                                                 uint32_t hart_id,
                                                 uint64_t &value) {
@@ -91,19 +136,57 @@ refsi_result RefSiAccelerator::writePerfCounter(uint32_t counter_id,
   return refsi_success;
 }
 
+uint64_t RefSiAccelerator::hashCode(const uint8_t *code, size_t size) {
+  // 64-bit FNV-1a, applied to whole words where possible.
+  const uint64_t prime = 0x100000001b3ull;
+  uint64_t hash = 0xcbf29ce484222325ull;
+  size_t i = 0;
+  for (; (i + sizeof(uint64_t)) <= size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, &code[i], sizeof(uint64_t));
+    hash = (hash ^ word) * prime;
+  }
+  for (; i < size; i++) {
+    hash = (hash ^ code[i]) * prime;
+  }
+  return hash;
+}
+
+bool RefSiAccelerator::codeUsesAtomics(const uint8_t *code, size_t size) {
+  // Instructions can start at any 16-bit boundary, and data or padding in the
+  // buffer can make a decoder lose track of where they start. Instead, look for
+  // the AMO major opcode at every 16-bit boundary. This can report atomics that
+  // are not there, but never misses one.
+  const uint8_t opcode_amo = 0x2f;
+  for (size_t i = 0; i < size; i += sizeof(uint16_t)) {
+    if ((code[i] & 0x7f) == opcode_amo) {
+      return true;
+    }
+  }
+  return false;
+}
+
 refsi_result RefSiAccelerator::createSim() {
   if (!getISA()) {
     return refsi_failure;
-  } else if (kernel_config.num_harts > REFSI_SIM_MAX_HARTS) {
+  } else if (harts_per_core > REFSI_SIM_MAX_HARTS) {
     return refsi_failure;
   }
   kernel_config.isa = getISA();
   kernel_config.varch = getVectorArch();
   kernel_config.vlen = getVectorLen();
-  kernel_config.num_harts = total_harts;
-  sim.reset(new slim_sim_t(kernel_config, soc.getMemory()));
-  for (size_t j = 0; j < kernel_config.num_harts; j++) {
-    initializeHart(sim->get_hart(j));
+  kernel_config.num_harts = harts_per_core;
+  kernel_config.interleave = soc.getInterleave();
+  kernel_config.adaptive_interleave = soc.getAdaptiveInterleave();
+  kernel_config.log_interleave = soc.getDebug();
+  cores.clear();
+  for (size_t i = 0; i < num_cores; i++) {
+    kernel_config.hart_id_base = i * harts_per_core;
+    cores.emplace_back(new slim_sim_t(kernel_config, soc.getMemory()));
+    slim_sim_t *sim = cores.back().get();
+    for (size_t j = 0; j < kernel_config.num_harts; j++) {
+      initializeHart(sim->get_hart(j));
+    }
   }
   return refsi_success;
 }
@@ -111,81 +194,170 @@ refsi_result RefSiAccelerator::createSim() {
 refsi_result RefSiAccelerator::runKernelSlice(
     uint64_t num_instances, reg_t entry_point, reg_t return_addr,
     uint32_t num_harts, const hart_state_entry *hart_data) {
-  if (!sim) {
+  RefSiInstanceQueue instances;
+  instances.num_instances = num_instances;
+  instances.entry_point = entry_point;
+  instances.return_addr = return_addr;
+  instances.hart_data = hart_data;
+  return runInstanceQueue(instances, num_harts);
+}
+
+refsi_result RefSiAccelerator::runKernelNDRange(
+    uint64_t num_instances, uint64_t num_slices, reg_t entry_point,
+    reg_t return_addr, uint32_t num_harts, const hart_state_entry *hart_data) {
+  for (uint32_t i = 0; i < num_harts; i++) {
+    if (hart_data[i].num_extra_args == 0) {
+      return refsi_failure;  // No room for the slice ID.
+    }
+  }
+  uint64_t total_instances = num_instances * num_slices;
+  if ((num_instances != 0) && (total_instances / num_instances != num_slices)) {
+    return refsi_failure;
+  }
+  RefSiInstanceQueue instances;
+  instances.num_instances = total_instances;
+  instances.instances_per_slice = num_instances;
+  instances.entry_point = entry_point;
+  instances.return_addr = return_addr;
+  instances.hart_data = hart_data;
+  return runInstanceQueue(instances, num_harts);
+}
+
+refsi_result RefSiAccelerator::runInstanceQueue(RefSiInstanceQueue &instances,
+                                                uint32_t num_harts) {
+  if (cores.empty()) {
     if (refsi_result result = createSim()) {
       return result;
     }
   }
-  const uint32_t max_extra_args = 7;
   for (uint32_t i = 0; i < num_harts; i++) {
-    if (hart_data[i].extra_args.size() > max_extra_args) {
+    if (instances.hart_data[i].num_extra_args >
+        hart_state_entry::max_extra_args) {
       return refsi_failure;
     }
   }
 
-  RefSiTrapHandler trap_handler;
-  trap_handler.set_return_addr(return_addr);
-  sim->set_trap_handler(&trap_handler);
+  // Give each hart an initial instance to execute. Harts that return from the
+  // entry point function pick up the next instance from the queue, which
+  // means that a slow instance does not hold up the other harts. Harts are
+  // allocated to cores in order, so that as few cores as possible are used.
+  size_t num_active_harts = std::min(
+      std::min(instances.num_instances, (uint64_t)num_harts),
+      (uint64_t)getNumHarts());
+  size_t num_active_cores =
+      (num_active_harts + harts_per_core - 1) / harts_per_core;
+  std::vector<RefSiTrapHandler> trap_handlers(num_active_cores);
+  for (size_t i = 0; i < num_active_cores; i++) {
+    slim_sim_t *sim = cores[i].get();
+    RefSiTrapHandler &trap_handler = trap_handlers[i];
+    trap_handler.set_return_addr(instances.return_addr);
+    trap_handler.set_instance_queue(&instances);
+    trap_handler.set_dma_device(soc.getMemory().getDMADevice());
+    sim->set_trap_handler(&trap_handler);
+    sim->set_may_use_atomics(code_uses_atomics);
 
-  // Put a breakpoint on the kernel return address.
-  sim->set_max_active_harts(num_harts);
-  for (size_t j = 0; j < num_harts; j++) {
-    processor_t *hart = sim->get_hart(j);
-    hart->get_state()->bp_addr = return_addr;
+    // Put a breakpoint on the kernel return address.
+    size_t first_hart = i * harts_per_core;
+    size_t core_harts =
+        std::min(num_active_harts - first_hart, (size_t)harts_per_core);
+    sim->set_max_active_harts(core_harts);
+    for (size_t j = 0; j < core_harts; j++) {
+      processor_t *hart = sim->get_hart(j);
+      hart->get_state()->bp_addr = instances.return_addr;
+      instances.dispatch(hart, first_hart + j);
+    }
   }
 
-  // Run all instances on the simulator, one 'hart group' at a time.
-  uint64_t instance_id = 0;
-  size_t instances_left = num_instances;
-  refsi_result result = refsi_success;
-  sim->set_pre_run_callback(pre_run_callback);
-  while (instances_left > 0) {
-    size_t num_active_harts = std::min(instances_left, (size_t)num_harts);
-    sim->set_max_active_harts(num_active_harts);
-
-    if (soc.getDebug()) {
-      fprintf(
-          stderr,
-          "[ACC] num_instances=%ld, instances_left=%ld, num_active_harts=%ld\n",
-          num_instances, instances_left, num_active_harts);
-    }
+  if (soc.getDebug()) {
+    fprintf(stderr, "[ACC] num_instances=%ld, num_active_harts=%ld, "
+            "num_active_cores=%ld\n", instances.num_instances,
+            num_active_harts, num_active_cores);
+  }
 
-    // Set the per-hart state for the current 'hart group'.
-    for (size_t j = 0; j < num_active_harts; j++) {
-      const hart_state_entry &hart_entry(hart_data[j]);
+  // Run the instances on the simulators until the queue is drained.
+  refsi_result result = runCores(num_active_cores);
+  waitForKernelDMA();
+
+  // Clear the breakpoint.
+  for (size_t i = 0; i < num_active_cores; i++) {
+    slim_sim_t *sim = cores[i].get();
+    sim->set_trap_handler(nullptr);
+    sim->set_max_active_harts(harts_per_core);
+    for (size_t j = 0; j < harts_per_core; j++) {
       processor_t *hart = sim->get_hart(j);
-      state_t *cpu_state = hart->get_state();
-      cpu_state->pc = entry_point;
-      // ra - return address
-      cpu_state->XPR.write(1, return_addr);
-      // sp - stack
-      cpu_state->XPR.write(2, hart_entry.stack_top_addr);
-      // a0 - instance ID
-      cpu_state->XPR.write(10, instance_id);
-      // a1 to a7 - extra arguments
-      for (size_t i = 0; i < hart_entry.extra_args.size(); i++) {
-        cpu_state->XPR.write(11 + i, hart_entry.extra_args[i]);
+      hart->get_state()->bp_addr = ~0ull;
+    }
+  }
+
+  return result;
+}
+
+refsi_result RefSiAccelerator::runCores(size_t num_active_cores) {
+  for (size_t i = 0; i < num_active_cores; i++) {
+    cores[i]->set_pre_run_callback(pre_run_callback);
+  }
+  if (num_active_cores == 1) {
+    return (cores[0]->run() == 0) ? refsi_success : refsi_failure;
+  } else if (code_uses_atomics) {
+    // Spike does not make AMOs and LR/SC atomic with respect to other host
+    // threads. Simulate the cores one after the other instead. Instances
+    // cannot wait on instances running on other cores, so this only affects
+    // how long it takes to simulate the kernel.
+    refsi_result result = refsi_success;
+    for (size_t i = 0; i < num_active_cores; i++) {
+      if (cores[i]->run() != 0) {
+        result = refsi_failure;
       }
-      instance_id++;
-      instances_left--;
     }
+    return result;
+  }
 
-    // Run the 'hart group' on the simulator.
-    if (sim->run() != 0) {
+  // Simulate each core on its own host thread. Cores only share the device's
+  // memory and I/O devices, as well as the instance queue.
+  std::vector<int> exit_codes(num_active_cores, 0);
+  std::vector<std::thread> core_threads;
+  for (size_t i = 0; i < num_active_cores; i++) {
+    core_threads.emplace_back([this, i, &exit_codes] {
+      exit_codes[i] = cores[i]->run();
+    });
+  }
+  refsi_result result = refsi_success;
+  for (size_t i = 0; i < num_active_cores; i++) {
+    core_threads[i].join();
+    if (exit_codes[i] != 0) {
       result = refsi_failure;
-      break;
     }
   }
-  sim->set_trap_handler(nullptr);
+  return result;
+}
 
-  // Clear the breakpoint.
-  sim->set_max_active_harts(num_harts);
-  for (size_t j = 0; j < num_harts; j++) {
-    processor_t *hart = sim->get_hart(j);
-    hart->get_state()->bp_addr = ~0ull;
+bool RefSiInstanceQueue::dispatch(processor_t *hart, size_t hart_id) {
+  uint64_t instance = next_instance.fetch_add(1);
+  if (instance >= num_instances) {
+    return false;
   }
-
-  return result;
+  const hart_state_entry &hart_entry(hart_data[hart_id]);
+  state_t *cpu_state = hart->get_state();
+  cpu_state->pc = entry_point;
+  // ra - return address
+  cpu_state->XPR.write(1, return_addr);
+  // sp - stack
+  cpu_state->XPR.write(2, hart_entry.stack_top_addr);
+  // a0 - instance ID
+  uint64_t instance_id = instance;
+  if (instances_per_slice > 0) {
+    instance_id = instance % instances_per_slice;
+  }
+  cpu_state->XPR.write(10, instance_id);
+  // a1 to a7 - extra arguments
+  for (size_t i = 0; i < hart_entry.num_extra_args; i++) {
+    cpu_state->XPR.write(11 + i, hart_entry.extra_args[i]);
+  }
+  if (instances_per_slice > 0) {
+    // a1 - slice ID, in place of the first extra argument
+    cpu_state->XPR.write(11, instance / instances_per_slice);
+  }
+  return true;
 }
 
 void RefSiAccelerator::initializeHart(processor_t *hart) {
@@ -213,33 +385,87 @@ void RefSiAccelerator::initializeHart(processor_t *hart) {
 
 refsi_result RefSiAccelerator::runKernelGeneric(uint32_t num_harts) {
   // Reset all the harts.
-  setNumHarts(num_harts);
+  setNumHartsPerCore(num_harts);
   if (refsi_result result = createSim()) {
     return result;
   }
+  slim_sim_t *sim = cores[0].get();
 
   // Boot the harts and simulate them until they exit.
   RefSiTrapHandler trap_handler;
   trap_handler.set_return_addr(0xffffffff00defafaull);
+  trap_handler.set_dma_device(soc.getMemory().getDMADevice());
   sim->set_max_active_harts(num_harts);
   sim->set_trap_handler(&trap_handler);
+  sim->set_may_use_atomics(true);
   int exit_code = sim->run();
   sim->set_trap_handler(nullptr);
+  waitForKernelDMA();
   return exit_code == 0 ? refsi_success : refsi_failure;
 }
 
-refsi_result RefSiAccelerator::syncCache(uint32_t flags) {
-  size_t old_max_harts = sim->get_max_active_harts();
-  sim->set_max_active_harts(0);
-  for (size_t i = 0; i < sim->get_hart_number(); i++) {
-    processor_t *hart = sim->get_hart(i);
-    if (flags & CMP_CACHE_SYNC_ACC_DCACHE) {
-      hart->get_mmu()->flush_tlb();
-    } else {
-      hart->get_mmu()->flush_icache();
+void RefSiAccelerator::waitForKernelDMA() {
+  // Transfers started by the kernel may still be in flight if the kernel did
+  // not wait for them. They must not outlive the kernel.
+  if (DMADevice *dma_device = soc.getMemory().getDMADevice()) {
+    dma_device->wait_idle();
+  }
+}
+
+refsi_result RefSiAccelerator::syncCache(uint32_t flags,
+                                         refsi_addr_t code_addr,
+                                         uint64_t code_size) {
+  // Loads and stores go straight to host memory, there is no data cache to
+  // write back. TLB entries only become stale when the memory map changes,
+  // e.g. when a memory window is remapped.
+  bool flush_tlb = false;
+  if (flags & CMP_CACHE_SYNC_ACC_DCACHE) {
+    uint64_t generation = soc.getMemory().get_generation();
+    flush_tlb = (generation != tlb_generation);
+    tlb_generation = generation;
+  }
+
+  // Decoded instructions can be kept across kernel launches as long as the
+  // code they were decoded from has not changed.
+  bool flush_icache = false;
+  if (flags & CMP_CACHE_SYNC_ACC_ICACHE) {
+    code_cache_key key;
+    uint8_t *code = nullptr;
+    if (code_size > 0) {
+      unit_id_t unit = make_unit(unit_kind::cmp);
+      code = soc.getMemory().addr_to_mem(code_addr, code_size, unit);
+      if (code) {
+        key.addr = code_addr;
+        key.size = code_size;
+        key.hash = hashCode(code, code_size);
+      }
+    }
+    flush_icache = (key.size == 0) || !(key == code_key);
+    if (flush_icache) {
+      // Harts and cores can only be simulated on several host threads when the
+      // code is known not to use atomics.
+      code_uses_atomics = !code || codeUsesAtomics(code, code_size);
+    }
+    code_key = key;
+  }
+
+  if (!flush_tlb && !flush_icache) {
+    return refsi_success;
+  }
+  for (auto &sim : cores) {
+    size_t old_max_harts = sim->get_max_active_harts();
+    sim->set_max_active_harts(0);
+    for (size_t i = 0; i < sim->get_hart_number(); i++) {
+      processor_t *hart = sim->get_hart(i);
+      if (flush_tlb) {
+        // This also invalidates decoded instructions.
+        hart->get_mmu()->flush_tlb();
+      } else {
+        hart->get_mmu()->flush_icache();
+      }
     }
+    sim->set_max_active_harts(old_max_harts);
   }
-  sim->set_max_active_harts(old_max_harts);
   return refsi_success;
 }
 
@@ -252,6 +478,11 @@ bool RefSiTrapHandler::handle_trap(trap_t &trap, reg_t pc, slim_sim_t &sim) {
     if (handle_return(trap, pc, sim)) {
       return true;
     }
+  } else if ((trap.cause() == CAUSE_STORE_ACCESS) && dma_device &&
+             dma_device->is_wait_reg(trap.get_tval())) {
+    if (handle_dma_wait(trap, pc, sim)) {
+      return true;
+    }
   }
   return default_trap_handler::handle_trap(trap, pc, sim);
 }
@@ -261,7 +492,38 @@ bool RefSiTrapHandler::handle_return(trap_t &trap, reg_t pc, slim_sim_t &sim) {
   // 'ra' register prior to starting the kernel. This causes an instruction
   // access fault trap, which we can distinguish from other traps with the
   // specific return address.
+  if (instances) {
+    // Restart the hart at the entry point if there are instances left.
+    size_t hart_id = sim.get_current_hart_id();
+    processor_t *hart = sim.get_hart(hart_id);
+    if (hart && instances->dispatch(hart, sim.get_hart_id_base() + hart_id)) {
+      sim.return_from_trap(hart->get_state(), instances->entry_point);
+      return true;
+    }
+  }
   sim.set_exited(
       0);  // Let the simulator know the hart has exited gracefully.
   return true;
 }
+
+bool RefSiTrapHandler::handle_dma_wait(trap_t &trap, reg_t pc,
+                                       slim_sim_t &sim) {
+  // Writing to DMADONESEQ fails when the transfer the hart waits for has not
+  // completed yet. Park the hart until the transfer is complete, then execute
+  // the store again.
+  size_t hart_id = sim.get_current_hart_id();
+  processor_t *hart = sim.get_hart(hart_id);
+  unit_id_t unit =
+      make_unit(unit_kind::acc_hart, sim.get_hart_id_base() + hart_id);
+  uint32_t xfer_id = 0;
+  if (!hart || !dma_device->get_pending_wait(unit, xfer_id)) {
+    return false;
+  }
+  DMADevice *dma = dma_device;
+  slim_sim_event event;
+  event.is_done = [=] { return dma->is_transfer_done(unit, xfer_id); };
+  event.wait = [=] { dma->wait_for_transfer(unit, xfer_id); };
+  sim.park_hart(event);
+  sim.return_from_trap(hart->get_state(), pc);
+  return true;
+}
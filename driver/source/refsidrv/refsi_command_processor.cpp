@@ -20,8 +20,10 @@
 #include "refsidrv/refsi_device.h"
 #include "refsidrv/refsi_memory.h"
 #include "refsidrv/refsi_memory_window.h"
+#include "refsidrv/refsi_perf_counters.h"
 
 #include <time.h>
+#include <algorithm>
 #include <sstream>
 
 #if defined(__BIG_ENDIAN__)
@@ -35,7 +37,12 @@ static float time_diff_in_sec(timespec &start, timespec &end) {
 
 RefSiCommandProcessor::RefSiCommandProcessor(RefSiDevice &soc) : soc(soc),
   debug(soc.getDebug()) {
-  registers.resize(CMP_NUM_REGS);
+  for (uint32_t i = 0; i < CMP_NUM_QUEUES; i++) {
+    RefSiCommandQueue &queue(queues[i]);
+    queue.id = (refsi_cmp_queue_id)i;
+    queue.unit = make_unit(unit_kind::cmp, i);
+    queue.registers.resize(CMP_NUM_REGS);
+  }
 }
 
 void RefSiCommandProcessor::start(RefSiLock &lock) {
@@ -47,77 +54,135 @@ void RefSiCommandProcessor::start(RefSiLock &lock) {
   }
   stopping = false;
   started = true;
-  worker_thread = new std::thread(workerMain, this);
+  for (RefSiCommandQueue &queue : queues) {
+    queue.worker_thread = new std::thread(workerMain, this, &queue);
+  }
 }
 
 void RefSiCommandProcessor::stop(RefSiLock &lock) {
   if (!started) {
     return;
   }
-  // Shut down the queue and wait for the worker thread to be done.
+  // Shut down the queues and wait for the worker threads to be done.
   if (debug) {
     fprintf(stderr, "[CMP] Requesting stop.\n");
   }
   stopping = true;
-  dispatched.notify_all();
+  for (RefSiCommandQueue &queue : queues) {
+    queue.dispatched.notify_all();
+  }
+  semaphore_signaled.notify_all();
   lock.unlock();
-  worker_thread->join();
+  for (RefSiCommandQueue &queue : queues) {
+    queue.worker_thread->join();
+  }
   lock.lock();
   stopping = false;
-  delete worker_thread;
-  worker_thread = nullptr;
+  started = false;
+  for (RefSiCommandQueue &queue : queues) {
+    delete queue.worker_thread;
+    queue.worker_thread = nullptr;
+  }
 }
 
-void RefSiCommandProcessor::enqueueRequest(RefSiCommandRequest request,
-                                           RefSiLock &lock) {
+uint64_t RefSiCommandProcessor::enqueueRequest(RefSiCommandRequest request,
+                                               refsi_cmp_queue_id queue_id,
+                                               RefSiLock &lock) {
   if (!started) {
     start(lock);
   }
 
   // Wait for the queue to have a free space for the request.
-  while (requests.size() > max_requests) {
+  RefSiCommandQueue &queue(queues[queue_id]);
+  while (queue.requests.size() > max_requests) {
     executed.wait(lock);
   }
 
   // Enqueue the request and notify the worker thread.
-  requests.push_back(request);
-  dispatched.notify_all();
+  request.fence = next_fence++;
+  queue.requests.push_back(request);
+  queue.dispatched.notify_all();
+  return request.fence;
 }
 
 void RefSiCommandProcessor::waitEmptyQueue(RefSiLock &lock) {
-  while (!requests.empty()) {
+  while (signaled_fence < (next_fence - 1)) {
+    executed.wait(lock);
+  }
+}
+
+refsi_result RefSiCommandProcessor::waitForFence(uint64_t fence,
+                                                 RefSiLock &lock) {
+  if (fence >= next_fence) {
+    return refsi_failure;  // The fence has not been returned yet.
+  }
+  while (signaled_fence < fence) {
     executed.wait(lock);
   }
+  return refsi_success;
 }
 
-void RefSiCommandProcessor::workerMain(RefSiCommandProcessor *cmp) {
+void RefSiCommandProcessor::updateSignaledFence() {
+  // Fences are allocated in enqueue order across all queues. The oldest request
+  // that has not been executed yet limits which fences can be signaled.
+  uint64_t fence = next_fence - 1;
+  for (const RefSiCommandQueue &queue : queues) {
+    if (!queue.requests.empty()) {
+      fence = std::min(fence, queue.requests.front().fence - 1);
+    }
+  }
+  signaled_fence = fence;
+}
+
+const char *RefSiCommandProcessor::getQueueName(refsi_cmp_queue_id queue_id) {
+  switch (queue_id) {
+    default:
+      return "unknown";
+    case CMP_QUEUE_COMPUTE:
+      return "compute";
+    case CMP_QUEUE_COPY:
+      return "copy";
+    case CMP_QUEUE_HIGH_PRIORITY:
+      return "high-priority";
+  }
+}
+
+void RefSiCommandProcessor::workerMain(RefSiCommandProcessor *cmp,
+                                       RefSiCommandQueue *queue) {
   RefSiLock lock(cmp->soc.getLock());
-  auto &requests = cmp->requests;
+  auto &requests = queue->requests;
+  const char *queue_name = getQueueName(queue->id);
   while (true) {
     if (cmp->stopping) {
       if (cmp->debug) {
-        fprintf(stderr, "[CMP] Stopping.\n");
+        fprintf(stderr, "[CMP] Stopping %s queue.\n", queue_name);
       }
       break;
     }
 
-    for (auto I = requests.begin(); I != requests.end();) {
-      // Execute the request.
+    while (!requests.empty()) {
+      // Execute the request. The device lock is released while executing
+      // commands so that the host can access device memory and enqueue more
+      // requests in the meantime.
+      RefSiCommandRequest request = requests.front();
       timespec start, end;
       if (cmp->debug) {
         clock_gettime(CLOCK_MONOTONIC, &start);
-        fprintf(stderr, "[CMP] Starting to execute command buffer at 0x%zx.\n",
-                I->command_buffer_addr);
+        fprintf(stderr, "[CMP] Starting to execute command buffer at 0x%zx "
+                "on the %s queue.\n", request.command_buffer_addr, queue_name);
       }
-      cmp->execute(*I, lock);
+      lock.unlock();
+      cmp->execute(request, *queue);
+      lock.lock();
       if (cmp->debug) {
         clock_gettime(CLOCK_MONOTONIC, &end);
-        fprintf(stderr, "[CMP] Finished executing command buffer in "
-                "%0.3f s\n", time_diff_in_sec(start, end));
+        fprintf(stderr, "[CMP] Finished executing command buffer on the %s "
+                "queue in %0.3f s\n", queue_name, time_diff_in_sec(start, end));
       }
 
-      // Remove the request from the queue.
-      I = requests.erase(I);
+      // Remove the request from the queue and signal its fence.
+      requests.pop_front();
+      cmp->updateSignaledFence();
 
       // Notify clients that a request has been executed.
       cmp->executed.notify_all();
@@ -126,7 +191,7 @@ void RefSiCommandProcessor::workerMain(RefSiCommandProcessor *cmp) {
     // Wait for something to happen:
     //   1) A command request has been dispatched
     //   2) The command processor is shutting down
-    cmp->dispatched.wait(lock);
+    queue->dispatched.wait(lock);
   }
 }
 
@@ -154,6 +219,12 @@ static const char *getOpcodeName(refsi_cmp_command_id opcode) {
       return "RUN_INSTANCES";
     case CMP_SYNC_CACHE:
       return "SYNC_CACHE";
+    case CMP_RUN_NDRANGE:
+      return "RUN_NDRANGE";
+    case CMP_SIGNAL_SEMAPHORE:
+      return "SIGNAL_SEMAPHORE";
+    case CMP_WAIT_SEMAPHORE:
+      return "WAIT_SEMAPHORE";
   }
 }
 
@@ -234,6 +305,16 @@ std::string RefSiCommandProcessor::formatDeviceAddress(refsi_addr_t address) {
       return "DMA_XFER_DST_STRIDE0";
     case REFSI_REG_DMAXFERDSTSTRIDE0 + 1:
       return "DMA_XFER_DST_STRIDE1";
+    case REFSI_REG_DMAFILLSIZE:
+      return "DMA_FILL_SIZE";
+    case REFSI_REG_DMADESCADDR:
+      return "DMA_DESC_ADDR";
+    }
+    if ((reg_idx >= REFSI_REG_DMAFILLPATTERN0) &&
+        (reg_idx < (REFSI_REG_DMAFILLPATTERN0 +
+                    (REFSI_DMA_MAX_FILL_PATTERN_SIZE / sizeof(uint64_t))))) {
+      return "DMA_FILL_PATTERN" +
+             std::to_string(reg_idx - REFSI_REG_DMAFILLPATTERN0);
     }
   }
 
@@ -247,39 +328,133 @@ std::string RefSiCommandProcessor::formatDeviceAddress(refsi_addr_t address) {
   return ss.str();
 }
 
+refsi_result RefSiCommandProcessor::decodeCommand(
+    const uint64_t *command_buffer, size_t total_chunks, size_t pos,
+    RefSiDecodedCommand &decoded) {
+  refsi_result result = refsiDecodeCMPCommand(command_buffer[pos],
+                                              &decoded.opcode,
+                                              &decoded.num_chunks,
+                                              &decoded.inline_chunk);
+  if (refsi_success != result) {
+    return result;
+  }
+  // The command's chunks must be part of the command buffer.
+  decoded.chunk_offset = pos + 1;
+  if (decoded.num_chunks > (total_chunks - decoded.chunk_offset)) {
+    return refsi_failure;
+  }
+  return refsi_success;
+}
+
+refsi_result RefSiCommandProcessor::prepareCommandBuffer(refsi_addr_t addr,
+                                                         size_t size,
+                                                         uint64_t &generation) {
+  const uint64_t *command_buffer = nullptr;
+  {
+    RefSiMemoryMapReadLock map_lock(soc.getMemoryMapLock());
+    command_buffer = (const uint64_t *)soc.getMemory().addr_to_mem(
+        addr, size, make_unit(unit_kind::cmp));
+  }
+  if (!command_buffer) {
+    return refsi_failure;
+  }
+
+  // Decode and validate all commands up to the first FINISH.
+  auto prepared = std::make_shared<RefSiPreparedCommandBuffer>();
+  prepared->command_buffer_size = size;
+  size_t total_chunks = size / sizeof(uint64_t);
+  size_t pos = 0;
+  while (pos < total_chunks) {
+    RefSiDecodedCommand decoded;
+    if (refsi_success != decodeCommand(command_buffer, total_chunks, pos,
+                                       decoded)) {
+      return refsi_failure;
+    } else if (!getOpcodeName(decoded.opcode)) {
+      return refsi_failure;
+    }
+    prepared->commands.push_back(decoded);
+    if (decoded.opcode == CMP_FINISH) {
+      break;
+    }
+    pos = decoded.chunk_offset + decoded.num_chunks;
+  }
+
+  prepared->generation = next_prepared_generation++;
+  generation = prepared->generation;
+  prepared_buffers[addr] = std::move(prepared);
+  if (debug) {
+    fprintf(stderr, "[CMP] Prepared command buffer at 0x%zx (%zd commands).\n",
+            addr, prepared_buffers[addr]->commands.size());
+  }
+  return refsi_success;
+}
+
+std::shared_ptr<const RefSiPreparedCommandBuffer>
+RefSiCommandProcessor::findPreparedCommandBuffer(refsi_addr_t addr,
+                                                 uint64_t generation) const {
+  auto it = prepared_buffers.find(addr);
+  if ((it == prepared_buffers.end()) ||
+      (it->second->generation != generation)) {
+    return nullptr;
+  }
+  return it->second;
+}
+
+refsi_result RefSiCommandProcessor::releaseCommandBuffer(refsi_addr_t addr) {
+  // Requests that have already been enqueued keep a reference to the decoded
+  // commands.
+  if (prepared_buffers.erase(addr) == 0) {
+    return refsi_failure;
+  }
+  return refsi_success;
+}
+
 refsi_result RefSiCommandProcessor::execute(RefSiCommandRequest request,
-                                            RefSiLock &lock) {
+                                            RefSiCommandQueue &queue) {
   // Retrieve a pointer to the command buffer area and divide it into 64-bit
   // chunks.
-  uint64_t *command_buffer = (uint64_t *)soc.getMemory().addr_to_mem(
-      request.command_buffer_addr, request.command_buffer_size,
-      make_unit(unit_kind::cmp));
+  uint64_t *command_buffer = nullptr;
+  {
+    RefSiMemoryMapReadLock map_lock(soc.getMemoryMapLock());
+    command_buffer = (uint64_t *)soc.getMemory().addr_to_mem(
+        request.command_buffer_addr, request.command_buffer_size, queue.unit);
+  }
   if (!command_buffer) {
     return refsi_failure;
   }
   size_t total_chunks = request.command_buffer_size / sizeof(uint64_t);
 
-  // Decode commands in the command buffer.
+  // Execute the commands of prepared command buffers without decoding them.
   refsi_result result = refsi_success;
+  if (request.prepared) {
+    for (const RefSiDecodedCommand &decoded : request.prepared->commands) {
+      RefSiCommandContext cmd(queue);
+      cmd.opcode = decoded.opcode;
+      cmd.num_chunks = decoded.num_chunks;
+      cmd.inline_chunk = decoded.inline_chunk;
+      cmd.chunks = &command_buffer[decoded.chunk_offset];
+      result = executeCommand(cmd);
+      if (refsi_success != result) {
+        return result;
+      }
+    }
+    return refsi_success;
+  }
+
+  // Decode commands in the command buffer.
   size_t pos = 0;
   while (pos < total_chunks) {
     // Decode the command header.
-    RefSiCommandContext cmd(lock);
-    result = refsiDecodeCMPCommand(command_buffer[pos], &cmd.opcode,
-                                   &cmd.num_chunks, &cmd.inline_chunk);
+    RefSiDecodedCommand decoded;
+    result = decodeCommand(command_buffer, total_chunks, pos, decoded);
     if (refsi_success != result) {
       return result;
     }
-    /*if (debug) {
-      const char *op_name = getOpcodeName(cmd.opcode);
-      if (op_name) {
-        fprintf(stderr, "[CMP] Decoded CMP_%s command.\n", op_name);
-      } else {
-        fprintf(stderr, "[CMP] Decoded command with opcode %d.\n", cmd.opcode);
-      }
-    }*/
-    pos++;
-    cmd.chunks = &command_buffer[pos];
+    RefSiCommandContext cmd(queue);
+    cmd.opcode = decoded.opcode;
+    cmd.num_chunks = decoded.num_chunks;
+    cmd.inline_chunk = decoded.inline_chunk;
+    cmd.chunks = &command_buffer[decoded.chunk_offset];
 
     // Execute the command.
     result = executeCommand(cmd);
@@ -289,12 +464,111 @@ refsi_result RefSiCommandProcessor::execute(RefSiCommandRequest request,
     } else if (cmd.opcode == CMP_FINISH) {
       break;
     }
-    pos += cmd.num_chunks;
+    pos = decoded.chunk_offset + decoded.num_chunks;
   }
   return refsi_success;
 }
 
+bool RefSiCommandProcessor::needsExecutionLock(const RefSiCommandContext &cmd) {
+  switch (cmd.opcode) {
+    default:
+      return false;
+    case CMP_RUN_KERNEL_SLICE:
+    case CMP_RUN_INSTANCES:
+    case CMP_RUN_NDRANGE:
+    case CMP_SYNC_CACHE:
+      return true;
+    case CMP_WRITE_REG64:
+      // Window registers change the memory map seen by running kernels.
+      return (cmd.inline_chunk >= CMP_REG_WINDOW_BASE0) &&
+             (cmd.inline_chunk <= CMP_REG_WINDOW_SCALEn);
+    case CMP_COPY_MEM64:
+      // Reading per-hart performance counters accesses the accelerator state.
+      if ((cmd.num_chunks == 3) &&
+          (get_unit_kind((unit_id_t)cmd.chunks[2]) == unit_kind::acc_hart)) {
+        return true;
+      }
+      return accessesIODevices(cmd);
+    case CMP_LOAD_REG64:
+    case CMP_STORE_REG64:
+    case CMP_STORE_IMM64:
+      // Memory-mapped devices are not synchronized with running kernels.
+      return accessesIODevices(cmd);
+  }
+}
+
+bool RefSiCommandProcessor::accessesIODevices(const RefSiCommandContext &cmd) {
+  RefSiMemoryMapReadLock map_lock(soc.getMemoryMapLock());
+  const size_t reg_size = sizeof(uint64_t);
+  switch (cmd.opcode) {
+    default:
+      return false;
+    case CMP_LOAD_REG64:
+    case CMP_STORE_REG64:
+      return (cmd.num_chunks == 1) &&
+             !soc.isMemoryRange(cmd.chunks[0], reg_size, cmd.queue.unit);
+    case CMP_STORE_IMM64:
+      return !soc.isMemoryRange(cmd.inline_chunk, reg_size, cmd.queue.unit);
+    case CMP_COPY_MEM64: {
+      if (cmd.num_chunks != 3) {
+        return false;
+      }
+      uint64_t copy_size = cmd.inline_chunk * reg_size;
+      return !soc.isMemoryRange(cmd.chunks[0], copy_size,
+                                (unit_id_t)cmd.chunks[2]) ||
+             !soc.isMemoryRange(cmd.chunks[1], copy_size, cmd.queue.unit);
+    }
+  }
+}
+
+RefSiLock RefSiCommandProcessor::lockExecution(const RefSiCommandQueue &queue) {
+  std::mutex &exec_mutex = soc.getExecutionLock();
+  if (queue.id == CMP_QUEUE_HIGH_PRIORITY) {
+    {
+      RefSiLock priority_lock(priority_mutex);
+      priority_waiters++;
+    }
+    RefSiLock exec_lock(exec_mutex);
+    {
+      RefSiLock priority_lock(priority_mutex);
+      if (--priority_waiters == 0) {
+        priority_idle.notify_all();
+      }
+    }
+    return exec_lock;
+  }
+
+  // Other queues give the lock back when a high-priority command is waiting
+  // for it, and sleep until no such command is left.
+  while (true) {
+    RefSiLock exec_lock(exec_mutex);
+    RefSiLock priority_lock(priority_mutex);
+    if (priority_waiters == 0) {
+      return exec_lock;
+    }
+    exec_lock.unlock();
+    priority_idle.wait(priority_lock, [&] { return priority_waiters == 0; });
+  }
+}
+
 refsi_result RefSiCommandProcessor::executeCommand(RefSiCommandContext &cmd) {
+  // Semaphore waits must not hold any lock, since they can block the queue for
+  // as long as it takes another queue to signal the semaphore.
+  if ((cmd.opcode == CMP_WAIT_SEMAPHORE) ||
+      (cmd.opcode == CMP_SIGNAL_SEMAPHORE)) {
+    return dispatchCommand(cmd);
+  } else if (needsExecutionLock(cmd)) {
+    RefSiLock exec_lock = lockExecution(cmd.queue);
+    return dispatchCommand(cmd);
+  }
+
+  // Other commands only access device memory, which can be done concurrently
+  // with kernels as long as the memory map does not change.
+  RefSiMemoryMapReadLock map_lock(soc.getMemoryMapLock());
+  return dispatchCommand(cmd);
+}
+
+refsi_result RefSiCommandProcessor::dispatchCommand(RefSiCommandContext &cmd) {
   switch (cmd.opcode) {
     default:
       return refsi_failure;
@@ -320,11 +594,18 @@ refsi_result RefSiCommandProcessor::executeCommand(RefSiCommandContext &cmd) {
       return executeRUN_INSTANCES(cmd);
     case CMP_SYNC_CACHE:
       return executeSYNC_CACHE(cmd);
+    case CMP_RUN_NDRANGE:
+      return executeRUN_NDRANGE(cmd);
+    case CMP_SIGNAL_SEMAPHORE:
+      return executeSIGNAL_SEMAPHORE(cmd);
+    case CMP_WAIT_SEMAPHORE:
+      return executeWAIT_SEMAPHORE(cmd);
   }
 }
 
 refsi_result RefSiCommandProcessor::executeWRITE_REG64(
     RefSiCommandContext &cmd) {
+  std::vector<uint64_t> &registers(cmd.queue.registers);
   if (cmd.num_chunks != 1) {
     return refsi_failure;
   }
@@ -334,7 +615,10 @@ refsi_result RefSiCommandProcessor::executeWRITE_REG64(
     return refsi_failure;
   } else if ((reg_idx >= CMP_REG_WINDOW_BASE0) &&
              (reg_idx <= CMP_REG_WINDOW_SCALEn)) {
+    // Changing a window changes the memory map, which must not happen while
+    // the host is accessing device memory.
     RefSiMemoryController &mem_ctl = soc.getMemory();
+    RefSiMemoryMapWriteLock map_lock(soc.getMemoryMapLock());
     refsi_result result = mem_ctl.handleWindowRegWrite(reg_idx, imm_val);
     if (result != refsi_success) {
       return result;
@@ -351,6 +635,7 @@ refsi_result RefSiCommandProcessor::executeWRITE_REG64(
 
 refsi_result RefSiCommandProcessor::executeLOAD_REG64(
     RefSiCommandContext &cmd) {
+  std::vector<uint64_t> &registers(cmd.queue.registers);
   if (cmd.num_chunks != 1) {
     return refsi_failure;
   }
@@ -361,7 +646,7 @@ refsi_result RefSiCommandProcessor::executeLOAD_REG64(
   }
   uint64_t val = 0;
   if (!soc.getMemory().load(src_addr, sizeof(uint64_t), (uint8_t *)&val,
-                            make_unit(unit_kind::cmp))) {
+                            cmd.queue.unit)) {
     return refsi_failure;
   }
   registers[reg_idx] = val;
@@ -376,6 +661,7 @@ refsi_result RefSiCommandProcessor::executeLOAD_REG64(
 
 refsi_result RefSiCommandProcessor::executeSTORE_REG64(
     RefSiCommandContext &cmd) {
+  std::vector<uint64_t> &registers(cmd.queue.registers);
   if (cmd.num_chunks != 1) {
     return refsi_failure;
   }
@@ -386,7 +672,7 @@ refsi_result RefSiCommandProcessor::executeSTORE_REG64(
   }
   uint64_t val = registers[reg_idx];
   if (!soc.getMemory().store(dst_addr, sizeof(uint64_t), (uint8_t *)&val,
-                             make_unit(unit_kind::cmp))) {
+                             cmd.queue.unit)) {
     return refsi_failure;
   }
   if (debug) {
@@ -406,7 +692,7 @@ refsi_result RefSiCommandProcessor::executeSTORE_IMM64(
   uint64_t dest_addr = cmd.inline_chunk;
   uint64_t imm_val = cmd.chunks[0];
   if (!soc.getMemory().store(dest_addr, sizeof(uint64_t), (uint8_t *)&imm_val,
-                             make_unit(unit_kind::cmp))) {
+                             cmd.queue.unit)) {
     return refsi_failure;
   }
   if (debug) {
@@ -446,10 +732,30 @@ refsi_result RefSiCommandProcessor::executeCOPY_MEM64(
     return refsi_failure;
   }
 
+  // Fast path: copy all registers at once when both ranges are backed by
+  // memory, or when reading performance counters into memory.
+  unit_id_t unit_id = (unit_id_t)cmd.chunks[2];
+  uint8_t *dst_mem = dst_device->addr_to_mem(dst_target_offset, copy_size,
+                                             cmd.queue.unit);
+  uint8_t *src_mem = dst_mem ? src_device->addr_to_mem(src_target_offset,
+                                                       copy_size, unit_id)
+                             : nullptr;
+  PerfCounterDevice *counters = soc.getMemory().getPerfCounterDevice();
+  uint32_t num_slow_regs = count;
+  if (src_mem && dst_mem) {
+    memmove(dst_mem, src_mem, copy_size);
+    num_slow_regs = 0;
+  } else if (dst_mem && counters && (src_device == counters)) {
+    if (!counters->load_counters(src_target_offset, count, dst_mem,
+                                 unit_id)) {
+      return refsi_failure;
+    }
+    num_slow_regs = 0;
+  }
+
   // Copy registers one by one. I/O devices cannot access more than one register
   // at a time.
-  unit_id_t unit_id = (unit_id_t)cmd.chunks[2];
-  for (uint32_t i = 0; i < count; i++) {
+  for (uint32_t i = 0; i < num_slow_regs; i++) {
     uint64_t reg_src_addr = src_target_offset + (i * reg_size);
     uint64_t reg_dst_addr = dst_target_offset + (i * reg_size);
     uint64_t val = 0;
@@ -457,7 +763,7 @@ refsi_result RefSiCommandProcessor::executeCOPY_MEM64(
       return refsi_failure;
     }
     if (!dst_device->store(reg_dst_addr, reg_size, (const uint8_t *)&val,
-                           make_unit(unit_kind::cmp))) {
+                           cmd.queue.unit)) {
       return refsi_failure;
     }
   }
@@ -488,6 +794,7 @@ refsi_result RefSiCommandProcessor::executeRUN_KERNEL_SLICE(
             "max_harts=%d)\n",
             num_instances, slice_id, max_harts);
   }
+  std::vector<uint64_t> &registers(cmd.queue.registers);
   uint64_t entry_point =
       CMP_GET_ENTRY_POINT_ADDR(registers[CMP_REG_ENTRY_PT_FN]);
   uint64_t kub_addr = CMP_GET_KUB_ADDR(registers[CMP_REG_KUB_DESC]);
@@ -506,28 +813,41 @@ refsi_result RefSiCommandProcessor::executeRUN_KERNEL_SLICE(
   (void)kargs_offset;
 
   // Prepare per-hart data.
-  size_t num_harts = (max_harts > 0) ? max_harts : num_harts_per_core;
+  size_t num_harts =
+      (max_harts > 0) ? max_harts : soc.getAccelerator().getNumHarts();
   size_t tcdm_hart_size_per_hart = tcdm_hart_size / num_harts;
   auto getTCDMHartAddress = [&](size_t hart_idx, reg_t address) {
     return (hart_idx * tcdm_hart_size_per_hart) + address + tcdm_hart_base;
   };
-  std::vector<hart_state_entry> per_hart_data(num_harts);
-  for (size_t hart_id = 0; hart_id < num_harts; hart_id++) {
-    hart_state_entry &hart_data(per_hart_data[hart_id]);
-    if (stack_top != 0) {
-      hart_data.stack_top_addr = stack_top;
-    } else {
-      hart_data.stack_top_addr = getTCDMHartAddress(hart_id,
-                                                    tcdm_hart_size_per_hart);
+  RefSiHartTableKey key;
+  key.opcode = CMP_RUN_KERNEL_SLICE;
+  key.num_harts = num_harts;
+  key.stack_top = stack_top;
+  key.params[key.num_params++] = kub_addr;
+  key.params[key.num_params++] = tsd_size;
+  if (!prepareHartTable(key)) {
+    for (size_t hart_id = 0; hart_id < num_harts; hart_id++) {
+      hart_state_entry &hart_data(hart_table[hart_id]);
+      if (stack_top != 0) {
+        hart_data.stack_top_addr = stack_top;
+      } else {
+        hart_data.stack_top_addr = getTCDMHartAddress(hart_id,
+                                                      tcdm_hart_size_per_hart);
+      }
+      hart_data.addExtraArg(slice_id);
+      hart_data.addExtraArg(kub_addr);
+      hart_data.addExtraArg((tsd_size > 0) ? getTCDMHartAddress(hart_id, 0)
+                                           : 0);
     }
-    hart_data.extra_args.push_back(slice_id);
-    hart_data.extra_args.push_back(kub_addr);
+  }
 
-    reg_t ktb_addr = 0;
+  for (size_t hart_id = 0; hart_id < num_harts; hart_id++) {
+    hart_state_entry &hart_data(hart_table[hart_id]);
+    hart_data.extra_args[0] = slice_id;
     if (tsd_size > 0) {
       // Copy thread-specific data to this thread's Kernel Thread Block.
       unit_id_t unit = make_unit(unit_kind::acc_hart, hart_id);
-      ktb_addr = getTCDMHartAddress(hart_id, 0);
+      reg_t ktb_addr = hart_data.extra_args[2];
       uint8_t *ktb = soc.getMemory().addr_to_mem(ktb_addr, tsd_size, unit);
       uint8_t *tsd =
           soc.getMemory().addr_to_mem(kub_addr + tsd_offset, tsd_size, unit);
@@ -536,13 +856,12 @@ refsi_result RefSiCommandProcessor::executeRUN_KERNEL_SLICE(
       }
       memcpy(ktb, tsd, tsd_size);
     }
-    hart_data.extra_args.push_back(ktb_addr);
   }
 
   // Run the kernel.
   return soc.getAccelerator().runKernelSlice(num_instances, entry_point,
                                              return_addr, num_harts,
-                                             per_hart_data.data());
+                                             hart_table.data());
 }
 
 refsi_result RefSiCommandProcessor::executeRUN_INSTANCES(
@@ -551,7 +870,7 @@ refsi_result RefSiCommandProcessor::executeRUN_INSTANCES(
     return refsi_failure;
   }
 
-  const uint32_t max_extra_args = 7;
+  const uint32_t max_extra_args = hart_state_entry::max_extra_args;
   uint32_t max_harts = cmd.inline_chunk & 0xff;
   uint32_t num_extra_args = (cmd.inline_chunk >> 8) & 0x07;
   if ((num_extra_args > max_extra_args) ||
@@ -567,31 +886,116 @@ refsi_result RefSiCommandProcessor::executeRUN_INSTANCES(
     }
     fprintf(stderr, ")\n");
   }
+  std::vector<uint64_t> &registers(cmd.queue.registers);
   uint64_t entry_point =
       CMP_GET_ENTRY_POINT_ADDR(registers[CMP_REG_ENTRY_PT_FN]);
   uint64_t stack_top = registers[CMP_REG_STACK_TOP];
   uint64_t return_addr = registers[CMP_REG_RETURN_ADDR];
 
   // Prepare per-hart data.
-  size_t num_harts = (max_harts > 0) ? max_harts : num_harts_per_core;
-  std::vector<hart_state_entry> per_hart_data(num_harts);
-  for (size_t hart_id = 0; hart_id < num_harts; hart_id++) {
-    hart_state_entry &hart_data(per_hart_data[hart_id]);
-    hart_data.stack_top_addr = stack_top;
-    for (size_t i = 0; i < num_extra_args; i++) {
-      hart_data.extra_args.push_back(cmd.chunks[i + 1]);
-    }
-  }
+  size_t num_harts =
+      (max_harts > 0) ? max_harts : soc.getAccelerator().getNumHarts();
+  prepareUniformHartTable(CMP_RUN_INSTANCES, num_harts, stack_top,
+                          &cmd.chunks[1], num_extra_args);
 
   // Run the kernel.
   return soc.getAccelerator().runKernelSlice(num_instances, entry_point,
                                              return_addr, num_harts,
-                                             per_hart_data.data());
+                                             hart_table.data());
+}
+
+refsi_result RefSiCommandProcessor::executeRUN_NDRANGE(
+    RefSiCommandContext &cmd) {
+  const uint32_t num_dims = 3;
+  if (cmd.num_chunks < num_dims) {
+    return refsi_failure;
+  }
+
+  // The first extra argument holds the slice ID, which is set by the
+  // accelerator for each instance. There must be at least one extra argument.
+  const uint32_t max_extra_args = hart_state_entry::max_extra_args;
+  uint32_t max_harts = cmd.inline_chunk & 0xff;
+  uint32_t num_extra_args = (cmd.inline_chunk >> 8) & 0x07;
+  if ((num_extra_args < 1) || (num_extra_args > max_extra_args) ||
+      (cmd.num_chunks != (num_extra_args + num_dims))) {
+    return refsi_failure;
+  }
+  uint64_t num_groups[num_dims];
+  for (uint32_t i = 0; i < num_dims; i++) {
+    num_groups[i] = cmd.chunks[i];
+  }
+  if (debug) {
+    fprintf(stderr, "[CMP] CMP_RUN_NDRANGE(groups=%zdx%zdx%zd, max_harts=%d",
+            num_groups[0], num_groups[1], num_groups[2], max_harts);
+    for (uint32_t i = 0; i < num_extra_args; i++) {
+      fprintf(stderr, ", 0x%zx", cmd.chunks[i + num_dims]);
+    }
+    fprintf(stderr, ")\n");
+  }
+
+  // Each slice contains one row of groups in the X dimension.
+  uint64_t num_slices = num_groups[1] * num_groups[2];
+  if ((num_groups[1] != 0) && (num_slices / num_groups[1] != num_groups[2])) {
+    return refsi_failure;
+  }
+  std::vector<uint64_t> &registers(cmd.queue.registers);
+  uint64_t entry_point =
+      CMP_GET_ENTRY_POINT_ADDR(registers[CMP_REG_ENTRY_PT_FN]);
+  uint64_t stack_top = registers[CMP_REG_STACK_TOP];
+  uint64_t return_addr = registers[CMP_REG_RETURN_ADDR];
+
+  // Prepare per-hart data.
+  size_t num_harts =
+      (max_harts > 0) ? max_harts : soc.getAccelerator().getNumHarts();
+  prepareUniformHartTable(CMP_RUN_NDRANGE, num_harts, stack_top,
+                          &cmd.chunks[num_dims], num_extra_args);
+
+  // Run all slices of the kernel.
+  return soc.getAccelerator().runKernelNDRange(
+      num_groups[0], num_slices, entry_point, return_addr, num_harts,
+      hart_table.data());
+}
+
+bool RefSiCommandProcessor::prepareHartTable(const RefSiHartTableKey &key) {
+  if ((key == hart_table_key) && (hart_table.size() == key.num_harts)) {
+    return true;
+  }
+  hart_table.assign(key.num_harts, hart_state_entry());
+  hart_table_key = key;
+  return false;
+}
+
+void RefSiCommandProcessor::prepareUniformHartTable(
+    refsi_cmp_command_id opcode, size_t num_harts, uint64_t stack_top,
+    const uint64_t *extra_args, uint32_t num_extra_args) {
+  RefSiHartTableKey key;
+  key.opcode = opcode;
+  key.num_harts = num_harts;
+  key.stack_top = stack_top;
+  key.num_params = num_extra_args;
+  for (uint32_t i = 0; i < num_extra_args; i++) {
+    key.params[i] = extra_args[i];
+  }
+  if (prepareHartTable(key)) {
+    return;
+  }
+  for (hart_state_entry &hart_data : hart_table) {
+    hart_data.stack_top_addr = stack_top;
+    for (uint32_t i = 0; i < num_extra_args; i++) {
+      hart_data.addExtraArg(extra_args[i]);
+    }
+  }
 }
 
 refsi_result RefSiCommandProcessor::executeSYNC_CACHE(
     RefSiCommandContext &cmd) {
-  if (cmd.num_chunks != 0) {
+  // The command optionally specifies the range of code executed by the harts.
+  refsi_addr_t code_addr = 0;
+  uint64_t code_size = 0;
+  if (cmd.num_chunks == 2) {
+    code_addr = cmd.chunks[0];
+    code_size = cmd.chunks[1];
+  } else if (cmd.num_chunks != 0) {
     return refsi_failure;
   }
 
@@ -599,7 +1003,55 @@ refsi_result RefSiCommandProcessor::executeSYNC_CACHE(
                                        CMP_CACHE_SYNC_ACC_ICACHE);
   if (debug) {
     fprintf(stderr,
-            "[CMP] CMP_SYNC_CACHE(flags=0x%x)\n", flags);
+            "[CMP] CMP_SYNC_CACHE(flags=0x%x, code=%s, code_size=0x%zx)\n",
+            flags, formatDeviceAddress(code_addr).c_str(), code_size);
   }
-  return soc.getAccelerator().syncCache(flags);
+  return soc.getAccelerator().syncCache(flags, code_addr, code_size);
+}
+
+refsi_result RefSiCommandProcessor::executeSIGNAL_SEMAPHORE(
+    RefSiCommandContext &cmd) {
+  if (cmd.num_chunks != 1) {
+    return refsi_failure;
+  }
+  uint32_t sem_idx = cmd.inline_chunk;
+  uint64_t value = cmd.chunks[0];
+  if (sem_idx >= CMP_NUM_SEMAPHORES) {
+    return refsi_failure;
+  }
+  if (debug) {
+    fprintf(stderr, "[CMP] CMP_SIGNAL_SEMAPHORE(%d, %zd)\n", sem_idx, value);
+  }
+
+  // Semaphore values never decrease, so that a wait on a value that has been
+  // reached in the past does not block.
+  RefSiLock lock(soc.getLock());
+  semaphores[sem_idx] = std::max(semaphores[sem_idx], value);
+  semaphore_signaled.notify_all();
+  return refsi_success;
+}
+
+refsi_result RefSiCommandProcessor::executeWAIT_SEMAPHORE(
+    RefSiCommandContext &cmd) {
+  if (cmd.num_chunks != 1) {
+    return refsi_failure;
+  }
+  uint32_t sem_idx = cmd.inline_chunk;
+  uint64_t value = cmd.chunks[0];
+  if (sem_idx >= CMP_NUM_SEMAPHORES) {
+    return refsi_failure;
+  }
+  if (debug) {
+    fprintf(stderr, "[CMP] CMP_WAIT_SEMAPHORE(%d, %zd)\n", sem_idx, value);
+  }
+
+  RefSiLock lock(soc.getLock());
+  while (semaphores[sem_idx] < value) {
+    if (stopping) {
+      // The semaphore will never be signaled.
+      return refsi_failure;
+    }
+    semaphore_signaled.wait(lock);
+  }
+  return refsi_success;
 }
@@ -17,6 +17,7 @@
 #include "refsidrv/refsi_device.h"
 
 #include <assert.h>
+#include <algorithm>
 
 #include "refsidrv/refsi_accelerator.h"
 #include "refsidrv/refsi_command_processor.h"
@@ -29,6 +30,22 @@ RefSiDevice::RefSiDevice(refsi_soc_family family) : family(family),
       debug = true;
     }
   }
+  if (const char *val = getenv("REFSI_NUM_CORES")) {
+    unsigned long cores = strtoul(val, nullptr, 0);
+    if (cores > 0) {
+      num_cores = std::min(cores, (unsigned long)max_num_cores);
+    }
+  }
+  if (const char *val = getenv("REFSI_INTERLEAVE")) {
+    if (size_t quantum = strtoul(val, nullptr, 0)) {
+      interleave = quantum;
+    }
+  }
+  if (const char *val = getenv("REFSI_ADAPTIVE_INTERLEAVE")) {
+    if (strcmp(val, "0") != 0) {
+      adaptive_interleave = true;
+    }
+  }
 }
 
 RefSiDevice::~RefSiDevice() {}
@@ -57,12 +74,16 @@ const std::vector<refsi_memory_map_entry> &RefSiDevice::getMemoryMap() const {
 
 refsi_addr_t RefSiDevice::allocDeviceMemory(size_t size, size_t alignment,
                                             refsi_memory_map_kind kind) {
-  RefSiLock lock(mutex);
+  RefSiLock lock(alloc_mutex);
   refsi_addr_t addr;
 
   switch (kind) {
     case DRAM:
-      return allocator.alloc(size, alignment);
+      addr = allocator.alloc(size, alignment);
+      if (addr) {
+        dram_allocs[addr] = size;
+      }
+      return addr;
     case HOST:
       addr = (host_base + alignment - 1) & ~(alignment - 1);
       if (addr + size <= host_base + host_size) {
@@ -75,17 +96,24 @@ refsi_addr_t RefSiDevice::allocDeviceMemory(size_t size, size_t alignment,
 }
 
 refsi_result RefSiDevice::freeDeviceMemory(refsi_addr_t phys_addr) {
-  RefSiLock lock(mutex);
+  RefSiLock lock(alloc_mutex);
   if (phys_addr >= host_base && phys_addr < (host_base + host_size)) {
     // don't need to free host memory
   } else if (phys_addr >= dram_base && phys_addr < (dram_base + dram_size)) {
     allocator.free(phys_addr);
+    // Give the pages backing the allocation back to the host.
+    auto it = dram_allocs.find(phys_addr);
+    if (it != dram_allocs.end()) {
+      RefSiMemoryMapReadLock map_lock(mem_map_mutex);
+      mem_ctl->discardMemRange(phys_addr, it->second);
+      dram_allocs.erase(it);
+    }
   }
   return refsi_success;
 }
 
 void *RefSiDevice::getMappedAddress(refsi_addr_t phys_addr, size_t size) {
-  RefSiLock lock(mutex);
+  RefSiMemoryMapReadLock lock(mem_map_mutex);
   return mem_ctl->addr_to_mem(phys_addr, size, make_unit(unit_kind::external));
 }
 
@@ -105,7 +133,18 @@ refsi_result RefSiDevice::invalidateDeviceMemory(refsi_addr_t phys_addr,
 
 refsi_result RefSiDevice::readDeviceMemory(uint8_t *dest, refsi_addr_t addr,
                                            size_t size, uint32_t unit_id) {
-  RefSiLock lock(mutex);
+  {
+    RefSiMemoryMapReadLock lock(mem_map_mutex);
+    if (isMemoryRange(addr, size, (unit_id_t)unit_id)) {
+      return mem_ctl->load(addr, size, dest, (unit_id_t)unit_id) ?
+            refsi_success : refsi_failure;
+    }
+  }
+
+  // Memory-mapped devices are not synchronized with the threads simulating
+  // the accelerator, which only access them with the execution lock held.
+  RefSiLock exec_lock(exec_mutex);
+  RefSiMemoryMapReadLock lock(mem_map_mutex);
   return mem_ctl->load(addr, size, dest, (unit_id_t)unit_id) ?
         refsi_success : refsi_failure;
 }
@@ -113,7 +152,22 @@ refsi_result RefSiDevice::readDeviceMemory(uint8_t *dest, refsi_addr_t addr,
 refsi_result RefSiDevice::writeDeviceMemory(refsi_addr_t addr,
                                             const uint8_t *source, size_t size,
                                             uint32_t unit_id) {
-  RefSiLock lock(mutex);
+  {
+    RefSiMemoryMapReadLock lock(mem_map_mutex);
+    if (isMemoryRange(addr, size, (unit_id_t)unit_id)) {
+      return mem_ctl->store(addr, size, source, (unit_id_t)unit_id) ?
+            refsi_success : refsi_failure;
+    }
+  }
+
+  // See readDeviceMemory.
+  RefSiLock exec_lock(exec_mutex);
+  RefSiMemoryMapReadLock lock(mem_map_mutex);
   return mem_ctl->store(addr, size, source, (unit_id_t)unit_id) ?
         refsi_success : refsi_failure;
 }
+
+bool RefSiDevice::isMemoryRange(refsi_addr_t phys_addr, size_t size,
+                                unit_id_t unit_id) {
+  return mem_ctl->addr_to_mem(phys_addr, size, unit_id) != nullptr;
+}
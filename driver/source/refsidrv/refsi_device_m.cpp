@@ -25,15 +25,52 @@
 RefSiMDevice::RefSiMDevice() : RefSiDevice(refsi_soc_family::m) {
   RefSiLock lock(mutex);
   mem_ctl = std::make_unique<RefSiMemoryController>(*this);
-  tcdm = mem_ctl->createMemRange(TCDM, tcdm_base, tcdm_size);
-  dram = mem_ctl->createMemRange(DRAM, dram_base, dram_size);
+  // Only commit host memory for the parts of TCDM and DRAM that are used.
+  tcdm = mem_ctl->createMemRange(TCDM, tcdm_base, tcdm_size, true);
+  dram = mem_ctl->createMemRange(DRAM, dram_base, dram_size, true);
   auto host_mem = new HostRAMDevice(host_size);
   mem_ctl->addMemDevice(host_base, host_size, HOST, host_mem);
   host = host_mem;
+  // Kernel DMA transfers are performed in the background by one host thread
+  // per hart, unless REFSI_DMA_THREADS overrides the number of threads. Zero
+  // threads means that transfers are performed synchronously.
+  unsigned num_dma_threads = num_harts_per_core * getNumCores();
+  if (const char *val = getenv("REFSI_DMA_THREADS")) {
+    num_dma_threads = strtoul(val, nullptr, 0);
+  }
   dma_device = new DMADevice(elf_machine::riscv_rv64, dma_io_base,
-                             *mem_ctl.get(), debug);
+                             *mem_ctl.get(), debug, num_dma_threads);
   mem_ctl->addMemDevice(dma_device->get_base(), dma_io_size, KERNEL_DMA_PRIVATE,
                         dma_device);
+  // Kernel DMA transfers complete as soon as their data has been copied,
+  // unless REFSI_DMA_BYTES_PER_CYCLE enables the timing model. Transfers then
+  // take REFSI_DMA_SETUP_CYCLES plus one cycle per REFSI_DMA_BYTES_PER_CYCLE
+  // bytes, measured against the hart's cycle counter, and each hart can have
+  // REFSI_DMA_ENGINES transfers in flight.
+  dma_timing_config dma_timing;
+  if (const char *val = getenv("REFSI_DMA_BYTES_PER_CYCLE")) {
+    dma_timing.bytes_per_cycle = strtoull(val, nullptr, 0);
+  }
+  if (const char *val = getenv("REFSI_DMA_SETUP_CYCLES")) {
+    dma_timing.setup_cycles = strtoull(val, nullptr, 0);
+  }
+  if (const char *val = getenv("REFSI_DMA_ENGINES")) {
+    dma_timing.num_engines = strtoul(val, nullptr, 0);
+  }
+  if (dma_timing.bytes_per_cycle > 0) {
+    dma_device->set_timing(
+        dma_timing,
+        [this](unit_id_t unit) {
+          uint64_t cycles = 0;
+          getAccelerator().readPerfCounter(REFSI_PERF_CNTR_CYCLE,
+                                           get_unit_index(unit), cycles);
+          return cycles;
+        },
+        [this](unit_id_t unit, uint64_t cycles) {
+          getAccelerator().writePerfCounter(REFSI_PERF_CNTR_CYCLE,
+                                            get_unit_index(unit), cycles);
+        });
+  }
   perf_counter_device = new PerfCounterDevice(*this);
   mem_ctl->addMemDevice(perf_counters_io_base, perf_counters_io_size,
                         PERF_COUNTERS, perf_counter_device);
@@ -54,17 +91,61 @@ refsi_result RefSiMDevice::initialize() {
 }
 
 refsi_result RefSiMDevice::executeCommandBuffer(refsi_addr_t cb_addr,
-                                                size_t size) {
+                                                size_t size, uint64_t *fence,
+                                                refsi_cmp_queue_id queue) {
+  RefSiLock lock(mutex);
+  uint64_t request_fence = cmp->enqueueRequest({cb_addr, size}, queue, lock);
+  if (fence) {
+    *fence = request_fence;
+  }
+  return refsi_success;
+}
+
+refsi_result RefSiMDevice::prepareCommandBuffer(refsi_addr_t cb_addr,
+                                                size_t size,
+                                                uint64_t &generation) {
+  RefSiLock lock(mutex);
+  return cmp->prepareCommandBuffer(cb_addr, size, generation);
+}
+
+refsi_result RefSiMDevice::executePreparedCommandBuffer(
+    refsi_addr_t cb_addr, uint64_t generation, uint64_t *fence,
+    refsi_cmp_queue_id queue) {
   RefSiLock lock(mutex);
-  cmp->enqueueRequest({cb_addr, size}, lock);
+  RefSiCommandRequest request;
+  request.command_buffer_addr = cb_addr;
+  request.prepared = cmp->findPreparedCommandBuffer(cb_addr, generation);
+  if (!request.prepared) {
+    return refsi_failure;
+  }
+  request.command_buffer_size = request.prepared->command_buffer_size;
+  uint64_t request_fence = cmp->enqueueRequest(request, queue, lock);
+  if (fence) {
+    *fence = request_fence;
+  }
   return refsi_success;
 }
 
+refsi_result RefSiMDevice::releaseCommandBuffer(refsi_addr_t cb_addr) {
+  RefSiLock lock(mutex);
+  return cmp->releaseCommandBuffer(cb_addr);
+}
+
 void RefSiMDevice::waitForDeviceIdle() {
   RefSiLock lock(mutex);
   cmp->waitEmptyQueue(lock);
 }
 
+refsi_result RefSiMDevice::waitForFence(uint64_t fence) {
+  RefSiLock lock(mutex);
+  return cmp->waitForFence(fence, lock);
+}
+
+uint64_t RefSiMDevice::getSignaledFence() {
+  RefSiLock lock(mutex);
+  return cmp->getSignaledFence();
+}
+
 void RefSiMDevice::preRunSim(slim_sim_t &sim) {
   // We only need to enable the sim's profiler_mode if the profile level is
   // set to 3, as the instruction and cycle counts will be captured
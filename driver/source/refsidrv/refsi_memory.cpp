@@ -17,6 +17,7 @@
 #include "refsidrv/refsi_memory.h"
 #include "refsidrv/refsi_memory_window.h"
 #include "refsidrv/refsi_device.h"
+#include "refsidrv/refsi_perf_counters.h"
 
 RefSiMemoryController::RefSiMemoryController(RefSiDevice &soc)
   : soc(soc) {
@@ -43,13 +44,14 @@ RefSiMemoryController::getMemoryMap() const {
 }
 
 RAMDevice *RefSiMemoryController::createMemRange(refsi_memory_map_kind kind,
-                                                 reg_t address, size_t size) {
+                                                 reg_t address, size_t size,
+                                                 bool sparse) {
   if (kind == HOST) {
     throw std::runtime_error(
         "createMemRange should not be used for HOST memory");
   }
 
-  auto mem = new RAMDevice(size);
+  auto mem = new RAMDevice(size, sparse);
   addMemDevice(address, size, kind, mem);
   return mem;
 }
@@ -70,6 +72,12 @@ void RefSiMemoryController::addMemDevice(reg_t address, size_t size,
     case HOST:
       host = static_cast<HostRAMDevice *>(device);
       break;
+    case KERNEL_DMA_PRIVATE:
+      dma_device = static_cast<DMADevice *>(device);
+      break;
+    case PERF_COUNTERS:
+      perf_counter_device = static_cast<PerfCounterDevice *>(device);
+      break;
     default:
       break;
   }
@@ -79,6 +87,14 @@ RefSiMemoryWindow *RefSiMemoryController::getWindow(unsigned index) const {
   return (index < windows.size()) ? windows[index] : 0;
 }
 
+void RefSiMemoryController::discardMemRange(reg_t address, size_t size) {
+  reg_t dev_offset = 0;
+  MemoryDevice *device = find_device(address, dev_offset);
+  if (device && ((device == dram) || (device == tcdm))) {
+    static_cast<RAMDevice *>(device)->discard(dev_offset, size);
+  }
+}
+
 refsi_result
 RefSiMemoryController::handleWindowRegWrite(refsi_cmp_register_id reg_idx,
                                             uint64_t value) {
@@ -171,43 +171,37 @@ size_t RefSiMemoryWindow::mem_size() const {
   return isMapped() ? mapped_config.size : config.size;
 }
 
-bool RefSiMemoryWindow::load(reg_t addr, size_t len, uint8_t *bytes,
-                             unit_id_t unit) {
-  refsi_addr_t target_addr = 0;
-  if ((addr + len) >= config.size) {
-    return false;
+MemoryDevice *RefSiMemoryWindow::resolve(reg_t addr, size_t size,
+                                         unit_id_t unit, reg_t &target_addr) {
+  refsi_addr_t eff_address = 0;
+  if ((addr + size) > mapped_config.size) {
+    return nullptr;
   } else if (!mapped_device) {
-    return false;
-  } else if (refsi_success != getEffectiveAddress(addr, unit, target_addr)) {
-    return false;
-  } else {
-    return mapped_device->load(target_addr, len, bytes, unit);
+    return nullptr;
+  } else if (refsi_success != getEffectiveAddress(addr, unit, eff_address)) {
+    return nullptr;
   }
+  target_addr = eff_address;
+  return mapped_device;
+}
+
+bool RefSiMemoryWindow::load(reg_t addr, size_t len, uint8_t *bytes,
+                             unit_id_t unit) {
+  reg_t target_addr = 0;
+  MemoryDevice *device = resolve(addr, len, unit, target_addr);
+  return device && device->load(target_addr, len, bytes, unit);
 }
 
 bool RefSiMemoryWindow::store(reg_t addr, size_t len, const uint8_t *bytes,
                               unit_id_t unit) {
-  refsi_addr_t target_addr = 0;
-  if ((addr + len) >= config.size) {
-    return false;
-  } else if (!mapped_device) {
-    return false;
-  } else if (refsi_success != getEffectiveAddress(addr, unit, target_addr)) {
-    return false;
-  } else {
-    return mapped_device->store(target_addr, len, bytes, unit);
-  }
+  reg_t target_addr = 0;
+  MemoryDevice *device = resolve(addr, len, unit, target_addr);
+  return device && device->store(target_addr, len, bytes, unit);
 }
 
 uint8_t *RefSiMemoryWindow::addr_to_mem(reg_t addr, size_t size,
                                         unit_id_t unit) {
-  refsi_addr_t target_addr = 0;
-  if (!mapped_device) {
-    return nullptr;
-  } else if (refsi_success != getEffectiveAddress(addr, unit, target_addr)) {
-    return nullptr;
-  } else {
-    return mapped_device->addr_to_mem(target_addr, size, unit);
-  }
-  return nullptr;
+  reg_t target_addr = 0;
+  MemoryDevice *device = resolve(addr, size, unit, target_addr);
+  return device ? device->addr_to_mem(target_addr, size, unit) : nullptr;
 }
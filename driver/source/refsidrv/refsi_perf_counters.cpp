@@ -17,6 +17,10 @@
 #include "refsi_perf_counters.h"
 #include "refsi_device.h"
 #include "refsi_accelerator.h"
+#include "refsi_memory.h"
+
+#include <algorithm>
+#include <cstring>
 
 PerfCounterDevice::PerfCounterDevice(RefSiDevice &soc) : soc(soc) {
   global_counters.resize(num_global_perf_counters);
@@ -44,6 +48,32 @@ bool PerfCounterDevice::get_perf_counter_index(reg_t rel_addr,
   return (counter_idx < global_counters.size());
 }
 
+uint64_t PerfCounterDevice::read_global_counter(size_t counter_idx) {
+  // DMA counters are maintained by the DMA device.
+  DMADevice *dma = soc.getMemory().getDMADevice();
+  if (dma && (counter_idx == REFSI_PERF_CNTR_DMA_BUSY_CYCLE)) {
+    return dma->get_timing_stats().busy_cycles;
+  } else if (dma && (counter_idx == REFSI_PERF_CNTR_DMA_IDLE_CYCLE)) {
+    return dma->get_timing_stats().idle_cycles;
+  }
+  return global_counters[counter_idx];
+}
+
+void PerfCounterDevice::write_global_counter(size_t counter_idx, uint64_t val) {
+  DMADevice *dma = soc.getMemory().getDMADevice();
+  if (dma && (counter_idx == REFSI_PERF_CNTR_DMA_BUSY_CYCLE)) {
+    dma_timing_stats stats = dma->get_timing_stats();
+    stats.busy_cycles = val;
+    dma->set_timing_stats(stats);
+  } else if (dma && (counter_idx == REFSI_PERF_CNTR_DMA_IDLE_CYCLE)) {
+    dma_timing_stats stats = dma->get_timing_stats();
+    stats.idle_cycles = val;
+    dma->set_timing_stats(stats);
+  } else {
+    global_counters[counter_idx] = val;
+  }
+}
+
 bool PerfCounterDevice::load(reg_t addr, size_t len, uint8_t *bytes,
                              unit_id_t unit_id) {
   // Handle multi-counter accesses.
@@ -51,12 +81,7 @@ bool PerfCounterDevice::load(reg_t addr, size_t len, uint8_t *bytes,
     if (len % sizeof(uint64_t)) {
       return false;
     }
-    for (reg_t i = 0; i < len; i += sizeof(uint64_t)) {
-      if (!load(addr + i, sizeof(uint64_t), bytes + i, unit_id)) {
-        return false;
-      }
-    }
-    return true;
+    return load_counters(addr, len / sizeof(uint64_t), bytes, unit_id);
   }
 
   // Retrieve and validate the counter index.
@@ -78,7 +103,7 @@ bool PerfCounterDevice::load(reg_t addr, size_t len, uint8_t *bytes,
       return false;
     }
   } else {
-    val = global_counters[counter_idx];
+    val = read_global_counter(counter_idx);
   }
 
   // Copy the value read from the performance counter to the caller.
@@ -91,6 +116,51 @@ bool PerfCounterDevice::load(reg_t addr, size_t len, uint8_t *bytes,
   return true;
 }
 
+bool PerfCounterDevice::load_counters(reg_t addr, size_t count,
+                                      uint8_t *bytes, unit_id_t unit_id) {
+  size_t first_idx = 0;
+  bool is_per_hart = false;
+  if (count == 0) {
+    return true;
+  } else if (!get_perf_counter_index(addr, first_idx, is_per_hart)) {
+    return false;
+  }
+
+  // Read the per-hart counters in the range with a single request to the
+  // accelerator.
+  size_t num_read = 0;
+  if (is_per_hart) {
+    if (get_unit_kind(unit_id) != unit_kind::acc_hart) {
+      return false;
+    }
+    size_t num_per_hart =
+        std::min(count, (size_t)num_per_hart_perf_counters - first_idx);
+    RefSiAccelerator &acc = soc.getAccelerator();
+    // The destination may not be aligned, so read the counters into a buffer
+    // on the stack first.
+    uint64_t values[num_per_hart_perf_counters];
+    if (refsi_success != acc.readPerfCounters(first_idx, num_per_hart,
+                                              get_unit_index(unit_id),
+                                              values)) {
+      return false;
+    }
+    memcpy(bytes, values, num_per_hart * sizeof(uint64_t));
+    num_read = num_per_hart;
+    first_idx = 0;
+  }
+
+  // Read global counters, which follow the per-hart counters.
+  size_t num_global = count - num_read;
+  if ((first_idx + num_global) > global_counters.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < num_global; i++) {
+    uint64_t val = read_global_counter(first_idx + i);
+    memcpy(bytes + ((num_read + i) * sizeof(uint64_t)), &val, sizeof(val));
+  }
+  return true;
+}
+
 bool PerfCounterDevice::store(reg_t addr, size_t len, const uint8_t *bytes,
                               unit_id_t unit_id) {
   // Multi-counter writes are not supported.
@@ -126,7 +196,7 @@ bool PerfCounterDevice::store(reg_t addr, size_t len, const uint8_t *bytes,
       return false;
     }
   } else {
-    global_counters[counter_idx] = val;
+    write_global_counter(counter_idx, val);
   }
   return true;
 }
@@ -150,6 +150,77 @@ refsi_result refsiExecuteCommandBuffer(refsi_device_t device,
   return m_device->executeCommandBuffer(cb_addr, size);
 }
 
+refsi_result refsiExecuteCommandBufferAsync(refsi_device_t device,
+                                            refsi_addr_t cb_addr, size_t size,
+                                            uint64_t *fence) {
+  if (!device) {
+    return refsi_invalid_device;
+  } else if (device->getFamily() != refsi_soc_family::m) {
+    return refsi_not_supported;
+  } else if (!fence) {
+    return refsi_failure;
+  }
+  RefSiMDevice *m_device = (RefSiMDevice *)device;
+  return m_device->executeCommandBuffer(cb_addr, size, fence);
+}
+
+refsi_result refsiExecuteCommandBufferOnQueue(refsi_device_t device,
+                                              refsi_cmp_queue_id queue,
+                                              refsi_addr_t cb_addr,
+                                              size_t size, uint64_t *fence) {
+  if (!device) {
+    return refsi_invalid_device;
+  } else if (device->getFamily() != refsi_soc_family::m) {
+    return refsi_not_supported;
+  } else if ((queue < CMP_QUEUE_COMPUTE) || (queue >= CMP_NUM_QUEUES)) {
+    return refsi_failure;
+  }
+  RefSiMDevice *m_device = (RefSiMDevice *)device;
+  return m_device->executeCommandBuffer(cb_addr, size, fence, queue);
+}
+
+refsi_result refsiPrepareCommandBuffer(refsi_device_t device,
+                                       refsi_addr_t cb_addr, size_t size,
+                                       uint64_t *generation) {
+  if (!device) {
+    return refsi_invalid_device;
+  } else if (device->getFamily() != refsi_soc_family::m) {
+    return refsi_not_supported;
+  } else if (!generation) {
+    return refsi_failure;
+  }
+  RefSiMDevice *m_device = (RefSiMDevice *)device;
+  return m_device->prepareCommandBuffer(cb_addr, size, *generation);
+}
+
+refsi_result refsiExecutePreparedCommandBuffer(refsi_device_t device,
+                                               refsi_cmp_queue_id queue,
+                                               refsi_addr_t cb_addr,
+                                               uint64_t generation,
+                                               uint64_t *fence) {
+  if (!device) {
+    return refsi_invalid_device;
+  } else if (device->getFamily() != refsi_soc_family::m) {
+    return refsi_not_supported;
+  } else if ((queue < CMP_QUEUE_COMPUTE) || (queue >= CMP_NUM_QUEUES)) {
+    return refsi_failure;
+  }
+  RefSiMDevice *m_device = (RefSiMDevice *)device;
+  return m_device->executePreparedCommandBuffer(cb_addr, generation, fence,
+                                                queue);
+}
+
+refsi_result refsiReleaseCommandBuffer(refsi_device_t device,
+                                       refsi_addr_t cb_addr) {
+  if (!device) {
+    return refsi_invalid_device;
+  } else if (device->getFamily() != refsi_soc_family::m) {
+    return refsi_not_supported;
+  }
+  RefSiMDevice *m_device = (RefSiMDevice *)device;
+  return m_device->releaseCommandBuffer(cb_addr);
+}
+
 void refsiWaitForDeviceIdle(refsi_device_t device) {
   if (!device) {
     return;
@@ -160,6 +231,29 @@ void refsiWaitForDeviceIdle(refsi_device_t device) {
   m_device->waitForDeviceIdle();
 }
 
+refsi_result refsiWaitForFence(refsi_device_t device, uint64_t fence) {
+  if (!device) {
+    return refsi_invalid_device;
+  } else if (device->getFamily() != refsi_soc_family::m) {
+    return refsi_not_supported;
+  }
+  RefSiMDevice *m_device = (RefSiMDevice *)device;
+  return m_device->waitForFence(fence);
+}
+
+refsi_result refsiGetSignaledFence(refsi_device_t device, uint64_t *fence) {
+  if (!device) {
+    return refsi_invalid_device;
+  } else if (device->getFamily() != refsi_soc_family::m) {
+    return refsi_not_supported;
+  } else if (!fence) {
+    return refsi_failure;
+  }
+  RefSiMDevice *m_device = (RefSiMDevice *)device;
+  *fence = m_device->getSignaledFence();
+  return refsi_success;
+}
+
 refsi_result refsiExecuteKernel(refsi_device_t device,
                                 refsi_addr_t entry_fn_addr,
                                 uint32_t num_harts) {
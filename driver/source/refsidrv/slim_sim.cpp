@@ -27,8 +27,13 @@
 #include <cstdlib>
 #include <cstring>
 #include <cassert>
+#include <thread>
 #include <signal.h>
 
+// Index of the hart stepped by the current host thread, when running harts in
+// parallel. Worker threads only ever step a single hart of a single simulator.
+static thread_local size_t worker_hart_id = ~(size_t)0;
+
 slim_sim_config::slim_sim_config() {
   debug = false;
   if (const char *val = getenv("SPIKE_SIM_DEBUG")) {
@@ -54,6 +59,12 @@ slim_sim_config::slim_sim_config() {
       hal_debug = true;
     }
   }
+  parallel = false;
+  if (const char *val = getenv("SPIKE_SIM_PARALLEL")) {
+    if (strcmp(val, "0") != 0) {
+      parallel = true;
+    }
+  }
 
   num_harts = 1;
   pmp_num = 16;
@@ -64,17 +75,25 @@ slim_sim_config::slim_sim_config() {
 
 slim_sim_t::slim_sim_t(const slim_sim_config &config, MemoryInterface &mem_if)
     : harts(std::max(config.num_harts, size_t(1))),
+      hart_id_base(config.hart_id_base),
       mem_if(mem_if),
       log_file(config.log_path),
       current_step(0),
       current_hart_id(0),
+      interleave(std::max(config.interleave, size_t(1))),
+      adaptive_interleave(config.adaptive_interleave),
+      min_interleave(std::max(std::min(config.min_interleave, interleave),
+                              size_t(1))),
+      max_interleave(std::max(config.max_interleave, interleave)),
+      log_interleave(config.log_interleave),
       debug(config.debug),
       log(false),
+      parallel(config.parallel),
       isa_parser(config.isa, config.priv) {
   debugger.reset(new debugger_t(*this));
 
   for (size_t i = 0; i < config.num_harts; i++) {
-    int hart_id = i;
+    int hart_id = hart_id_base + i;
     harts[i] = new processor_t(&isa_parser, config.varch.c_str(), this, hart_id,
                                /* halted */ false, log_file.get(), std::cout);
   }
@@ -84,6 +103,7 @@ slim_sim_t::slim_sim_t(const slim_sim_config &config, MemoryInterface &mem_if)
     harts[i]->set_pmp_granularity(config.pmp_granularity);
   }
   hart_barrier_address.resize(config.num_harts, 0);
+  hart_events.resize(config.num_harts);
 
   configure_log(config.log, config.log_commits);
 }
@@ -99,11 +119,15 @@ int slim_sim_t::run() {
   signal_exit = false;
   current_hart_id = 0;
   current_step = 0;
+  window_slices = 0;
+  window_sync_events = 0;
   for (size_t i = 0; i < harts.size(); i++) {
     is_hart_running[i] = (i < get_hart_number());
     hart_barrier_address[i] = 0;
+    hart_events[i] = slim_sim_event();
     harts[i]->get_state()->profiler_mode = false;
   }
+  is_hart_parked.reset();
   if (!debug && log) {
     set_procs_debug(true);
   }
@@ -121,40 +145,205 @@ int slim_sim_t::run() {
         debugger->read_command();
         debugger->run_command();
       }
+    } else if (parallel && !may_use_atomics && !log &&
+               get_hart_number() > 1) {
+      run_parallel();
     } else {
-      step(INTERLEAVE);
+      step(interleave);
     }
   }
 
   return exit_code;
 }
 
+void slim_sim_t::step_hart(processor_t *hart, size_t n) {
+  hart->step(n);
+  handle_hart_events(hart);
+}
+
+bool slim_sim_t::handle_hart_events(processor_t *hart) {
+  state_t *hart_state = hart->get_state();
+  if (hart_state->mcause->read() != 0 && trap_handler) {
+    handle_trap(hart);
+    return true;
+  } else if (hart_state->pc == hart_state->bp_addr) {
+    handle_breakpoint(hart);
+    return true;
+  }
+  return false;
+}
+
 void slim_sim_t::step(size_t n) {
   for (size_t i = 0, steps = 0; i < n; i += steps) {
-    steps = std::min(n - i, INTERLEAVE - current_step);
-    if (is_hart_running[current_hart_id]) {
-      processor_t *hart = harts[current_hart_id];
-      state_t *hart_state = hart->get_state();
-      hart->step(steps);
-      if (hart_state->mcause->read() != 0 && trap_handler) {
-        handle_trap(hart);
-      } else if (hart_state->pc == hart_state->bp_addr) {
-        handle_breakpoint(hart);
+    if (is_hart_parked.any()) {
+      wake_parked_harts();
+    }
+    if (!is_hart_running[current_hart_id]) {
+      // The hart has exited or is asleep. Give the rest of its time slice to
+      // the next hart that can make progress.
+      size_t next_hart_id = find_running_hart(current_hart_id);
+      if (next_hart_id == get_hart_number()) {
+        return;
       }
+      current_hart_id = next_hart_id;
+      current_step = 0;
     }
+    steps = std::min(n - i, interleave - current_step);
+    step_hart(harts[current_hart_id], steps);
 
     current_step += steps;
-    if (current_step == n) {
+    if ((current_step == n) || (current_step >= interleave)) {
       current_step = 0;
       if (is_hart_running[current_hart_id]) {
         harts[current_hart_id]->get_mmu()->yield_load_reservation();
       }
-      if (++current_hart_id == get_hart_number()) {
-        // TODO find the next 'still running' hart.
-        current_hart_id = 0;
+      end_time_slice();
+      size_t next_hart_id = find_running_hart(current_hart_id + 1);
+      if (next_hart_id < get_hart_number()) {
+        current_hart_id = next_hart_id;
+      }
+    }
+  }
+}
+
+size_t slim_sim_t::find_running_hart(size_t start) const {
+  // Search the running bits one word at a time, starting at 'start' and
+  // wrapping around to the first hart.
+  const size_t num_harts = get_hart_number();
+  const size_t word_bits = 64;
+  const std::bitset<REFSI_SIM_MAX_HARTS> word_mask(~0ull);
+  for (size_t pass = 0; pass < 2; pass++) {
+    size_t first = (pass == 0) ? start : 0;
+    size_t last = (pass == 0) ? num_harts : std::min(start, num_harts);
+    for (size_t base = first; base < last; base += word_bits) {
+      uint64_t word = ((is_hart_running >> base) & word_mask).to_ullong();
+      if (word != 0) {
+        size_t hart_id = base + __builtin_ctzll(word);
+        if (hart_id < last) {
+          return hart_id;
+        }
+        break;
+      }
+    }
+  }
+  return num_harts;
+}
+
+void slim_sim_t::end_time_slice() {
+  window_slices++;
+  if (adaptive_interleave && !debug &&
+      (window_slices >= std::max(get_hart_number(), size_t(16)))) {
+    adapt_interleave();
+  }
+}
+
+void slim_sim_t::adapt_interleave() {
+  // Harts that wait on each other (barriers) or on DMA transfers only make
+  // progress once the harts they wait on have been stepped, which favours
+  // short time slices. Switching between harts has a cost (yielding load
+  // reservations, handling traps) which favours long time slices when harts
+  // are independent.
+  size_t new_interleave = interleave;
+  if ((window_sync_events * 4) >= window_slices) {
+    new_interleave = std::max(interleave / 2, min_interleave);
+  } else if (window_sync_events == 0) {
+    new_interleave = std::min(interleave * 2, max_interleave);
+  }
+  if (log_interleave && (new_interleave != interleave)) {
+    fprintf(stderr, "[SIM] interleave=%zu (was %zu), sync_events=%zu, "
+            "time_slices=%zu\n", new_interleave, interleave,
+            window_sync_events, window_slices);
+  }
+  interleave = new_interleave;
+  window_slices = 0;
+  window_sync_events = 0;
+}
+
+void slim_sim_t::wake_parked_harts() {
+  for (size_t i = 0; i < get_hart_number(); i++) {
+    if (is_hart_parked[i] && hart_events[i].is_done()) {
+      is_hart_parked[i] = false;
+      is_hart_running[i] = true;
+    }
+  }
+
+  // When no hart can make progress, block until the first parked hart's event
+  // happens instead of spinning.
+  if (is_hart_running.none() && is_hart_parked.any()) {
+    for (size_t i = 0; i < get_hart_number(); i++) {
+      if (is_hart_parked[i]) {
+        hart_events[i].wait();
+        is_hart_parked[i] = false;
+        is_hart_running[i] = true;
+        break;
+      }
+    }
+  }
+}
+
+void slim_sim_t::run_parallel() {
+  // Each hart is stepped on its own host thread. Harts synchronize with each
+  // other at well-defined points only:
+  //   1) Traps and breakpoints (which includes barriers and hart exits) are
+  //      handled while holding sync_lock.
+  //   2) Accesses to memory-mapped devices are serialized with mmio_lock.
+  //   3) Load reservations are yielded at the end of every time slice, like
+  //      they are when interleaving harts on a single thread.
+  //   4) Parked harts wait for their event without holding any lock.
+  // Nothing serializes AMOs or LR/SC sequences between harts, which is why
+  // run() only gets here when the harts' code does not use atomics.
+  std::vector<std::thread> workers;
+  parallel_running = true;
+  for (size_t i = 0; i < get_hart_number(); i++) {
+    workers.emplace_back(&slim_sim_t::run_hart_worker, this, i);
+  }
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  parallel_running = false;
+}
+
+void slim_sim_t::run_hart_worker(size_t hart_id) {
+  worker_hart_id = hart_id;
+  processor_t *hart = harts[hart_id];
+  while (true) {
+    size_t quantum = 0;
+    // Sleep while the hart is waiting on a barrier or has exited.
+    {
+      std::unique_lock<std::mutex> lock(sync_lock);
+      hart_woken.wait(lock, [&] {
+        return signal_exit || is_hart_running[hart_id] ||
+               is_hart_parked[hart_id];
+      });
+      if (!signal_exit && is_hart_parked[hart_id]) {
+        slim_sim_event event = hart_events[hart_id];
+        lock.unlock();
+        event.wait();
+        lock.lock();
+        if (is_hart_parked[hart_id]) {
+          is_hart_parked[hart_id] = false;
+          is_hart_running[hart_id] = true;
+        }
+      }
+      if (signal_exit) {
+        break;
+      }
+      quantum = interleave;
+    }
+
+    hart->step(quantum);
+    {
+      std::unique_lock<std::mutex> lock(sync_lock);
+      if (handle_hart_events(hart)) {
+        // Handling the trap may have woken up other harts (e.g. when this hart
+        // was the last one to reach a barrier) or ended the simulation.
+        hart_woken.notify_all();
       }
+      end_time_slice();
     }
+    hart->get_mmu()->yield_load_reservation();
   }
+  worker_hart_id = ~(size_t)0;
 }
 
 void slim_sim_t::run_single_step(bool noisy, size_t steps) {
@@ -170,6 +359,11 @@ void slim_sim_t::handle_trap(processor_t *hart) {
                   hart_state->mtval->read(), hart_state->mtval2->read(),
                   hart_state->mtinst->read());
   if (trap_handler->handle_trap(trap, hart_state->mepc->read(), *this)) {
+    // The trap handler may have already resumed execution elsewhere.
+    if (hart_state->mcause->read() == 0) {
+      return;
+    }
+
     // Calculate the PC of the instruction following the one that caused the
     // trap.
     reg_t old_pc = hart_state->mepc->read();
@@ -205,6 +399,10 @@ void slim_sim_t::return_from_trap(state_t *hart_state, reg_t new_pc) {
   // TODO: restore mstatus for completeness
 }
 
+size_t slim_sim_t::get_current_hart_id() const {
+  return parallel_running ? worker_hart_id : current_hart_id;
+}
+
 processor_t* slim_sim_t::get_hart(size_t index) const {
   return (index < get_hart_number()) ? harts[index] : nullptr;
 }
@@ -254,7 +452,12 @@ bool slim_sim_t::mmio_load(reg_t addr, size_t len, uint8_t* bytes) {
   if (addr + len < addr || !paddr_ok(addr + len - 1)) {
     return false;
   }
-  unit_id_t unit = make_unit(unit_kind::acc_hart, get_current_hart_id());
+  unit_id_t unit = make_unit(unit_kind::acc_hart,
+                             hart_id_base + get_current_hart_id());
+  std::unique_lock<std::mutex> lock(mmio_lock, std::defer_lock);
+  if (parallel_running) {
+    lock.lock();
+  }
   return mem_if.load(addr, len, bytes, unit);
 }
 
@@ -262,7 +465,12 @@ bool slim_sim_t::mmio_store(reg_t addr, size_t len, const uint8_t* bytes) {
   if (addr + len < addr || !paddr_ok(addr + len - 1)) {
     return false;
   }
-  unit_id_t unit = make_unit(unit_kind::acc_hart, get_current_hart_id());
+  unit_id_t unit = make_unit(unit_kind::acc_hart,
+                             hart_id_base + get_current_hart_id());
+  std::unique_lock<std::mutex> lock(mmio_lock, std::defer_lock);
+  if (parallel_running) {
+    lock.lock();
+  }
   return mem_if.store(addr, len, bytes, unit);
 }
 
@@ -270,22 +478,32 @@ char* slim_sim_t::addr_to_mem(reg_t addr) {
   if (!paddr_ok(addr)) {
     return NULL;
   }
-  unit_id_t unit = make_unit(unit_kind::acc_hart, get_current_hart_id());
+  unit_id_t unit = make_unit(unit_kind::acc_hart,
+                             hart_id_base + get_current_hart_id());
+  std::unique_lock<std::mutex> lock(mmio_lock, std::defer_lock);
+  if (parallel_running) {
+    lock.lock();
+  }
   return (char *)mem_if.addr_to_mem(addr, sizeof(uint8_t), unit);
 }
 
 void slim_sim_t::proc_reset(unsigned id) {
 }
 
+bool slim_sim_t::is_hart_alive() const {
+  return is_hart_running.any() || is_hart_parked.any();
+}
+
 void slim_sim_t::set_exited(reg_t exit_code) {
   if (exit_code != 0) {
     // When a thread exits with a non-zero code, abort simulation.
     is_hart_running.reset();
+    is_hart_parked.reset();
   } else {
     // When a thread exits gracefully, wait for other threads to have finished
     // executing before stopping the simulator.
-    is_hart_running[current_hart_id] = false;
-    if (is_hart_running.any()) {
+    is_hart_running[get_current_hart_id()] = false;
+    if (is_hart_alive()) {
       return;
     }
   }
@@ -297,11 +515,13 @@ bool slim_sim_t::handle_barrier(reg_t link_address) {
   // Put the hart to sleep and record the link address. It is used to identify
   // the call site of the barrier in user code and error when different harts
   // hit different barriers at the same time.
-  hart_barrier_address[current_hart_id] = link_address;
-  is_hart_running[current_hart_id] = false;
+  size_t hart_id = get_current_hart_id();
+  hart_barrier_address[hart_id] = link_address;
+  is_hart_running[hart_id] = false;
+  window_sync_events++;
 
   // Wait for all harts to be asleep.
-  if (is_hart_running.any()) {
+  if (is_hart_alive()) {
     return true;
   }
 
@@ -323,6 +543,14 @@ bool slim_sim_t::handle_barrier(reg_t link_address) {
   return true;
 }
 
+void slim_sim_t::park_hart(const slim_sim_event &event) {
+  size_t hart_id = get_current_hart_id();
+  hart_events[hart_id] = event;
+  is_hart_running[hart_id] = false;
+  is_hart_parked[hart_id] = true;
+  window_sync_events++;
+}
+
 bool slim_sim_t::mmio_print(reg_t addr) {
   // Fast path: the message to print is stored in regular memory.
   char *data = addr_to_mem(addr);
@@ -0,0 +1,111 @@
+// Copyright (C) Codeplay Software Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License") with LLVM
+// Exceptions; you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://github.com/codeplaysoftware/oneapi-construction-kit/blob/main/LICENSE.txt
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+//
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+// Check that command buffers on different CMP queues are ordered by semaphores
+// and only by semaphores: a queue blocked on a semaphore does not stop the
+// other queues, and commands that wait for a semaphore see the results of the
+// commands executed before it was signaled.
+
+#include <chrono>
+#include <thread>
+
+#include "refsidrv_test.h"
+
+namespace {
+
+uint64_t submit(refsi_device_t device, refsi_cmp_queue_id queue,
+                const std::vector<uint64_t> &commands) {
+  refsi_addr_t cb_addr = writeCommandBuffer(device, commands);
+  uint64_t fence = 0;
+  REFSI_CHECK(refsiExecuteCommandBufferOnQueue(
+                  device, queue, cb_addr, commands.size() * sizeof(uint64_t),
+                  &fence) == refsi_success);
+  return fence;
+}
+
+void addCopy(std::vector<uint64_t> &commands, refsi_addr_t src_addr,
+             refsi_addr_t dst_addr, uint32_t count) {
+  commands.push_back(refsiEncodeCMPCommand(CMP_COPY_MEM64, 3, count));
+  commands.push_back(src_addr);
+  commands.push_back(dst_addr);
+  commands.push_back(test_unit_id);
+}
+
+}  // namespace
+
+int main() {
+  refsi_device_t device = openTestDevice();
+
+  const uint32_t count = 4096;
+  const size_t size = count * sizeof(uint64_t);
+  const uint32_t sem_idx = 0;
+  refsi_addr_t src_addr = allocDeviceMemory(device, size);
+  refsi_addr_t staging_addr = allocDeviceMemory(device, size);
+  refsi_addr_t result_addr = allocDeviceMemory(device, size);
+  refsi_addr_t flag_addr = allocDeviceMemory(device, sizeof(uint64_t));
+  std::vector<uint64_t> values(count);
+  for (uint32_t i = 0; i < count; i++) {
+    values[i] = (i * 0x9e3779b97f4a7c15ull) + 1;
+  }
+  std::vector<uint64_t> zeros(count, 0);
+  writeDeviceBuffer(device, src_addr, values.data(), size);
+  writeDeviceBuffer(device, staging_addr, zeros.data(), size);
+  writeDeviceBuffer(device, result_addr, zeros.data(), size);
+  writeDeviceValue(device, flag_addr, 0);
+
+  // The compute queue waits for the staging buffer to be filled by the copy
+  // queue, which has not been given any work yet.
+  std::vector<uint64_t> compute_commands;
+  compute_commands.push_back(
+      refsiEncodeCMPCommand(CMP_WAIT_SEMAPHORE, 1, sem_idx));
+  compute_commands.push_back(1);
+  addCopy(compute_commands, staging_addr, result_addr, count);
+  compute_commands.push_back(refsiEncodeCMPCommand(CMP_FINISH, 0, 0));
+  uint64_t compute_fence = submit(device, CMP_QUEUE_COMPUTE, compute_commands);
+
+  // The high-priority queue is not blocked by the compute queue.
+  std::vector<uint64_t> priority_commands;
+  priority_commands.push_back(
+      refsiEncodeCMPCommand(CMP_STORE_IMM64, 1, (uint32_t)flag_addr));
+  priority_commands.push_back(1);
+  priority_commands.push_back(refsiEncodeCMPCommand(CMP_FINISH, 0, 0));
+  submit(device, CMP_QUEUE_HIGH_PRIORITY, priority_commands);
+  for (int i = 0; readDeviceValue(device, flag_addr) != 1; i++) {
+    REFSI_CHECK(i < 10000);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  uint64_t signaled_fence = 0;
+  REFSI_CHECK(refsiGetSignaledFence(device, &signaled_fence) == refsi_success);
+  REFSI_CHECK(signaled_fence < compute_fence);
+
+  // Fill the staging buffer on the copy queue, then unblock the compute queue.
+  std::vector<uint64_t> copy_commands;
+  addCopy(copy_commands, src_addr, staging_addr, count);
+  copy_commands.push_back(
+      refsiEncodeCMPCommand(CMP_SIGNAL_SEMAPHORE, 1, sem_idx));
+  copy_commands.push_back(1);
+  copy_commands.push_back(refsiEncodeCMPCommand(CMP_FINISH, 0, 0));
+  uint64_t copy_fence = submit(device, CMP_QUEUE_COPY, copy_commands);
+
+  REFSI_CHECK(refsiWaitForFence(device, compute_fence) == refsi_success);
+  REFSI_CHECK(refsiWaitForFence(device, copy_fence) == refsi_success);
+  std::vector<uint64_t> result(count);
+  readDeviceBuffer(device, result.data(), result_addr, size);
+  REFSI_CHECK(result == values);
+
+  closeTestDevice(device);
+  return 0;
+}
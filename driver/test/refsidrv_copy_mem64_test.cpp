@@ -0,0 +1,97 @@
+// Copyright (C) Codeplay Software Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License") with LLVM
+// Exceptions; you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://github.com/codeplaysoftware/oneapi-construction-kit/blob/main/LICENSE.txt
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+//
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+// Check that CMP_COPY_MEM64 copies the same values whether it copies memory in
+// one go, reads performance counters in a batch or copies device registers one
+// at a time.
+
+#include "refsidrv_test.h"
+
+namespace {
+
+/// @brief Execute a command buffer that copies @p count registers from
+/// @p src_addr, accessed as @p unit_id, to @p dst_addr.
+void copyMem64(refsi_device_t device, refsi_addr_t src_addr,
+               refsi_addr_t dst_addr, uint32_t count, uint32_t unit_id) {
+  std::vector<uint64_t> commands;
+  commands.push_back(refsiEncodeCMPCommand(CMP_COPY_MEM64, 3, count));
+  commands.push_back(src_addr);
+  commands.push_back(dst_addr);
+  commands.push_back(unit_id);
+  commands.push_back(refsiEncodeCMPCommand(CMP_FINISH, 0, 0));
+  refsi_addr_t cb_addr = writeCommandBuffer(device, commands);
+  uint64_t fence = 0;
+  REFSI_CHECK(refsiExecuteCommandBufferAsync(
+                  device, cb_addr, commands.size() * sizeof(uint64_t),
+                  &fence) == refsi_success);
+  REFSI_CHECK(refsiWaitForFence(device, fence) == refsi_success);
+  REFSI_CHECK(refsiFreeDeviceMemory(device, cb_addr) == refsi_success);
+}
+
+std::vector<uint64_t> readValues(refsi_device_t device, refsi_addr_t addr,
+                                 uint32_t count, uint32_t unit_id) {
+  std::vector<uint64_t> values(count);
+  for (uint32_t i = 0; i < count; i++) {
+    REFSI_CHECK(refsiReadDeviceMemory(
+                    device, (uint8_t *)&values[i],
+                    addr + (i * sizeof(uint64_t)), sizeof(uint64_t),
+                    unit_id) == refsi_success);
+  }
+  return values;
+}
+
+}  // namespace
+
+int main() {
+  refsi_device_t device = openTestDevice();
+
+  const uint32_t count = 64;
+  const size_t size = count * sizeof(uint64_t);
+  refsi_addr_t src_addr = allocDeviceMemory(device, size);
+  refsi_addr_t dst_addr = allocDeviceMemory(device, size);
+
+  // Memory to memory.
+  std::vector<uint64_t> values(count);
+  for (uint32_t i = 0; i < count; i++) {
+    values[i] = 0x0101010101010101ull * (i + 1);
+  }
+  writeDeviceBuffer(device, src_addr, values.data(), size);
+  copyMem64(device, src_addr, dst_addr, count, test_unit_id);
+  REFSI_CHECK(readValues(device, dst_addr, count, test_unit_id) == values);
+
+  // Per-hart performance counters to memory.
+  refsi_addr_t counters_addr = findMemoryMapEntry(device, PERF_COUNTERS);
+  REFSI_CHECK(counters_addr != 0);
+  const uint32_t num_counters = REFSI_NUM_PER_HART_PERF_COUNTERS;
+  uint32_t hart_unit = REFSI_UNIT_ID(REFSI_UNIT_KIND_ACC_HART, 1);
+  copyMem64(device, counters_addr, dst_addr, num_counters, hart_unit);
+  REFSI_CHECK(readValues(device, dst_addr, num_counters, test_unit_id) ==
+              readValues(device, counters_addr, num_counters, hart_unit));
+
+  // Device registers to memory, one at a time.
+  writeDMAReg(device, REFSI_REG_DMASRCADDR, src_addr);
+  writeDMAReg(device, REFSI_REG_DMADSTADDR, dst_addr);
+  refsi_addr_t regs_addr =
+      REFSI_DMA_REG_ADDR(REFSI_DMA_IO_ADDRESS, REFSI_REG_DMASRCADDR);
+  copyMem64(device, regs_addr, dst_addr, 2, test_unit_id);
+  std::vector<uint64_t> expected_regs = {src_addr, dst_addr};
+  REFSI_CHECK(readValues(device, dst_addr, 2, test_unit_id) == expected_regs);
+
+  REFSI_CHECK(refsiFreeDeviceMemory(device, dst_addr) == refsi_success);
+  REFSI_CHECK(refsiFreeDeviceMemory(device, src_addr) == refsi_success);
+  closeTestDevice(device);
+  return 0;
+}
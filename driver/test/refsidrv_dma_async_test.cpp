@@ -0,0 +1,82 @@
+// Copyright (C) Codeplay Software Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License") with LLVM
+// Exceptions; you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://github.com/codeplaysoftware/oneapi-construction-kit/blob/main/LICENSE.txt
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+//
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+// Start a chain of kernel DMA copies, where each copy reads the buffer written
+// by the previous one, without waiting in between. Transfers are performed in
+// the background, but they must complete in the order they were started.
+
+#include "refsidrv_test.h"
+
+namespace {
+
+/// @brief Start a 1D copy and return the ID of the transfer.
+uint64_t startCopy(refsi_device_t device, refsi_addr_t dst_addr,
+                   refsi_addr_t src_addr, uint64_t size) {
+  writeDMAReg(device, REFSI_REG_DMASRCADDR, src_addr);
+  writeDMAReg(device, REFSI_REG_DMADSTADDR, dst_addr);
+  writeDMAReg(device, REFSI_REG_DMAXFERSIZE0, size);
+  writeDMAReg(device, REFSI_REG_DMACTRL, REFSI_DMA_START | REFSI_DMA_1D);
+  return readDMAReg(device, REFSI_REG_DMASTARTSEQ);
+}
+
+}  // namespace
+
+int main() {
+  refsi_device_t device = openTestDevice();
+
+  const size_t num_buffers = 8;
+  const uint64_t size = 256 * 1024;
+  std::vector<uint8_t> pattern(size);
+  for (uint64_t i = 0; i < size; i++) {
+    pattern[i] = (uint8_t)((i * 13) + (i >> 8) + 1);
+  }
+  std::vector<uint8_t> zeros(size, 0);
+  std::vector<refsi_addr_t> buffers;
+  for (size_t i = 0; i < num_buffers; i++) {
+    buffers.push_back(allocDeviceMemory(device, size));
+    writeDeviceBuffer(device, buffers[i], (i == 0) ? pattern.data()
+                                                   : zeros.data(), size);
+  }
+
+  // Each transfer is given the next ID.
+  uint64_t first_id = 0;
+  uint64_t last_id = 0;
+  for (size_t i = 1; i < num_buffers; i++) {
+    uint64_t xfer_id = startCopy(device, buffers[i], buffers[i - 1], size);
+    if (i == 1) {
+      first_id = xfer_id;
+    } else {
+      REFSI_CHECK(xfer_id == (last_id + 1));
+    }
+    last_id = xfer_id;
+  }
+  REFSI_CHECK(first_id > 0);
+
+  // Waiting for the last transfer waits for all of them.
+  writeDMAReg(device, REFSI_REG_DMADONESEQ, last_id);
+  REFSI_CHECK(readDMAReg(device, REFSI_REG_DMADONESEQ) >= last_id);
+  std::vector<uint8_t> data(size);
+  for (size_t i = 0; i < num_buffers; i++) {
+    readDeviceBuffer(device, data.data(), buffers[i], size);
+    REFSI_CHECK(data == pattern);
+  }
+
+  for (refsi_addr_t buffer : buffers) {
+    REFSI_CHECK(refsiFreeDeviceMemory(device, buffer) == refsi_success);
+  }
+  closeTestDevice(device);
+  return 0;
+}
@@ -0,0 +1,127 @@
+// Copyright (C) Codeplay Software Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License") with LLVM
+// Exceptions; you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://github.com/codeplaysoftware/oneapi-construction-kit/blob/main/LICENSE.txt
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+//
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+// Measure the throughput of host-started kernel DMA transfers for a range of
+// transfer shapes: contiguous copies, 2D copies with narrow rows and 3D copies
+// with and without gaps between planes. This is not run as a test.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+#include "refsidrv_test.h"
+
+namespace {
+
+/// @brief Shape of a benchmarked transfer.
+struct dma_bench_shape {
+  const char *name;
+  unsigned num_dims;
+  uint64_t row_size;
+  uint64_t num_rows;
+  uint64_t num_planes;
+  uint64_t row_stride;
+  uint64_t plane_stride;
+
+  uint64_t bytes() const { return row_size * num_rows * num_planes; }
+
+  uint64_t extent() const {
+    return ((num_planes - 1) * plane_stride) + ((num_rows - 1) * row_stride) +
+           row_size;
+  }
+};
+
+/// @brief Run the transfer @p num_iterations times and return the throughput,
+/// in GB/s.
+double runShape(refsi_device_t device, const dma_bench_shape &shape,
+                unsigned num_iterations) {
+  uint64_t extent = shape.extent();
+  refsi_addr_t src_addr = allocDeviceMemory(device, extent);
+  refsi_addr_t dst_addr = allocDeviceMemory(device, extent);
+  std::vector<uint8_t> data(extent, 0x5a);
+  writeDeviceBuffer(device, src_addr, data.data(), extent);
+
+  uint64_t ctrl = REFSI_DMA_START;
+  if (shape.num_dims == 3) {
+    ctrl |= REFSI_DMA_3D | REFSI_DMA_STRIDE_BOTH;
+  } else if (shape.num_dims == 2) {
+    ctrl |= REFSI_DMA_2D | REFSI_DMA_STRIDE_BOTH;
+  } else {
+    ctrl |= REFSI_DMA_1D;
+  }
+  writeDMAReg(device, REFSI_REG_DMASRCADDR, src_addr);
+  writeDMAReg(device, REFSI_REG_DMADSTADDR, dst_addr);
+  writeDMAReg(device, REFSI_REG_DMAXFERSIZE0 + 0, shape.row_size);
+  writeDMAReg(device, REFSI_REG_DMAXFERSIZE0 + 1, shape.num_rows);
+  writeDMAReg(device, REFSI_REG_DMAXFERSIZE0 + 2, shape.num_planes);
+  writeDMAReg(device, REFSI_REG_DMAXFERSRCSTRIDE0 + 0, shape.row_stride);
+  writeDMAReg(device, REFSI_REG_DMAXFERSRCSTRIDE0 + 1, shape.plane_stride);
+  writeDMAReg(device, REFSI_REG_DMAXFERDSTSTRIDE0 + 0, shape.row_stride);
+  writeDMAReg(device, REFSI_REG_DMAXFERDSTSTRIDE0 + 1, shape.plane_stride);
+
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < num_iterations; i++) {
+    writeDMAReg(device, REFSI_REG_DMACTRL, ctrl);
+  }
+  waitForDMA(device);
+  auto end = std::chrono::steady_clock::now();
+
+  REFSI_CHECK(refsiFreeDeviceMemory(device, dst_addr) == refsi_success);
+  REFSI_CHECK(refsiFreeDeviceMemory(device, src_addr) == refsi_success);
+  double seconds = std::chrono::duration<double>(end - start).count();
+  return (double)(shape.bytes() * num_iterations) / seconds / 1e9;
+}
+
+}  // namespace
+
+int main() {
+  refsi_device_t device = openTestDevice();
+
+  // Each shape copies 4 MiB per iteration.
+  const uint64_t total = 4 << 20;
+  const uint64_t gap = 16;
+  std::vector<dma_bench_shape> shapes;
+  shapes.push_back({"1D", 1, total, 1, 1, 0, 0});
+  shapes.push_back({"2D packed 64B rows", 2, 64, total / 64, 1, 64, 0});
+  for (uint64_t row_size : {4, 8, 16, 32, 64, 100}) {
+    shapes.push_back({"2D strided rows", 2, row_size, total / row_size, 1,
+                      row_size + gap, 0});
+  }
+  shapes.push_back({"3D packed planes", 3, 256, 64, total / (256 * 64), 256,
+                    256 * 64});
+  shapes.push_back({"3D padded planes", 3, 256, 64, total / (256 * 64), 256,
+                    (256 * 64) + gap});
+  shapes.push_back({"3D strided rows", 3, 16, 64, total / (16 * 64), 16 + gap,
+                    (16 + gap) * 64});
+
+  // Report the best of several runs, since the DMA threads share the host
+  // with everything else.
+  const unsigned num_iterations = 16;
+  const unsigned num_runs = 5;
+  std::printf("%-20s %10s %10s\n", "shape", "row size", "GB/s");
+  for (const dma_bench_shape &shape : shapes) {
+    double throughput = 0.0;
+    for (unsigned i = 0; i < num_runs; i++) {
+      throughput = std::max(throughput,
+                            runShape(device, shape, num_iterations));
+    }
+    std::printf("%-20s %10llu %10.2f\n", shape.name,
+                (unsigned long long)shape.row_size, throughput);
+  }
+
+  closeTestDevice(device);
+  return 0;
+}
@@ -0,0 +1,156 @@
+// Copyright (C) Codeplay Software Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License") with LLVM
+// Exceptions; you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://github.com/codeplaysoftware/oneapi-construction-kit/blob/main/LICENSE.txt
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+//
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+// Start a chain of kernel DMA descriptors linked through their NEXT field and
+// check that every transfer in the chain has been performed once the chain's
+// single transfer ID has completed.
+
+#include "refsidrv_test.h"
+
+namespace {
+
+uint8_t getPattern(size_t i) { return (uint8_t)((i * 13) + 5); }
+
+}  // namespace
+
+int main() {
+  refsi_device_t device = openTestDevice();
+
+  // Buffers for a 1D copy, a 2D copy with padded rows and a 1D fill.
+  const size_t copy_size = 100;
+  const size_t row_size = 12;
+  const size_t num_rows = 6;
+  const size_t src_row_stride = 16;
+  const size_t dst_row_stride = 20;
+  const size_t fill_size = 50;
+  const uint32_t fill_pattern = 0xa1b2c3d4;
+  const uint8_t gap = 0xee;
+
+  std::vector<uint8_t> copy_src(copy_size);
+  for (size_t i = 0; i < copy_size; i++) {
+    copy_src[i] = getPattern(i);
+  }
+  std::vector<uint8_t> rows_src(src_row_stride * num_rows);
+  for (size_t i = 0; i < rows_src.size(); i++) {
+    rows_src[i] = getPattern(i + 1000);
+  }
+  std::vector<uint8_t> rows_dst(dst_row_stride * num_rows, gap);
+  std::vector<uint8_t> fill_dst(fill_size + 8, gap);
+
+  refsi_addr_t copy_src_addr = allocDeviceMemory(device, copy_size);
+  refsi_addr_t copy_dst_addr = allocDeviceMemory(device, copy_size);
+  refsi_addr_t rows_src_addr = allocDeviceMemory(device, rows_src.size());
+  refsi_addr_t rows_dst_addr = allocDeviceMemory(device, rows_dst.size());
+  refsi_addr_t fill_dst_addr = allocDeviceMemory(device, fill_dst.size());
+  writeDeviceBuffer(device, copy_src_addr, copy_src.data(), copy_size);
+  writeDeviceBuffer(device, rows_src_addr, rows_src.data(), rows_src.size());
+  writeDeviceBuffer(device, rows_dst_addr, rows_dst.data(), rows_dst.size());
+  writeDeviceBuffer(device, fill_dst_addr, fill_dst.data(), fill_dst.size());
+
+  // Build the descriptors. They are deliberately not stored in chain order, so
+  // that following NEXT is the only way to find the next transfer.
+  const size_t desc_size = REFSI_DMA_DESC_NUM_FIELDS * sizeof(uint64_t);
+  const size_t num_descs = 3;
+  refsi_addr_t descs_addr = allocDeviceMemory(device, desc_size * num_descs);
+  refsi_addr_t copy_desc_addr = descs_addr + (2 * desc_size);
+  refsi_addr_t rows_desc_addr = descs_addr;
+  refsi_addr_t fill_desc_addr = descs_addr + desc_size;
+
+  uint64_t copy_desc[REFSI_DMA_DESC_NUM_FIELDS] = {};
+  copy_desc[REFSI_DMA_DESC_CTRL] = REFSI_DMA_1D | REFSI_DMA_COPY;
+  copy_desc[REFSI_DMA_DESC_SRCADDR] = copy_src_addr;
+  copy_desc[REFSI_DMA_DESC_DSTADDR] = copy_dst_addr;
+  copy_desc[REFSI_DMA_DESC_XFERSIZE0] = copy_size;
+  copy_desc[REFSI_DMA_DESC_NEXT] = rows_desc_addr;
+
+  uint64_t rows_desc[REFSI_DMA_DESC_NUM_FIELDS] = {};
+  rows_desc[REFSI_DMA_DESC_CTRL] =
+      REFSI_DMA_2D | REFSI_DMA_STRIDE_BOTH | REFSI_DMA_COPY;
+  rows_desc[REFSI_DMA_DESC_SRCADDR] = rows_src_addr;
+  rows_desc[REFSI_DMA_DESC_DSTADDR] = rows_dst_addr;
+  rows_desc[REFSI_DMA_DESC_XFERSIZE0 + 0] = row_size;
+  rows_desc[REFSI_DMA_DESC_XFERSIZE0 + 1] = num_rows;
+  rows_desc[REFSI_DMA_DESC_XFERSRCSTRIDE0] = src_row_stride;
+  rows_desc[REFSI_DMA_DESC_XFERDSTSTRIDE0] = dst_row_stride;
+  rows_desc[REFSI_DMA_DESC_NEXT] = fill_desc_addr;
+
+  // The fill pattern is taken from the DMA registers.
+  uint64_t fill_desc[REFSI_DMA_DESC_NUM_FIELDS] = {};
+  fill_desc[REFSI_DMA_DESC_CTRL] = REFSI_DMA_1D | REFSI_DMA_FILL;
+  fill_desc[REFSI_DMA_DESC_DSTADDR] = fill_dst_addr;
+  fill_desc[REFSI_DMA_DESC_XFERSIZE0] = fill_size;
+  fill_desc[REFSI_DMA_DESC_NEXT] = 0;
+
+  writeDeviceBuffer(device, copy_desc_addr, copy_desc, desc_size);
+  writeDeviceBuffer(device, rows_desc_addr, rows_desc, desc_size);
+  writeDeviceBuffer(device, fill_desc_addr, fill_desc, desc_size);
+
+  // Start the whole chain with a single transfer ID.
+  uint64_t start_seq = readDMAReg(device, REFSI_REG_DMASTARTSEQ);
+  writeDMAReg(device, REFSI_REG_DMAFILLSIZE, sizeof(fill_pattern));
+  writeDMAReg(device, REFSI_REG_DMAFILLPATTERN0, fill_pattern);
+  writeDMAReg(device, REFSI_REG_DMADESCADDR, copy_desc_addr);
+  writeDMAReg(device, REFSI_REG_DMACTRL, REFSI_DMA_CHAIN | REFSI_DMA_START);
+  REFSI_CHECK(readDMAReg(device, REFSI_REG_DMASTARTSEQ) == (start_seq + 1));
+  waitForDMA(device);
+
+  // Check the 1D copy.
+  std::vector<uint8_t> result(copy_size);
+  readDeviceBuffer(device, result.data(), copy_dst_addr, copy_size);
+  REFSI_CHECK(result == copy_src);
+
+  // Check the 2D copy, including the gaps between destination rows.
+  result.resize(rows_dst.size());
+  readDeviceBuffer(device, result.data(), rows_dst_addr, result.size());
+  for (size_t y = 0; y < num_rows; y++) {
+    for (size_t x = 0; x < dst_row_stride; x++) {
+      uint8_t expected =
+          (x < row_size) ? rows_src[(y * src_row_stride) + x] : gap;
+      REFSI_CHECK(result[(y * dst_row_stride) + x] == expected);
+    }
+  }
+
+  // Check the fill, which must not write past the end of the buffer.
+  result.resize(fill_dst.size());
+  readDeviceBuffer(device, result.data(), fill_dst_addr, result.size());
+  for (size_t i = 0; i < result.size(); i++) {
+    uint8_t expected = gap;
+    if (i < fill_size) {
+      expected = (uint8_t)(fill_pattern >> ((i % sizeof(fill_pattern)) * 8));
+    }
+    REFSI_CHECK(result[i] == expected);
+  }
+
+  // Descriptors that start another chain are rejected.
+  rows_desc[REFSI_DMA_DESC_CTRL] |= REFSI_DMA_CHAIN;
+  writeDeviceBuffer(device, rows_desc_addr, rows_desc, desc_size);
+  writeDMAReg(device, REFSI_REG_DMADESCADDR, copy_desc_addr);
+  const uint64_t chain_ctrl = REFSI_DMA_CHAIN | REFSI_DMA_START;
+  REFSI_CHECK(refsiWriteDeviceMemory(
+                  device,
+                  REFSI_DMA_REG_ADDR(REFSI_DMA_IO_ADDRESS, REFSI_REG_DMACTRL),
+                  (const uint8_t *)&chain_ctrl, sizeof(chain_ctrl),
+                  test_unit_id) == refsi_failure);
+  REFSI_CHECK(readDMAReg(device, REFSI_REG_DMASTARTSEQ) == (start_seq + 1));
+
+  const refsi_addr_t buffers[] = {copy_src_addr, copy_dst_addr, rows_src_addr,
+                                  rows_dst_addr, fill_dst_addr, descs_addr};
+  for (refsi_addr_t addr : buffers) {
+    REFSI_CHECK(refsiFreeDeviceMemory(device, addr) == refsi_success);
+  }
+  closeTestDevice(device);
+  return 0;
+}
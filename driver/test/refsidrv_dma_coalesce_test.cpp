@@ -0,0 +1,156 @@
+// Copyright (C) Codeplay Software Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License") with LLVM
+// Exceptions; you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://github.com/codeplaysoftware/oneapi-construction-kit/blob/main/LICENSE.txt
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+//
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+// Check that 2D and 3D kernel DMA copies produce the same results whether or
+// not their dimensions can be merged into fewer, larger copies.
+
+#include "refsidrv_test.h"
+
+namespace {
+
+/// @brief Shape of a copy and layout of its source and destination buffers.
+struct dma_test_copy {
+  unsigned num_dims;
+  uint64_t row_size;
+  uint64_t num_rows;
+  uint64_t num_planes;
+  uint64_t row_stride;
+  uint64_t plane_stride;
+
+  uint64_t extent() const {
+    return ((num_planes - 1) * plane_stride) + ((num_rows - 1) * row_stride) +
+           row_size;
+  }
+
+  uint64_t offset(uint64_t x, uint64_t y, uint64_t z) const {
+    return (z * plane_stride) + (y * row_stride) + x;
+  }
+};
+
+uint8_t getPattern(uint64_t x, uint64_t y, uint64_t z) {
+  return (uint8_t)((x * 7) + (y * 31) + (z * 101) + 1);
+}
+
+/// @brief Copy data laid out as described by @p copy with the DMA engine and
+/// return the copied elements, in order.
+std::vector<uint8_t> runCopy(refsi_device_t device,
+                             const dma_test_copy &copy) {
+  const uint8_t src_gap = 0xcc;
+  const uint8_t dst_gap = 0xee;
+  uint64_t extent = copy.extent();
+  std::vector<uint8_t> src_data(extent, src_gap);
+  for (uint64_t z = 0; z < copy.num_planes; z++) {
+    for (uint64_t y = 0; y < copy.num_rows; y++) {
+      for (uint64_t x = 0; x < copy.row_size; x++) {
+        src_data[copy.offset(x, y, z)] = getPattern(x, y, z);
+      }
+    }
+  }
+  std::vector<uint8_t> dst_data(extent, dst_gap);
+  refsi_addr_t src_addr = allocDeviceMemory(device, extent);
+  refsi_addr_t dst_addr = allocDeviceMemory(device, extent);
+  writeDeviceBuffer(device, src_addr, src_data.data(), extent);
+  writeDeviceBuffer(device, dst_addr, dst_data.data(), extent);
+
+  uint64_t ctrl = REFSI_DMA_START | REFSI_DMA_STRIDE_BOTH;
+  ctrl |= (copy.num_dims == 3) ? REFSI_DMA_3D : REFSI_DMA_2D;
+  writeDMAReg(device, REFSI_REG_DMASRCADDR, src_addr);
+  writeDMAReg(device, REFSI_REG_DMADSTADDR, dst_addr);
+  writeDMAReg(device, REFSI_REG_DMAXFERSIZE0 + 0, copy.row_size);
+  writeDMAReg(device, REFSI_REG_DMAXFERSIZE0 + 1, copy.num_rows);
+  writeDMAReg(device, REFSI_REG_DMAXFERSIZE0 + 2, copy.num_planes);
+  writeDMAReg(device, REFSI_REG_DMAXFERSRCSTRIDE0 + 0, copy.row_stride);
+  writeDMAReg(device, REFSI_REG_DMAXFERSRCSTRIDE0 + 1, copy.plane_stride);
+  writeDMAReg(device, REFSI_REG_DMAXFERDSTSTRIDE0 + 0, copy.row_stride);
+  writeDMAReg(device, REFSI_REG_DMAXFERDSTSTRIDE0 + 1, copy.plane_stride);
+  writeDMAReg(device, REFSI_REG_DMACTRL, ctrl);
+  waitForDMA(device);
+  readDeviceBuffer(device, dst_data.data(), dst_addr, extent);
+
+  // Gather the copied elements and make sure that the gaps between rows and
+  // planes have not been written to.
+  std::vector<uint8_t> elements;
+  std::vector<bool> is_element(extent, false);
+  for (uint64_t z = 0; z < copy.num_planes; z++) {
+    for (uint64_t y = 0; y < copy.num_rows; y++) {
+      for (uint64_t x = 0; x < copy.row_size; x++) {
+        uint64_t offset = copy.offset(x, y, z);
+        elements.push_back(dst_data[offset]);
+        is_element[offset] = true;
+      }
+    }
+  }
+  for (uint64_t i = 0; i < extent; i++) {
+    REFSI_CHECK(is_element[i] || (dst_data[i] == dst_gap));
+  }
+
+  REFSI_CHECK(refsiFreeDeviceMemory(device, dst_addr) == refsi_success);
+  REFSI_CHECK(refsiFreeDeviceMemory(device, src_addr) == refsi_success);
+  return elements;
+}
+
+/// @brief Copy the same elements with packed rows and planes, which can be
+/// merged into a single copy, and with gaps, which cannot. The results must
+/// match each other and the expected pattern.
+void checkCopies(refsi_device_t device, unsigned num_dims, uint64_t row_size,
+                 uint64_t num_rows, uint64_t num_planes) {
+  const uint64_t row_gap = 3;
+  const uint64_t plane_gap = 40;
+  uint64_t padded_row = row_size + row_gap;
+  std::vector<dma_test_copy> copies;
+  // Packed rows and planes.
+  copies.push_back({num_dims, row_size, num_rows, num_planes, row_size,
+                    row_size * num_rows});
+  // Gaps between rows only.
+  copies.push_back({num_dims, row_size, num_rows, num_planes, padded_row,
+                    padded_row * num_rows});
+  if (num_dims == 3) {
+    // Gaps between planes only, which leaves packed rows to merge.
+    copies.push_back({num_dims, row_size, num_rows, num_planes, row_size,
+                      (row_size * num_rows) + plane_gap});
+    // Gaps between rows and planes.
+    copies.push_back({num_dims, row_size, num_rows, num_planes, padded_row,
+                      (padded_row * num_rows) + plane_gap});
+  }
+
+  std::vector<uint8_t> expected;
+  for (uint64_t z = 0; z < num_planes; z++) {
+    for (uint64_t y = 0; y < num_rows; y++) {
+      for (uint64_t x = 0; x < row_size; x++) {
+        expected.push_back(getPattern(x, y, z));
+      }
+    }
+  }
+  for (const dma_test_copy &copy : copies) {
+    REFSI_CHECK(runCopy(device, copy) == expected);
+  }
+}
+
+}  // namespace
+
+int main() {
+  refsi_device_t device = openTestDevice();
+
+  // Row sizes that are copied with a fixed-size copy and ones that are not.
+  const uint64_t row_sizes[] = {1, 8, 13, 64, 100};
+  for (uint64_t row_size : row_sizes) {
+    checkCopies(device, 2, row_size, 5, 1);
+    checkCopies(device, 3, row_size, 5, 4);
+  }
+
+  closeTestDevice(device);
+  return 0;
+}
@@ -0,0 +1,156 @@
+// Copyright (C) Codeplay Software Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License") with LLVM
+// Exceptions; you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://github.com/codeplaysoftware/oneapi-construction-kit/blob/main/LICENSE.txt
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+//
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+// Check kernel DMA fill and broadcast transfers, including that they do not
+// write to the gaps between destination rows and planes.
+
+#include <algorithm>
+
+#include "refsidrv_test.h"
+
+namespace {
+
+const uint8_t gap_value = 0xee;
+
+/// @brief Layout of a destination buffer.
+struct dma_test_layout {
+  uint64_t row_size;
+  uint64_t num_rows;
+  uint64_t num_planes;
+  uint64_t row_stride;
+  uint64_t plane_stride;
+
+  uint64_t extent() const {
+    return ((num_planes - 1) * plane_stride) + ((num_rows - 1) * row_stride) +
+           row_size;
+  }
+};
+
+/// @brief Allocate a destination buffer filled with the gap value.
+refsi_addr_t allocDestination(refsi_device_t device,
+                              const dma_test_layout &layout) {
+  std::vector<uint8_t> data(layout.extent(), gap_value);
+  refsi_addr_t addr = allocDeviceMemory(device, data.size());
+  writeDeviceBuffer(device, addr, data.data(), data.size());
+  return addr;
+}
+
+/// @brief Set the transfer size and destination strides of the next transfer.
+void setLayout(refsi_device_t device, const dma_test_layout &layout) {
+  writeDMAReg(device, REFSI_REG_DMAXFERSIZE0 + 0, layout.row_size);
+  writeDMAReg(device, REFSI_REG_DMAXFERSIZE0 + 1, layout.num_rows);
+  writeDMAReg(device, REFSI_REG_DMAXFERSIZE0 + 2, layout.num_planes);
+  writeDMAReg(device, REFSI_REG_DMAXFERDSTSTRIDE0 + 0, layout.row_stride);
+  writeDMAReg(device, REFSI_REG_DMAXFERDSTSTRIDE0 + 1, layout.plane_stride);
+}
+
+/// @brief Check that every row of the destination buffer holds @p row and
+/// that the gaps have not been written to.
+void checkDestination(refsi_device_t device, refsi_addr_t addr,
+                      const dma_test_layout &layout,
+                      const std::vector<uint8_t> &row) {
+  std::vector<uint8_t> expected(layout.extent(), gap_value);
+  for (uint64_t z = 0; z < layout.num_planes; z++) {
+    for (uint64_t y = 0; y < layout.num_rows; y++) {
+      uint64_t offset = (z * layout.plane_stride) + (y * layout.row_stride);
+      std::copy(row.begin(), row.end(), expected.begin() + offset);
+    }
+  }
+  std::vector<uint8_t> data(expected.size());
+  readDeviceBuffer(device, data.data(), addr, data.size());
+  REFSI_CHECK(data == expected);
+}
+
+/// @brief Fill the rows described by @p layout with a pattern.
+void checkFill(refsi_device_t device, unsigned num_dims,
+               const dma_test_layout &layout,
+               const std::vector<uint8_t> &pattern) {
+  refsi_addr_t dst_addr = allocDestination(device, layout);
+  uint64_t pattern_regs[REFSI_DMA_MAX_FILL_PATTERN_SIZE / sizeof(uint64_t)] =
+      {};
+  std::copy(pattern.begin(), pattern.end(), (uint8_t *)pattern_regs);
+  for (size_t i = 0; (i * sizeof(uint64_t)) < pattern.size(); i++) {
+    writeDMAReg(device, REFSI_REG_DMAFILLPATTERN0 + i, pattern_regs[i]);
+  }
+  writeDMAReg(device, REFSI_REG_DMAFILLSIZE, pattern.size());
+  writeDMAReg(device, REFSI_REG_DMADSTADDR, dst_addr);
+  setLayout(device, layout);
+  uint64_t ctrl = REFSI_DMA_START | REFSI_DMA_FILL;
+  if (num_dims == 1) {
+    ctrl |= REFSI_DMA_1D;
+  } else {
+    ctrl |= ((num_dims == 3) ? REFSI_DMA_3D : REFSI_DMA_2D) |
+            REFSI_DMA_STRIDE_DST;
+  }
+  writeDMAReg(device, REFSI_REG_DMACTRL, ctrl);
+  waitForDMA(device);
+
+  // Each row starts with the beginning of the pattern.
+  std::vector<uint8_t> row(layout.row_size);
+  for (uint64_t i = 0; i < row.size(); i++) {
+    row[i] = pattern[i % pattern.size()];
+  }
+  checkDestination(device, dst_addr, layout, row);
+  REFSI_CHECK(refsiFreeDeviceMemory(device, dst_addr) == refsi_success);
+}
+
+/// @brief Copy the same source row to all the rows described by @p layout.
+void checkBroadcast(refsi_device_t device, unsigned num_dims,
+                    const dma_test_layout &layout) {
+  std::vector<uint8_t> row(layout.row_size);
+  for (uint64_t i = 0; i < row.size(); i++) {
+    row[i] = (uint8_t)((i * 13) + 5);
+  }
+  refsi_addr_t src_addr = allocDeviceMemory(device, row.size());
+  writeDeviceBuffer(device, src_addr, row.data(), row.size());
+  refsi_addr_t dst_addr = allocDestination(device, layout);
+  writeDMAReg(device, REFSI_REG_DMASRCADDR, src_addr);
+  writeDMAReg(device, REFSI_REG_DMADSTADDR, dst_addr);
+  setLayout(device, layout);
+  uint64_t ctrl = REFSI_DMA_START | REFSI_DMA_BROADCAST | REFSI_DMA_STRIDE_DST;
+  ctrl |= (num_dims == 3) ? REFSI_DMA_3D : REFSI_DMA_2D;
+  writeDMAReg(device, REFSI_REG_DMACTRL, ctrl);
+  waitForDMA(device);
+
+  checkDestination(device, dst_addr, layout, row);
+  REFSI_CHECK(refsiFreeDeviceMemory(device, dst_addr) == refsi_success);
+  REFSI_CHECK(refsiFreeDeviceMemory(device, src_addr) == refsi_success);
+}
+
+}  // namespace
+
+int main() {
+  refsi_device_t device = openTestDevice();
+
+  std::vector<uint8_t> short_pattern = {0x11, 0x22, 0x33};
+  std::vector<uint8_t> long_pattern(REFSI_DMA_MAX_FILL_PATTERN_SIZE);
+  for (size_t i = 0; i < long_pattern.size(); i++) {
+    long_pattern[i] = (uint8_t)(i + 1);
+  }
+  for (const std::vector<uint8_t> &pattern : {short_pattern, long_pattern}) {
+    checkFill(device, 1, {1000, 1, 1, 0, 0}, pattern);
+    checkFill(device, 2, {10, 4, 1, 16, 0}, pattern);
+    checkFill(device, 2, {200, 4, 1, 200, 0}, pattern);
+    checkFill(device, 3, {10, 4, 3, 16, 100}, pattern);
+  }
+
+  checkBroadcast(device, 2, {24, 8, 1, 32, 0});
+  checkBroadcast(device, 2, {24, 8, 1, 24, 0});
+  checkBroadcast(device, 3, {24, 3, 2, 32, 100});
+
+  closeTestDevice(device);
+  return 0;
+}
@@ -0,0 +1,66 @@
+// Copyright (C) Codeplay Software Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License") with LLVM
+// Exceptions; you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://github.com/codeplaysoftware/oneapi-construction-kit/blob/main/LICENSE.txt
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+//
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+// Check that kernel DMA transfers that would read from or write to
+// memory-mapped registers are rejected when they are started, rather than
+// accessing the registers from a DMA thread.
+
+#include "refsidrv_test.h"
+
+namespace {
+
+/// @brief Try to start a 1D copy and return whether it was started.
+bool startCopy(refsi_device_t device, refsi_addr_t dst_addr,
+               refsi_addr_t src_addr, uint64_t size) {
+  uint64_t start_seq = readDMAReg(device, REFSI_REG_DMASTARTSEQ);
+  writeDMAReg(device, REFSI_REG_DMASRCADDR, src_addr);
+  writeDMAReg(device, REFSI_REG_DMADSTADDR, dst_addr);
+  writeDMAReg(device, REFSI_REG_DMAXFERSIZE0, size);
+  const uint64_t ctrl = REFSI_DMA_1D | REFSI_DMA_COPY | REFSI_DMA_START;
+  refsi_result result = refsiWriteDeviceMemory(
+      device, REFSI_DMA_REG_ADDR(REFSI_DMA_IO_ADDRESS, REFSI_REG_DMACTRL),
+      (const uint8_t *)&ctrl, sizeof(ctrl), test_unit_id);
+  bool started = (readDMAReg(device, REFSI_REG_DMASTARTSEQ) != start_seq);
+  REFSI_CHECK(started == (result == refsi_success));
+  return started;
+}
+
+}  // namespace
+
+int main() {
+  refsi_device_t device = openTestDevice();
+
+  const uint64_t size = 2 * sizeof(uint64_t);
+  refsi_addr_t buffer_addr = allocDeviceMemory(device, size);
+  refsi_addr_t other_addr = allocDeviceMemory(device, size);
+  refsi_addr_t perf_addr = findMemoryMapEntry(device, PERF_COUNTERS);
+  REFSI_CHECK(perf_addr != 0);
+
+  // Copies between memory buffers are started.
+  REFSI_CHECK(startCopy(device, other_addr, buffer_addr, size));
+  waitForDMA(device);
+
+  // Copies from or to registers are not.
+  REFSI_CHECK(!startCopy(device, buffer_addr, perf_addr, size));
+  REFSI_CHECK(!startCopy(device, perf_addr, buffer_addr, size));
+  REFSI_CHECK(!startCopy(device, buffer_addr, REFSI_DMA_IO_ADDRESS, size));
+  REFSI_CHECK(!startCopy(device, REFSI_DMA_IO_ADDRESS, buffer_addr, size));
+
+  REFSI_CHECK(refsiFreeDeviceMemory(device, other_addr) == refsi_success);
+  REFSI_CHECK(refsiFreeDeviceMemory(device, buffer_addr) == refsi_success);
+  closeTestDevice(device);
+  return 0;
+}
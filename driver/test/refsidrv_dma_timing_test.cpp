@@ -0,0 +1,146 @@
+// Copyright (C) Codeplay Software Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License") with LLVM
+// Exceptions; you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://github.com/codeplaysoftware/oneapi-construction-kit/blob/main/LICENSE.txt
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+//
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+// Check the kernel DMA timing model: transfers started by a hart only appear
+// complete once the hart's cycle counter has reached their completion cycle,
+// they complete in order and the DMA cycle counters account for them.
+//
+// No kernel is run, so the hart's cycle counter stays at zero and a hart that
+// waits for a transfer does not need to be stalled.
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+
+#include "refsidrv_test.h"
+
+namespace {
+
+const uint64_t bytes_per_cycle = 8;
+const uint64_t setup_cycles = 100;
+const uint32_t hart_unit_id = REFSI_UNIT_ID(REFSI_UNIT_KIND_ACC_HART, 0);
+
+/// @brief Access one of the first hart's kernel DMA registers.
+refsi_result accessHartDMAReg(refsi_device_t device, uint32_t reg,
+                              uint64_t *value, bool write) {
+  refsi_addr_t addr = REFSI_DMA_REG_ADDR(REFSI_DMA_IO_ADDRESS, reg);
+  if (write) {
+    return refsiWriteDeviceMemory(device, addr, (const uint8_t *)value,
+                                  sizeof(uint64_t), hart_unit_id);
+  }
+  return refsiReadDeviceMemory(device, (uint8_t *)value, addr,
+                               sizeof(uint64_t), hart_unit_id);
+}
+
+void writeHartDMAReg(refsi_device_t device, uint32_t reg, uint64_t value) {
+  REFSI_CHECK(accessHartDMAReg(device, reg, &value, true) == refsi_success);
+}
+
+uint64_t readHartDMAReg(refsi_device_t device, uint32_t reg) {
+  uint64_t value = 0;
+  REFSI_CHECK(accessHartDMAReg(device, reg, &value, false) == refsi_success);
+  return value;
+}
+
+/// @brief Start a 1D copy on behalf of the hart and return its ID.
+uint32_t startHartCopy(refsi_device_t device, refsi_addr_t dst_addr,
+                       refsi_addr_t src_addr, uint64_t size) {
+  writeHartDMAReg(device, REFSI_REG_DMASRCADDR, src_addr);
+  writeHartDMAReg(device, REFSI_REG_DMADSTADDR, dst_addr);
+  writeHartDMAReg(device, REFSI_REG_DMAXFERSIZE0, size);
+  writeHartDMAReg(device, REFSI_REG_DMACTRL, REFSI_DMA_1D | REFSI_DMA_START);
+  return (uint32_t)readHartDMAReg(device, REFSI_REG_DMASTARTSEQ);
+}
+
+/// @brief Read one of the global performance counters.
+uint64_t readGlobalCounter(refsi_device_t device, refsi_addr_t counters_addr,
+                           uint32_t counter_id) {
+  uint32_t index = REFSI_NUM_PER_HART_PERF_COUNTERS + counter_id;
+  return readDeviceValue(device, counters_addr + (index * sizeof(uint64_t)));
+}
+
+}  // namespace
+
+int main() {
+  // Transfers run on the thread that starts them, so their data has been
+  // copied by the time the DMACTRL write returns.
+  setenv("REFSI_DMA_THREADS", "0", 1);
+  setenv("REFSI_DMA_BYTES_PER_CYCLE", std::to_string(bytes_per_cycle).c_str(),
+         1);
+  setenv("REFSI_DMA_SETUP_CYCLES", std::to_string(setup_cycles).c_str(), 1);
+  setenv("REFSI_DMA_ENGINES", "1", 1);
+  refsi_device_t device = openTestDevice();
+  refsi_addr_t counters_addr = findMemoryMapEntry(device, PERF_COUNTERS);
+  REFSI_CHECK(counters_addr != 0);
+
+  const uint64_t sizes[] = {4096, 800};
+  std::vector<uint8_t> values(sizes[0]);
+  for (size_t i = 0; i < values.size(); i++) {
+    values[i] = (uint8_t)((i * 37) + 1);
+  }
+  refsi_addr_t src_addr = allocDeviceMemory(device, sizes[0]);
+  refsi_addr_t dst_addrs[2];
+  writeDeviceBuffer(device, src_addr, values.data(), values.size());
+  for (unsigned i = 0; i < 2; i++) {
+    dst_addrs[i] = allocDeviceMemory(device, sizes[i]);
+  }
+
+  // Both transfers have been executed, but neither is complete as far as the
+  // hart is concerned. The second one is queued behind the first one on the
+  // hart's only engine.
+  uint32_t done_seq = (uint32_t)readHartDMAReg(device, REFSI_REG_DMADONESEQ);
+  uint32_t xfer_ids[2];
+  for (unsigned i = 0; i < 2; i++) {
+    xfer_ids[i] = startHartCopy(device, dst_addrs[i], src_addr, sizes[i]);
+    REFSI_CHECK(xfer_ids[i] == (done_seq + i + 1));
+    REFSI_CHECK(readHartDMAReg(device, REFSI_REG_DMADONESEQ) == done_seq);
+  }
+  uint64_t expected_busy = 0;
+  for (uint64_t size : sizes) {
+    expected_busy += setup_cycles + (size / bytes_per_cycle);
+  }
+  REFSI_CHECK(readGlobalCounter(device, counters_addr,
+                                REFSI_PERF_CNTR_DMA_BUSY_CYCLE) ==
+              expected_busy);
+  REFSI_CHECK(readGlobalCounter(device, counters_addr,
+                                REFSI_PERF_CNTR_DMA_IDLE_CYCLE) == 0);
+
+  // Waiting for the second transfer completes both of them.
+  writeHartDMAReg(device, REFSI_REG_DMADONESEQ, xfer_ids[1]);
+  REFSI_CHECK(readHartDMAReg(device, REFSI_REG_DMADONESEQ) == xfer_ids[1]);
+  for (unsigned i = 0; i < 2; i++) {
+    std::vector<uint8_t> result(sizes[i]);
+    readDeviceBuffer(device, result.data(), dst_addrs[i], sizes[i]);
+    REFSI_CHECK(std::equal(result.begin(), result.end(), values.begin()));
+  }
+
+  // Transfers started by the host are not timed.
+  writeDMAReg(device, REFSI_REG_DMASRCADDR, src_addr);
+  writeDMAReg(device, REFSI_REG_DMADSTADDR, dst_addrs[0]);
+  writeDMAReg(device, REFSI_REG_DMAXFERSIZE0, sizes[0]);
+  writeDMAReg(device, REFSI_REG_DMACTRL, REFSI_DMA_1D | REFSI_DMA_START);
+  REFSI_CHECK(readDMAReg(device, REFSI_REG_DMADONESEQ) ==
+              readDMAReg(device, REFSI_REG_DMASTARTSEQ));
+  REFSI_CHECK(readGlobalCounter(device, counters_addr,
+                                REFSI_PERF_CNTR_DMA_BUSY_CYCLE) ==
+              expected_busy);
+
+  REFSI_CHECK(refsiFreeDeviceMemory(device, dst_addrs[1]) == refsi_success);
+  REFSI_CHECK(refsiFreeDeviceMemory(device, dst_addrs[0]) == refsi_success);
+  REFSI_CHECK(refsiFreeDeviceMemory(device, src_addr) == refsi_success);
+  closeTestDevice(device);
+  return 0;
+}
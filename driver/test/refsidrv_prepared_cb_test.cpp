@@ -0,0 +1,85 @@
+// Copyright (C) Codeplay Software Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License") with LLVM
+// Exceptions; you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://github.com/codeplaysoftware/oneapi-construction-kit/blob/main/LICENSE.txt
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+//
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+// Replay a prepared command buffer several times, then check that executing it
+// with a generation that is no longer valid is rejected.
+
+#include "refsidrv_test.h"
+
+namespace {
+
+uint64_t executePrepared(refsi_device_t device, refsi_addr_t cb_addr,
+                         uint64_t generation) {
+  uint64_t fence = 0;
+  REFSI_CHECK(refsiExecutePreparedCommandBuffer(device, CMP_QUEUE_COMPUTE,
+                                                cb_addr, generation,
+                                                &fence) == refsi_success);
+  REFSI_CHECK(refsiWaitForFence(device, fence) == refsi_success);
+  return fence;
+}
+
+}  // namespace
+
+int main() {
+  refsi_device_t device = openTestDevice();
+
+  const uint64_t value = 0x1234567890abcdefull;
+  refsi_addr_t result_addr = allocDeviceMemory(device, sizeof(uint64_t));
+
+  std::vector<uint64_t> commands;
+  commands.push_back(
+      refsiEncodeCMPCommand(CMP_STORE_IMM64, 1, (uint32_t)result_addr));
+  commands.push_back(value);
+  commands.push_back(refsiEncodeCMPCommand(CMP_FINISH, 0, 0));
+  size_t cb_size = commands.size() * sizeof(uint64_t);
+  refsi_addr_t cb_addr = writeCommandBuffer(device, commands);
+
+  uint64_t generation = 0;
+  REFSI_CHECK(refsiPrepareCommandBuffer(device, cb_addr, cb_size,
+                                        &generation) == refsi_success);
+
+  // Each execution of the prepared command buffer must store the value again.
+  for (int i = 0; i < 2; i++) {
+    writeDeviceValue(device, result_addr, 0);
+    executePrepared(device, cb_addr, generation);
+    REFSI_CHECK(readDeviceValue(device, result_addr) == value);
+  }
+
+  // Once released, the command buffer can no longer be executed.
+  REFSI_CHECK(refsiReleaseCommandBuffer(device, cb_addr) == refsi_success);
+  uint64_t fence = 0;
+  REFSI_CHECK(refsiExecutePreparedCommandBuffer(device, CMP_QUEUE_COMPUTE,
+                                                cb_addr, generation,
+                                                &fence) == refsi_failure);
+
+  // Preparing it again yields a new generation and the old one stays invalid.
+  uint64_t new_generation = 0;
+  REFSI_CHECK(refsiPrepareCommandBuffer(device, cb_addr, cb_size,
+                                        &new_generation) == refsi_success);
+  REFSI_CHECK(new_generation != generation);
+  REFSI_CHECK(refsiExecutePreparedCommandBuffer(device, CMP_QUEUE_COMPUTE,
+                                                cb_addr, generation,
+                                                &fence) == refsi_failure);
+  writeDeviceValue(device, result_addr, 0);
+  executePrepared(device, cb_addr, new_generation);
+  REFSI_CHECK(readDeviceValue(device, result_addr) == value);
+  REFSI_CHECK(refsiReleaseCommandBuffer(device, cb_addr) == refsi_success);
+
+  REFSI_CHECK(refsiFreeDeviceMemory(device, cb_addr) == refsi_success);
+  REFSI_CHECK(refsiFreeDeviceMemory(device, result_addr) == refsi_success);
+  closeTestDevice(device);
+  return 0;
+}
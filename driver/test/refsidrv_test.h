@@ -0,0 +1,129 @@
+// Copyright (C) Codeplay Software Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License") with LLVM
+// Exceptions; you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://github.com/codeplaysoftware/oneapi-construction-kit/blob/main/LICENSE.txt
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+//
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+#ifndef _REFSIDRV_TEST_REFSIDRV_TEST_H
+#define _REFSIDRV_TEST_REFSIDRV_TEST_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "device/dma_regs.h"
+#include "refsidrv/refsidrv.h"
+
+/// @brief Abort the test when the condition does not hold.
+#define REFSI_CHECK(cond)                                                  \
+  do {                                                                     \
+    if (!(cond)) {                                                         \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,     \
+              #cond);                                                      \
+      exit(1);                                                             \
+    }                                                                      \
+  } while (0)
+
+/// @brief Open a RefSi M device, aborting the test on failure.
+inline refsi_device_t openTestDevice() {
+  REFSI_CHECK(refsiInitialize() == refsi_success);
+  refsi_device_t device = refsiOpenDevice(REFSI_M);
+  REFSI_CHECK(device != nullptr);
+  return device;
+}
+
+/// @brief Close a device opened with openTestDevice.
+inline void closeTestDevice(refsi_device_t device) {
+  REFSI_CHECK(refsiShutdownDevice(device) == refsi_success);
+  REFSI_CHECK(refsiTerminate() == refsi_success);
+}
+
+/// @brief Unit on whose behalf the tests access device memory.
+constexpr uint32_t test_unit_id = REFSI_UNIT_ID(REFSI_UNIT_KIND_EXTERNAL, 0);
+
+/// @brief Copy data from host memory to device memory.
+inline void writeDeviceBuffer(refsi_device_t device, refsi_addr_t addr,
+                              const void *data, size_t size) {
+  REFSI_CHECK(refsiWriteDeviceMemory(device, addr, (const uint8_t *)data, size,
+                                     test_unit_id) == refsi_success);
+}
+
+/// @brief Copy data from device memory to host memory.
+inline void readDeviceBuffer(refsi_device_t device, void *data,
+                             refsi_addr_t addr, size_t size) {
+  REFSI_CHECK(refsiReadDeviceMemory(device, (uint8_t *)data, addr, size,
+                                    test_unit_id) == refsi_success);
+}
+
+/// @brief Write a 64-bit value to device memory.
+inline void writeDeviceValue(refsi_device_t device, refsi_addr_t addr,
+                             uint64_t value) {
+  writeDeviceBuffer(device, addr, &value, sizeof(value));
+}
+
+/// @brief Read a 64-bit value from device memory.
+inline uint64_t readDeviceValue(refsi_device_t device, refsi_addr_t addr) {
+  uint64_t value = 0;
+  readDeviceBuffer(device, &value, addr, sizeof(value));
+  return value;
+}
+
+/// @brief Allocate DRAM, aborting the test on failure.
+inline refsi_addr_t allocDeviceMemory(refsi_device_t device, size_t size) {
+  refsi_addr_t addr =
+      refsiAllocDeviceMemory(device, size, sizeof(uint64_t), DRAM);
+  REFSI_CHECK(addr != 0);
+  return addr;
+}
+
+/// @brief Find the start address of the first memory map entry of that kind.
+inline refsi_addr_t findMemoryMapEntry(refsi_device_t device,
+                                       refsi_memory_map_kind kind) {
+  refsi_device_info_t info;
+  REFSI_CHECK(refsiQueryDeviceInfo(device, &info) == refsi_success);
+  for (unsigned i = 0; i < info.num_memory_map_entries; i++) {
+    refsi_memory_map_entry entry;
+    REFSI_CHECK(refsiQueryDeviceMemoryMap(device, i, &entry) == refsi_success);
+    if (entry.kind == kind) {
+      return entry.start_addr;
+    }
+  }
+  return 0;
+}
+
+/// @brief Copy a command buffer to newly-allocated device memory.
+inline refsi_addr_t writeCommandBuffer(refsi_device_t device,
+                                       const std::vector<uint64_t> &chunks) {
+  size_t size = chunks.size() * sizeof(uint64_t);
+  refsi_addr_t addr = allocDeviceMemory(device, size);
+  writeDeviceBuffer(device, addr, chunks.data(), size);
+  return addr;
+}
+
+/// @brief Write to one of the host's kernel DMA registers.
+inline void writeDMAReg(refsi_device_t device, uint32_t reg, uint64_t value) {
+  writeDeviceValue(device, REFSI_DMA_REG_ADDR(REFSI_DMA_IO_ADDRESS, reg), value);
+}
+
+/// @brief Read one of the host's kernel DMA registers.
+inline uint64_t readDMAReg(refsi_device_t device, uint32_t reg) {
+  return readDeviceValue(device, REFSI_DMA_REG_ADDR(REFSI_DMA_IO_ADDRESS, reg));
+}
+
+/// @brief Wait for the most recent DMA transfer started by the host.
+inline void waitForDMA(refsi_device_t device) {
+  writeDMAReg(device, REFSI_REG_DMADONESEQ,
+              readDMAReg(device, REFSI_REG_DMASTARTSEQ));
+}
+
+#endif  // _REFSIDRV_TEST_REFSIDRV_TEST_H
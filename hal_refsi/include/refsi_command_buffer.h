@@ -17,6 +17,7 @@
 #ifndef _HAL_REFSI_REFSI_COMMAND_BUFFER_H
 #define _HAL_REFSI_REFSI_COMMAND_BUFFER_H
 
+#include <cstdint>
 #include <vector>
 
 #include "refsi_hal.h"
@@ -75,9 +76,32 @@ class refsi_command_buffer {
   void addRUN_INSTANCES(uint32_t max_harts, uint64_t num_instances,
                         std::vector<uint64_t> &extra_args);
 
+  /// @brief Add a command to run all slices of an N-dimensional kernel on the
+  /// device. Slices are rows of work-groups in the X dimension, each slice ID
+  /// being passed to the kernel entry point in place of the first extra arg.
+  /// @param max_harts Maximum number of harts to use for running the kernel.
+  /// @param num_groups Number of work-groups in each of the three dimensions.
+  /// @param extra_args Extra arguments to pass to the kernel entry point.
+  void addRUN_NDRANGE(uint32_t max_harts, const uint64_t num_groups[3],
+                      std::vector<uint64_t> &extra_args);
+
   /// @brief Add a command to flush and/or invalidate caches in the SoC.
   /// @param flags Flags to control which cache(s) get invalidated/flushed.
-  void addSYNC_CACHE(uint32_t flags);
+  /// @param code_addr Start of the code executed by the accelerator. When
+  /// specified, instruction caches are only invalidated if the code changed.
+  /// @param code_size Size of the code executed by the accelerator, or zero.
+  void addSYNC_CACHE(uint32_t flags, refsi_addr_t code_addr = 0,
+                     uint64_t code_size = 0);
+
+  /// @brief Add a command to raise the value of a CMP semaphore.
+  /// @param semaphore Index of the semaphore to signal.
+  /// @param value Value to signal the semaphore with.
+  void addSIGNAL_SEMAPHORE(uint32_t semaphore, uint64_t value);
+
+  /// @brief Add a command to wait for a CMP semaphore to reach a value.
+  /// @param semaphore Index of the semaphore to wait for.
+  /// @param value Value to wait for.
+  void addWAIT_SEMAPHORE(uint32_t semaphore, uint64_t value);
 
   /// @brief Add a command to write an immediate value to a DMA register.
   /// @param dma_reg DMA register index.
@@ -89,13 +113,33 @@ class refsi_command_buffer {
   /// @return Address of the DMA register in memory.
   refsi_addr_t getDMARegAddr(uint32_t dma_reg) const;
 
-  /// @brief Execute the commands that have been added to the buffer.
+  /// @brief Execute the commands that have been added to the buffer and wait
+  /// for them to be finished.
   /// @param hal_device Device to execute the command buffer.
   /// @param locker Mutex for the HAL device.
   refsi_result run(refsi_hal_device &hal_device, refsi_locker &locker);
 
+  /// @brief Start executing the commands that have been added to the buffer,
+  /// without waiting for them to be finished. The memory used by the buffer is
+  /// released once the fence has been signaled.
+  /// @param hal_device Device to execute the command buffer.
+  /// @param locker Mutex for the HAL device.
+  /// @param fence On success, fence that is signaled once the commands have
+  /// been executed.
+  /// @param queue CMP queue to execute the commands on.
+  /// @param access Device memory accessed by the commands. They are executed
+  /// after the commands previously submitted to other queues that access the
+  /// same memory.
+  refsi_result runAsync(refsi_hal_device &hal_device, refsi_locker &locker,
+                        uint64_t &fence,
+                        refsi_cmp_queue_id queue = CMP_QUEUE_COMPUTE,
+                        const refsi_memory_access &access =
+                            refsi_memory_access());
+
  private:
   std::vector<uint64_t> chunks;
+  /// @brief Position of the FINISH command in @p chunks, if any.
+  size_t finish_pos = SIZE_MAX;
 };
 
 #endif  // _HAL_REFSI_REFSI_COMMAND_BUFFER_H
@@ -17,6 +17,8 @@
 #ifndef _HAL_REFSI_REFSI_HAL_H
 #define _HAL_REFSI_REFSI_HAL_H
 
+#include <deque>
+#include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -47,6 +49,10 @@ struct refsi_hal_program {
 
   std::unique_ptr<ELFProgram> elf;
   std::map<std::string, std::unique_ptr<refsi_hal_kernel>> kernels;
+  /// @brief Unique, non-zero ID given to the program when it is loaded. This
+  /// is used to tell whether the program is resident in device memory, since
+  /// program addresses can be reused once a program has been freed.
+  uint64_t generation = 0;
 };
 
 /// @brief Enumerates host-related profiling counters.
@@ -62,6 +68,51 @@ enum refsi_host_counter {
 
 using refsi_locker = std::unique_lock<std::mutex>;
 
+/// @brief Function called with the HAL lock held once a fence is signaled.
+using refsi_fence_callback = std::function<void(refsi_locker &)>;
+
+/// @brief Range of device memory.
+struct refsi_memory_range {
+  hal::hal_addr_t start = 0;
+  hal::hal_size_t size = 0;
+
+  bool overlaps(const refsi_memory_range &other) const {
+    return (start < (other.start + other.size)) &&
+           (other.start < (start + size));
+  }
+};
+
+/// @brief Device memory accessed by a command buffer. This determines which of
+/// the command buffers executed on other CMP queues it needs to wait for.
+struct refsi_memory_access {
+  /// @brief Whether the commands may access any device memory, in which case
+  /// the ranges below are ignored.
+  bool any = true;
+  /// @brief Ranges of device memory read by the commands.
+  std::vector<refsi_memory_range> reads;
+  /// @brief Ranges of device memory written to by the commands.
+  std::vector<refsi_memory_range> writes;
+
+  /// @brief Determine whether these accesses need to be ordered with the
+  /// @p other accesses, i.e. whether either of them writes to memory accessed
+  /// by the other.
+  bool conflicts_with(const refsi_memory_access &other) const;
+};
+
+/// @brief Describes how a command buffer executed on a CMP queue is ordered
+/// with respect to command buffers executed on the other queues.
+struct refsi_queue_submission {
+  /// @brief Queue the command buffer is executed on.
+  refsi_cmp_queue_id queue = CMP_QUEUE_COMPUTE;
+  /// @brief Semaphores and values to wait for before executing the commands.
+  std::vector<std::pair<uint32_t, uint64_t>> waits;
+  /// @brief Value to signal the queue's semaphore with once the commands have
+  /// been executed.
+  uint64_t signal_value = 0;
+  /// @brief Device memory accessed by the commands.
+  refsi_memory_access access;
+};
+
 class refsi_hal_device : public hal::hal_device_t {
  public:
   refsi_hal_device(refsi_device_t device, riscv::hal_device_info_riscv_t *info,
@@ -123,6 +174,61 @@ class refsi_hal_device : public hal::hal_device_t {
   bool mem_write(hal::hal_addr_t dst, const void *src, hal::hal_size_t size,
                  refsi_locker &locker);
 
+  /// @brief Copy a command buffer to device memory so that it can be executed
+  /// by the device. The HAL lock must be held when this is called.
+  /// @param chunks Commands to copy to device memory.
+  /// @param size Size of the command buffer, in bytes.
+  /// @return Device address of the command buffer or hal_nullptr on failure.
+  virtual hal::hal_addr_t write_command_buffer(const uint64_t *chunks,
+                                               size_t size,
+                                               refsi_locker &locker);
+
+  /// @brief Release the device memory used by a command buffer that has
+  /// finished executing. Command buffers must be released in the order they
+  /// were written. The HAL lock must be held when this is called.
+  /// @param cb_addr Device address returned by write_command_buffer.
+  virtual void release_command_buffer(hal::hal_addr_t cb_addr,
+                                      refsi_locker &locker);
+
+  /// @brief Defer work until a command buffer fence has been signaled, e.g.
+  /// freeing memory used by the command buffer. Callbacks are called in fence
+  /// order. The HAL lock must be held when this is called.
+  /// @param fence Fence returned when executing a command buffer.
+  /// @param callback Function to call once the fence has been signaled.
+  void defer_until_fence(uint64_t fence, refsi_fence_callback callback);
+
+  /// @brief Wait for a fence to be signaled and call the deferred callbacks
+  /// up to that fence. The HAL lock must be held when this is called.
+  bool wait_for_fence(uint64_t fence, refsi_locker &locker);
+
+  /// @brief Wait for all command buffers executed by the HAL to be finished.
+  /// This must be done before the host accesses memory that may be used by
+  /// in-flight commands. The HAL lock must be held when this is called.
+  bool wait_for_idle(refsi_locker &locker);
+
+  /// @brief Call the deferred callbacks for all fences that have already been
+  /// signaled, without waiting. The HAL lock must be held when this is called.
+  void retire_fences(refsi_locker &locker);
+
+  /// @brief Determine how to order a command buffer executed on a CMP queue.
+  /// Each queue signals its own semaphore once a command buffer has executed.
+  /// The command buffer waits for the work submitted before it to other queues
+  /// that conflicts with its memory accesses, which keeps dependent commands in
+  /// submission order while letting independent commands run concurrently.
+  /// The HAL lock must be held when this is called.
+  /// @param queue Queue the command buffer will be executed on.
+  /// @param access Device memory accessed by the command buffer.
+  refsi_queue_submission prepare_queue_submission(
+      refsi_cmp_queue_id queue, const refsi_memory_access &access);
+
+  /// @brief Record that a command buffer prepared with
+  /// prepare_queue_submission has been enqueued on the device. The HAL lock
+  /// must be held when this is called.
+  /// @param submission Submission returned by prepare_queue_submission.
+  /// @param fence Fence signaled once the command buffer has been executed.
+  void commit_queue_submission(const refsi_queue_submission &submission,
+                               uint64_t fence);
+
  protected:
   bool hal_debug() const { return debug; }
 
@@ -136,6 +242,15 @@ class refsi_hal_device : public hal::hal_device_t {
   void pack_uint64_arg(std::vector<uint8_t> &packed_data, uint64_t value,
                        size_t align = 0);
 
+  /// @brief Find the range of the device allocation that contains @p addr.
+  /// The HAL lock must be held when this is called.
+  bool find_allocation(hal::hal_addr_t addr, refsi_memory_range &range) const;
+
+  /// @brief Determine which device memory a kernel accesses, given its
+  /// arguments. The HAL lock must be held when this is called.
+  refsi_memory_access get_kernel_access(const hal::hal_arg_t *args,
+                                        uint32_t num_args) const;
+
   elf_machine machine = elf_machine::unknown;
   refsi_addr_t local_ram_addr = 0;
   size_t local_ram_size = 0;
@@ -143,9 +258,30 @@ class refsi_hal_device : public hal::hal_device_t {
   std::mutex &hal_lock;
   hal::hal_device_info_t *info = nullptr;
   std::vector<hal::util::hal_counter_value_t> hart_counter_data;
+  std::vector<hal::util::hal_counter_value_t> global_counter_data;
   std::vector<hal::util::hal_counter_value_t> host_counter_data;
   bool counters_enabled = false;
   bool debug = false;
+  uint64_t next_program_generation = 1;
+  // Most recent fence returned when executing a command buffer.
+  uint64_t last_fence = 0;
+  // Work to do once command buffers have finished executing.
+  std::deque<std::pair<uint64_t, refsi_fence_callback>> fence_callbacks;
+  // Last value signaled by each CMP queue's semaphore, which has the same
+  // index as the queue.
+  uint64_t queue_timelines[CMP_NUM_QUEUES] = {};
+  // Values of the other queues' semaphores each queue has already waited for.
+  uint64_t queue_waits[CMP_NUM_QUEUES][CMP_NUM_QUEUES] = {};
+  // Command buffer executed on a CMP queue whose fence has not been retired.
+  struct queue_work {
+    uint64_t signal_value = 0;
+    uint64_t fence = 0;
+    refsi_memory_access access;
+  };
+  // Work that may still be executing on each CMP queue, in submission order.
+  std::deque<queue_work> queue_work_items[CMP_NUM_QUEUES];
+  // Size of each device allocation, indexed by its address.
+  std::map<hal::hal_addr_t, hal::hal_size_t> allocations;
   std::map<refsi_memory_map_kind, refsi_memory_map_entry> mem_map;
 };
 
@@ -17,6 +17,7 @@
 #ifndef _HAL_REFSI_REFSI_HAL_M1_H
 #define _HAL_REFSI_REFSI_HAL_M1_H
 
+#include <deque>
 #include <mutex>
 
 #include "refsi_hal.h"
@@ -39,17 +40,41 @@ class refsi_m1_hal_device : public refsi_hal_device {
                    const hal::hal_arg_t *args, uint32_t num_args,
                    uint32_t work_dim) override;
 
+  // fill a target buffer with a pattern using the DMA controller
+  bool mem_fill(hal::hal_addr_t dst, const void *pattern,
+                hal::hal_size_t pattern_size, hal::hal_size_t size) override;
+
   // copy memory between target buffers
   bool mem_copy(hal::hal_addr_t dst, hal::hal_addr_t src,
                 hal::hal_size_t size) override;
 
+  // Alignment of buffers allocated with launch_buffer_alloc.
+  static constexpr hal::hal_size_t launch_buffer_align = 256;
+
+  // write command buffers to the command ring instead of allocating memory
+  hal::hal_addr_t write_command_buffer(const uint64_t *chunks, size_t size,
+                                       refsi_locker &locker) override;
+  void release_command_buffer(hal::hal_addr_t cb_addr,
+                              refsi_locker &locker) override;
+
  private:
   bool createWindows(refsi_locker &locker);
   bool createWindow(refsi_command_buffer &cb, uint32_t win_id, uint32_t mode,
                     refsi_addr_t base, refsi_addr_t target, uint64_t scale,
                     uint64_t size);
   bool createROM(refsi_locker &locker);
+  bool saveWritableSegments(const ELFProgram &elf, refsi_locker &locker);
+  void freeWritableSegments(refsi_locker &locker);
+  bool createCommandRing(refsi_locker &locker);
   void encodeKernelExit(riscv_encoder &enc);
+  // Allocate or release a short-lived device buffer used by a kernel launch,
+  // such as the Kernel Uniform Block or the performance counter buffer.
+  // Released buffers are recycled by later launches. They must only be
+  // released once commands using them have finished executing.
+  hal::hal_addr_t launch_buffer_alloc(hal::hal_size_t size,
+                                      refsi_locker &locker);
+  void launch_buffer_free(hal::hal_addr_t addr, hal::hal_size_t size,
+                          refsi_locker &locker);
   void encodeLaunchKernel(riscv_encoder &enc, unsigned num_dims);
 
   unsigned num_harts_per_core = 0;
@@ -62,6 +87,35 @@ class refsi_m1_hal_device : public refsi_hal_device {
   hal::hal_addr_t elf_mem_base = 0;
   hal::hal_addr_t elf_mem_size = 0;
   hal::hal_addr_t elf_mem_mapped_addr = 0;
+  // Generation of the program currently loaded in ELF memory, or zero.
+  uint64_t resident_program_generation = 0;
+  // Range of ELF memory covered by the resident program's segments.
+  hal::hal_addr_t resident_program_addr = 0;
+  hal::hal_addr_t resident_program_size = 0;
+
+  // Writable segments (e.g. .data and .bss) of the resident program. Kernels
+  // can modify these, so their initial contents are kept in device memory and
+  // copied back before each launch that does not load the program.
+  struct writable_segment {
+    hal::hal_addr_t addr;        // Address of the segment in ELF memory.
+    hal::hal_addr_t image_addr;  // Address of the segment's initial contents.
+    hal::hal_size_t size;        // Size of the segment in memory.
+  };
+  std::vector<writable_segment> resident_writable_segments;
+  hal::hal_addr_t resident_image_addr = 0;
+
+  // Ring buffer in DRAM that command buffers are written to.
+  hal::hal_addr_t cb_ring_addr = 0;   // Device address of the ring buffer.
+  uint8_t *cb_ring_mapped = nullptr;  // Host pointer to the ring buffer.
+  uint64_t cb_ring_size = 0;          // Size of the ring buffer.
+  uint64_t cb_ring_head = 0;  // Offset where the next buffer will be written.
+  uint64_t cb_ring_tail = 0;  // Offset of the oldest unreleased buffer.
+  std::deque<uint64_t> cb_ring_pending;  // Offsets of unreleased buffers.
+
+  // Free launch buffers, indexed by size class.
+  std::map<hal::hal_size_t, std::vector<hal::hal_addr_t>> launch_buffer_pool;
+  // Maximum number of free buffers kept for each size class.
+  const size_t max_pooled_launch_buffers = 8;
 
   hal::hal_addr_t tcdm_base = 0;         // Base address of TCDM.
   hal::hal_addr_t tcdm_size = 0;         // Total TCDM size.
@@ -237,6 +237,17 @@ class refsi_hal : public hal::hal_t {
         {REFSI_PERF_CNTR_CYCLE, "cycles", "elapsed cycles", "hart", num_values,
          hal::hal_counter_unit_cycles, cfg_default}};
 
+    // Global counters follow the per-hart counters.
+    uint32_t global_prefix = REFSI_NUM_PER_HART_PERF_COUNTERS;
+    counter_description_data.push_back(
+        {global_prefix + REFSI_PERF_CNTR_DMA_BUSY_CYCLE, "dma_busy_cycles",
+         "cycles spent performing kernel DMA transfers", "", 1,
+         hal::hal_counter_unit_cycles, cfg_default});
+    counter_description_data.push_back(
+        {global_prefix + REFSI_PERF_CNTR_DMA_IDLE_CYCLE, "dma_idle_cycles",
+         "cycles spent waiting between kernel DMA transfers", "", 1,
+         hal::hal_counter_unit_cycles, cfg_default});
+
     // These extra profiling counters slow down the sim a lot when enabled, so
     // we disable them unless the user has specified the max profiling level.
     int profile_level = 0;
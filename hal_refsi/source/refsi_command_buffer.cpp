@@ -21,27 +21,66 @@
 
 refsi_result refsi_command_buffer::run(refsi_hal_device &hal_device,
                                        refsi_locker &locker) {
+  // Execute the command buffer and wait for its completion.
+  uint64_t fence = 0;
+  if (refsi_result result = runAsync(hal_device, locker, fence)) {
+    return result;
+  }
+  return hal_device.wait_for_fence(fence, locker) ? refsi_success
+                                                  : refsi_failure;
+}
+
+refsi_result refsi_command_buffer::runAsync(refsi_hal_device &hal_device,
+                                            refsi_locker &locker,
+                                            uint64_t &fence,
+                                            refsi_cmp_queue_id queue,
+                                            const refsi_memory_access &access) {
+  // Reclaim memory used by command buffers that have finished executing.
+  hal_device.retire_fences(locker);
+
+  // Wait for the conflicting work previously submitted to other queues and
+  // signal this queue's semaphore once the commands have been executed. The
+  // signal must come before FINISH, which stops the execution of the command
+  // buffer.
+  refsi_queue_submission submission =
+      hal_device.prepare_queue_submission(queue, access);
+  refsi_command_buffer queue_cb;
+  for (const auto &wait : submission.waits) {
+    queue_cb.addWAIT_SEMAPHORE(wait.first, wait.second);
+  }
+  size_t end_pos = std::min(finish_pos, chunks.size());
+  queue_cb.chunks.insert(queue_cb.chunks.end(), chunks.begin(),
+                         chunks.begin() + end_pos);
+  queue_cb.addSIGNAL_SEMAPHORE(queue, submission.signal_value);
+  queue_cb.chunks.insert(queue_cb.chunks.end(), chunks.begin() + end_pos,
+                         chunks.end());
+
   // Write the command buffer to device memory.
-  size_t cb_size = chunks.size() * sizeof(uint64_t);
+  size_t cb_size = queue_cb.chunks.size() * sizeof(uint64_t);
   hal::hal_addr_t cb_addr =
-      hal_device.mem_alloc(cb_size, sizeof(uint64_t), locker);
-  if (!cb_addr ||
-      !hal_device.mem_write(cb_addr, chunks.data(), cb_size, locker)) {
+      hal_device.write_command_buffer(queue_cb.chunks.data(), cb_size, locker);
+  if (!cb_addr) {
     return refsi_failure;
   }
 
-  // Execute the command buffer and wait for its completion.
-  if (refsi_result result = refsiExecuteCommandBuffer(hal_device.get_device(),
-                                                      cb_addr, cb_size)) {
-    hal_device.mem_free(cb_addr, locker);
+  // Start executing the command buffer.
+  if (refsi_result result = refsiExecuteCommandBufferOnQueue(
+          hal_device.get_device(), queue, cb_addr, cb_size, &fence)) {
+    hal_device.release_command_buffer(cb_addr, locker);
     return result;
   }
-  refsiWaitForDeviceIdle(hal_device.get_device());
-  hal_device.mem_free(cb_addr, locker);
+  hal_device.commit_queue_submission(submission, fence);
+  hal_device.defer_until_fence(fence, [&hal_device, cb_addr](
+                                          refsi_locker &locker) {
+    hal_device.release_command_buffer(cb_addr, locker);
+  });
   return refsi_success;
 }
 
 void refsi_command_buffer::addFINISH() {
+  if (finish_pos == SIZE_MAX) {
+    finish_pos = chunks.size();
+  }
   chunks.push_back(refsiEncodeCMPCommand(CMP_FINISH, 0, 0));
 }
 
@@ -103,9 +142,46 @@ void refsi_command_buffer::addRUN_INSTANCES(uint32_t max_harts,
   }
 }
 
-void refsi_command_buffer::addSYNC_CACHE(uint32_t flags) {
+void refsi_command_buffer::addRUN_NDRANGE(uint32_t max_harts,
+                                          const uint64_t num_groups[3],
+                                          std::vector<uint64_t> &extra_args) {
+  const uint32_t max_extra_args = 7;
+  uint32_t num_extra_args =
+      std::min((uint32_t)extra_args.size(), max_extra_args);
+  uint32_t inline_chunk = (max_harts & 0xff) | (num_extra_args << 8);
+  chunks.push_back(refsiEncodeCMPCommand(CMP_RUN_NDRANGE, 3 + num_extra_args,
+                                         inline_chunk));
+  for (uint32_t i = 0; i < 3; i++) {
+    chunks.push_back(num_groups[i]);
+  }
+  for (uint32_t i = 0; i < num_extra_args; i++) {
+    chunks.push_back(extra_args[i]);
+  }
+}
+
+void refsi_command_buffer::addSYNC_CACHE(uint32_t flags,
+                                         refsi_addr_t code_addr,
+                                         uint64_t code_size) {
   uint32_t inline_chunk = flags;
-  chunks.push_back(refsiEncodeCMPCommand(CMP_SYNC_CACHE, 0, inline_chunk));
+  if (code_size == 0) {
+    chunks.push_back(refsiEncodeCMPCommand(CMP_SYNC_CACHE, 0, inline_chunk));
+    return;
+  }
+  chunks.push_back(refsiEncodeCMPCommand(CMP_SYNC_CACHE, 2, inline_chunk));
+  chunks.push_back(code_addr);
+  chunks.push_back(code_size);
+}
+
+void refsi_command_buffer::addSIGNAL_SEMAPHORE(uint32_t semaphore,
+                                               uint64_t value) {
+  chunks.push_back(refsiEncodeCMPCommand(CMP_SIGNAL_SEMAPHORE, 1, semaphore));
+  chunks.push_back(value);
+}
+
+void refsi_command_buffer::addWAIT_SEMAPHORE(uint32_t semaphore,
+                                             uint64_t value) {
+  chunks.push_back(refsiEncodeCMPCommand(CMP_WAIT_SEMAPHORE, 1, semaphore));
+  chunks.push_back(value);
 }
 
 refsi_addr_t refsi_command_buffer::getDMARegAddr(uint32_t dma_reg) const {
@@ -99,6 +99,7 @@ hal::hal_program_t refsi_hal_device::program_load(const void *data,
     return hal::hal_invalid_program;
   }
   auto *refsi_program = new refsi_hal_program(std::move(new_program));
+  refsi_program->generation = next_program_generation++;
   return (hal::hal_program_t)refsi_program;
 }
 
@@ -116,6 +117,8 @@ bool refsi_hal_device::program_free(hal::hal_program_t program) {
 bool refsi_hal_device::counter_read(uint32_t counter_id, uint64_t &out,
                                     uint32_t index) {
   refsi_locker locker(hal_lock);
+  // Counter values are only updated once kernels have finished executing.
+  wait_for_idle(locker);
 
   // Handle RefSi per-hart counters.
   if (counter_id < REFSI_NUM_PER_HART_PERF_COUNTERS) {
@@ -127,8 +130,14 @@ bool refsi_hal_device::counter_read(uint32_t counter_id, uint64_t &out,
   }
   counter_id -= REFSI_NUM_PER_HART_PERF_COUNTERS;
 
-  // TODO: Handle RefSi global counters when there are such counters.
+  // Handle RefSi global counters.
   if (counter_id < REFSI_NUM_GLOBAL_PERF_COUNTERS) {
+    if ((counter_id < global_counter_data.size()) &&
+        global_counter_data[counter_id].has_value(index)) {
+      out = global_counter_data[counter_id].get_value(index);
+      global_counter_data[counter_id].clear_value(index);
+      return true;
+    }
     return false;
   }
   counter_id -= REFSI_NUM_GLOBAL_PERF_COUNTERS;
@@ -297,6 +306,9 @@ bool refsi_hal_device::mem_free(hal::hal_addr_t addr) {
   if (hal_debug()) {
     fprintf(stderr, "refsi_hal_device::mem_free(address=0x%08lx)\n", addr);
   }
+  if (!wait_for_idle(locker)) {
+    return false;
+  }
   return mem_free(addr, locker);
 }
 
@@ -307,6 +319,9 @@ bool refsi_hal_device::mem_read(void *dst, hal::hal_addr_t src,
     fprintf(stderr, "refsi_hal_device::mem_read(src=0x%08lx, size=%ld)\n", src,
             size);
   }
+  if (!wait_for_idle(locker)) {
+    return false;
+  }
   return mem_read(dst, src, size, locker);
 }
 
@@ -317,6 +332,9 @@ bool refsi_hal_device::mem_write(hal::hal_addr_t dst, const void *src,
     fprintf(stderr, "refsi_hal_device::mem_write(dst=0x%08lx, size=%ld)\n", dst,
             size);
   }
+  if (!wait_for_idle(locker)) {
+    return false;
+  }
   return mem_write(dst, src, size, locker);
 }
 
@@ -328,6 +346,9 @@ bool refsi_hal_device::mem_fill(hal::hal_addr_t dst, const void *pattern,
   }
 
   refsi_locker locker(hal_lock);
+  if (!wait_for_idle(locker)) {
+    return false;
+  }
   const size_t max_chunk_size = 4096;
   std::vector<uint8_t> chunk;
   while (chunk.size() < size && chunk.size() < max_chunk_size) {
@@ -355,13 +376,57 @@ bool refsi_hal_device::mem_fill(hal::hal_addr_t dst, const void *pattern,
 hal::hal_addr_t refsi_hal_device::mem_alloc(hal::hal_size_t size,
                                             hal::hal_size_t alignment,
                                             refsi_locker &locker) {
-  return refsiAllocDeviceMemory(device, size, alignment, DRAM);
+  hal::hal_addr_t addr = refsiAllocDeviceMemory(device, size, alignment, DRAM);
+  if (addr) {
+    allocations[addr] = size;
+  }
+  return addr;
 }
 
 bool refsi_hal_device::mem_free(hal::hal_addr_t addr, refsi_locker &locker) {
+  allocations.erase(addr);
   return refsiFreeDeviceMemory(device, addr) == refsi_success;
 }
 
+bool refsi_hal_device::find_allocation(hal::hal_addr_t addr,
+                                       refsi_memory_range &range) const {
+  auto it = allocations.upper_bound(addr);
+  if (it == allocations.begin()) {
+    return false;
+  }
+  --it;
+  if ((addr - it->first) >= it->second) {
+    return false;
+  }
+  range.start = it->first;
+  range.size = it->second;
+  return true;
+}
+
+refsi_memory_access refsi_hal_device::get_kernel_access(
+    const hal::hal_arg_t *args, uint32_t num_args) const {
+  // Kernels are assumed to only access global memory through the buffers
+  // passed as arguments. A pointer that does not point into a buffer allocated
+  // by the HAL, such as a host pointer, means that any memory may be accessed.
+  refsi_memory_access access;
+  access.any = false;
+  for (uint32_t i = 0; i < num_args; i++) {
+    const hal::hal_arg_t &arg(args[i]);
+    if ((arg.kind != hal::hal_arg_address) ||
+        (arg.space != hal::hal_space_global) || !arg.address) {
+      continue;
+    }
+    refsi_memory_range range;
+    if (!find_allocation(arg.address, range)) {
+      access.any = true;
+      break;
+    }
+    access.reads.push_back(range);
+    access.writes.push_back(range);
+  }
+  return access;
+}
+
 bool refsi_hal_device::mem_read(void *dst, hal::hal_addr_t src,
                                 hal::hal_size_t size, refsi_locker &locker) {
   if (!dst) {
@@ -398,6 +463,127 @@ bool refsi_hal_device::mem_write(hal::hal_addr_t dst, const void *src,
   return true;
 }
 
+hal::hal_addr_t refsi_hal_device::write_command_buffer(const uint64_t *chunks,
+                                                      size_t size,
+                                                      refsi_locker &locker) {
+  hal::hal_addr_t cb_addr = mem_alloc(size, sizeof(uint64_t), locker);
+  if (!cb_addr) {
+    return hal::hal_nullptr;
+  } else if (!mem_write(cb_addr, chunks, size, locker)) {
+    mem_free(cb_addr, locker);
+    return hal::hal_nullptr;
+  }
+  return cb_addr;
+}
+
+void refsi_hal_device::release_command_buffer(hal::hal_addr_t cb_addr,
+                                              refsi_locker &locker) {
+  mem_free(cb_addr, locker);
+}
+
+void refsi_hal_device::defer_until_fence(uint64_t fence,
+                                         refsi_fence_callback callback) {
+  last_fence = std::max(last_fence, fence);
+  if (callback) {
+    fence_callbacks.emplace_back(fence, std::move(callback));
+  }
+}
+
+bool refsi_hal_device::wait_for_fence(uint64_t fence, refsi_locker &locker) {
+  bool success = true;
+  if (fence > 0) {
+    success = (refsiWaitForFence(device, fence) == refsi_success);
+  }
+  retire_fences(locker);
+  return success;
+}
+
+bool refsi_hal_device::wait_for_idle(refsi_locker &locker) {
+  return wait_for_fence(last_fence, locker);
+}
+
+void refsi_hal_device::retire_fences(refsi_locker &locker) {
+  if (fence_callbacks.empty()) {
+    return;
+  }
+  uint64_t signaled_fence = 0;
+  if (refsiGetSignaledFence(device, &signaled_fence) != refsi_success) {
+    return;
+  }
+  for (std::deque<queue_work> &work_items : queue_work_items) {
+    while (!work_items.empty() &&
+           (work_items.front().fence <= signaled_fence)) {
+      work_items.pop_front();
+    }
+  }
+  while (!fence_callbacks.empty() &&
+         (fence_callbacks.front().first <= signaled_fence)) {
+    refsi_fence_callback callback = std::move(fence_callbacks.front().second);
+    fence_callbacks.pop_front();
+    callback(locker);
+  }
+}
+
+static bool any_overlap(const std::vector<refsi_memory_range> &a,
+                        const std::vector<refsi_memory_range> &b) {
+  for (const refsi_memory_range &range_a : a) {
+    for (const refsi_memory_range &range_b : b) {
+      if (range_a.overlaps(range_b)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool refsi_memory_access::conflicts_with(
+    const refsi_memory_access &other) const {
+  if (any || other.any) {
+    return true;
+  }
+  return any_overlap(writes, other.writes) ||
+         any_overlap(writes, other.reads) || any_overlap(reads, other.writes);
+}
+
+refsi_queue_submission refsi_hal_device::prepare_queue_submission(
+    refsi_cmp_queue_id queue, const refsi_memory_access &access) {
+  refsi_queue_submission submission;
+  submission.queue = queue;
+  submission.access = access;
+  for (uint32_t other = 0; other < CMP_NUM_QUEUES; other++) {
+    if (other == queue) {
+      continue;
+    }
+    // Queues execute their command buffers in order, which means that waiting
+    // for the most recent conflicting one is enough.
+    uint64_t wait_value = 0;
+    for (const queue_work &work : queue_work_items[other]) {
+      if ((work.signal_value > queue_waits[queue][other]) &&
+          work.access.conflicts_with(access)) {
+        wait_value = work.signal_value;
+      }
+    }
+    if (wait_value > 0) {
+      submission.waits.emplace_back(other, wait_value);
+    }
+  }
+  submission.signal_value = queue_timelines[queue] + 1;
+  return submission;
+}
+
+void refsi_hal_device::commit_queue_submission(
+    const refsi_queue_submission &submission, uint64_t fence) {
+  for (const auto &wait : submission.waits) {
+    queue_waits[submission.queue][wait.first] = wait.second;
+  }
+  queue_timelines[submission.queue] = submission.signal_value;
+  queue_work work;
+  work.signal_value = submission.signal_value;
+  work.fence = fence;
+  work.access = submission.access;
+  queue_work_items[submission.queue].push_back(std::move(work));
+}
+
 RefSiMemoryWrapper::RefSiMemoryWrapper(refsi_device_t device)
     : device(device) {}
 
@@ -16,6 +16,7 @@
 
 #include "refsi_hal_m1.h"
 
+#include <algorithm>
 #include <string>
 
 #include "arg_pack.h"
@@ -33,6 +34,11 @@
 constexpr const uint64_t REFSI_ELF_BASE = 0x10000ull;
 constexpr const uint64_t REFSI_ELF_SIZE = (1 << 27) - REFSI_ELF_BASE;
 
+// Size of the ring buffer that command buffers are written to before being
+// executed. Command buffers that do not fit in the ring are allocated
+// individually instead.
+constexpr const uint64_t REFSI_CB_RING_SIZE = 1 << 20;
+
 refsi_m1_hal_device::refsi_m1_hal_device(refsi_device_t device,
                                          riscv::hal_device_info_riscv_t *info,
                                          std::mutex &hal_lock)
@@ -45,10 +51,20 @@ refsi_m1_hal_device::refsi_m1_hal_device(refsi_device_t device,
 
 refsi_m1_hal_device::~refsi_m1_hal_device() {
   refsi_locker locker(hal_lock);
+  wait_for_idle(locker);
   mem_free(rom_base, locker);
   mem_free(elf_mem_mapped_addr, locker);
+  freeWritableSegments(locker);
+  mem_free(cb_ring_addr, locker);
+  for (auto &size_class : launch_buffer_pool) {
+    for (hal::hal_addr_t addr : size_class.second) {
+      mem_free(addr, locker);
+    }
+  }
+  launch_buffer_pool.clear();
   rom_base = 0;
   elf_mem_mapped_addr = 0;
+  cb_ring_addr = 0;
   refsiShutdownDevice(device);
 }
 
@@ -71,9 +87,16 @@ bool refsi_m1_hal_device::initialize(refsi_locker &locker) {
     return false;
   }
 
+  if (!createCommandRing(locker)) {
+    return false;
+  }
+
   for (uint32_t i = 0; i < REFSI_NUM_PER_HART_PERF_COUNTERS; i++) {
     hart_counter_data.push_back({i, num_harts_per_core * num_cores});
   }
+  for (uint32_t i = 0; i < REFSI_NUM_GLOBAL_PERF_COUNTERS; i++) {
+    global_counter_data.push_back({i, 1});
+  }
 
   return true;
 }
@@ -95,6 +118,7 @@ bool refsi_m1_hal_device::createWindows(refsi_locker &locker) {
       mem_free(elf_mem_mapped_addr, locker);
     }
     elf_mem_mapped_addr = mem_alloc(elf_mem_size, 4096, locker);
+    resident_program_generation = 0;
     if (!elf_mem_mapped_addr) {
       return false;
     }
@@ -122,7 +146,10 @@ bool refsi_m1_hal_device::createWindows(refsi_locker &locker) {
   tcdm_hart_size = 2 * (1 << 20);
   tcdm_hart_base = tcdm_base + 64 * (1 << 20);
   tcdm_hart_target = tcdm_base + tcdm_size - tcdm_hart_size;
-  tcdm_hart_size_per_hart = tcdm_hart_size / num_harts_per_core;
+  // The per-hart area is shared between the harts of all cores, which means
+  // that each core uses its own slice of it. The rest of TCDM is not split
+  // between cores, since the HAL does not place any per-core data there.
+  tcdm_hart_size_per_hart = tcdm_hart_size / (num_harts_per_core * num_cores);
   if (!createWindow(cb, 1 /* win_id */, CMP_WINDOW_MODE_PERT_HART,
                     tcdm_hart_base, tcdm_hart_target, tcdm_hart_size_per_hart,
                     tcdm_hart_size_per_hart)) {
@@ -133,6 +160,58 @@ bool refsi_m1_hal_device::createWindows(refsi_locker &locker) {
   return cb.run(*this, locker) == refsi_success;
 }
 
+bool refsi_m1_hal_device::saveWritableSegments(const ELFProgram &elf,
+                                               refsi_locker &locker) {
+  freeWritableSegments(locker);
+  const hal::hal_size_t image_align = sizeof(uint64_t);
+  auto alignedSize = [=](const elf_segment &segment) {
+    return (segment.memory_size + image_align - 1) & ~(image_align - 1);
+  };
+  hal::hal_size_t image_size = 0;
+  for (const elf_segment &segment : elf.get_segments()) {
+    if (segment.writable) {
+      image_size += alignedSize(segment);
+    }
+  }
+  if (image_size == 0) {
+    return true;
+  }
+  resident_image_addr = mem_alloc(image_size, image_align, locker);
+  if (!resident_image_addr) {
+    return false;
+  }
+
+  // The image holds the segment data from the ELF followed by zeros, which is
+  // what ELFProgram::load writes to ELF memory.
+  hal::hal_addr_t image_addr = resident_image_addr;
+  std::vector<uint8_t> contents;
+  for (const elf_segment &segment : elf.get_segments()) {
+    if (!segment.writable) {
+      continue;
+    }
+    contents.assign(segment.memory_size, 0);
+    if (segment.file_size > 0) {
+      memcpy(contents.data(), segment.data, segment.file_size);
+    }
+    if (!mem_write(image_addr, contents.data(), contents.size(), locker)) {
+      freeWritableSegments(locker);
+      return false;
+    }
+    resident_writable_segments.push_back(
+        {segment.address, image_addr, segment.memory_size});
+    image_addr += alignedSize(segment);
+  }
+  return true;
+}
+
+void refsi_m1_hal_device::freeWritableSegments(refsi_locker &locker) {
+  if (resident_image_addr) {
+    mem_free(resident_image_addr, locker);
+    resident_image_addr = 0;
+  }
+  resident_writable_segments.clear();
+}
+
 bool refsi_m1_hal_device::createWindow(refsi_command_buffer &cb,
                                        uint32_t win_id, uint32_t mode,
                                        refsi_addr_t base, refsi_addr_t target,
@@ -190,6 +269,76 @@ bool refsi_m1_hal_device::createROM(refsi_locker &locker) {
   return true;
 }
 
+bool refsi_m1_hal_device::createCommandRing(refsi_locker &locker) {
+  // Allocate the ring once, so that submitting command buffers does not need
+  // to go through the device memory allocator. Commands are written to the
+  // ring through a mapped pointer.
+  cb_ring_size = REFSI_CB_RING_SIZE;
+  cb_ring_addr = mem_alloc(cb_ring_size, sizeof(uint64_t), locker);
+  if (!cb_ring_addr) {
+    return false;
+  }
+  cb_ring_mapped =
+      (uint8_t *)refsiGetMappedAddress(device, cb_ring_addr, cb_ring_size);
+  if (!cb_ring_mapped) {
+    mem_free(cb_ring_addr, locker);
+    cb_ring_addr = 0;
+    return false;
+  }
+  cb_ring_head = cb_ring_tail = 0;
+  cb_ring_pending.clear();
+  return true;
+}
+
+hal::hal_addr_t refsi_m1_hal_device::write_command_buffer(
+    const uint64_t *chunks, size_t size, refsi_locker &locker) {
+  // Find a contiguous area of the ring that can hold the command buffer,
+  // wrapping around to the start of the ring if needed.
+  uint64_t offset = cb_ring_head;
+  if (cb_ring_pending.empty()) {
+    cb_ring_head = cb_ring_tail = offset = 0;
+    if (size > cb_ring_size) {
+      offset = cb_ring_size;
+    }
+  } else if (cb_ring_head > cb_ring_tail) {
+    if (size > (cb_ring_size - cb_ring_head)) {
+      offset = (size <= cb_ring_tail) ? 0 : cb_ring_size;
+    }
+  } else if (size > (cb_ring_tail - cb_ring_head)) {
+    offset = cb_ring_size;
+  }
+  if (offset == cb_ring_size) {
+    // The ring is full, fall back to allocating device memory.
+    return refsi_hal_device::write_command_buffer(chunks, size, locker);
+  }
+
+  memcpy(&cb_ring_mapped[offset], chunks, size);
+  cb_ring_head = offset + size;
+  cb_ring_pending.push_back(offset);
+  return cb_ring_addr + offset;
+}
+
+void refsi_m1_hal_device::release_command_buffer(hal::hal_addr_t cb_addr,
+                                                 refsi_locker &locker) {
+  if ((cb_addr < cb_ring_addr) || (cb_addr >= (cb_ring_addr + cb_ring_size))) {
+    refsi_hal_device::release_command_buffer(cb_addr, locker);
+    return;
+  }
+
+  // Buffers are usually released in order, which means that the ring is free
+  // up to the next unreleased buffer.
+  uint64_t offset = cb_addr - cb_ring_addr;
+  auto it = std::find(cb_ring_pending.begin(), cb_ring_pending.end(), offset);
+  if (it != cb_ring_pending.end()) {
+    cb_ring_pending.erase(it);
+  }
+  if (cb_ring_pending.empty()) {
+    cb_ring_head = cb_ring_tail = 0;
+  } else {
+    cb_ring_tail = cb_ring_pending.front();
+  }
+}
+
 void refsi_m1_hal_device::encodeKernelExit(riscv_encoder &enc) {
   enc.addLI(A0, 0);
   enc.addLI(A7, 0);
@@ -264,7 +413,7 @@ bool refsi_m1_hal_device::kernel_exec(hal::hal_program_t program,
 
   // Prepare N-D range dimensions.
   uint64_t work_group_size = 1;
-  uint32_t max_harts = num_harts_per_core;
+  uint32_t max_harts = num_harts_per_core * num_cores;
   wg.num_dim = work_dim;
   for (int i = 0; i < DIMS; i++) {
     wg.local_size[i] = nd_range->local[i];
@@ -277,24 +426,42 @@ bool refsi_m1_hal_device::kernel_exec(hal::hal_program_t program,
   }
   wg.hal_extra = tcdm_hart_base;
 
-  // Ensure that ELF segments will be loaded in a valid area of memory.
-  hal::hal_addr_t text_end_addr = elf_mem_base + elf_mem_size;
-  for (const elf_segment &segment : elf->get_segments()) {
-    if ((segment.address < elf_mem_base) ||
-        (segment.address >= text_end_addr)) {
+  // Load the ELF into Spike's memory, unless it is already resident because
+  // it was used by the previous kernel launch.
+  bool program_loaded = false;
+  if (refsi_program->generation != resident_program_generation) {
+    // Ensure that ELF segments will be loaded in a valid area of memory.
+    hal::hal_addr_t text_end_addr = elf_mem_base + elf_mem_size;
+    hal::hal_addr_t program_start = text_end_addr;
+    hal::hal_addr_t program_end = elf_mem_base;
+    for (const elf_segment &segment : elf->get_segments()) {
+      if ((segment.address < elf_mem_base) ||
+          (segment.address >= text_end_addr)) {
+        return false;
+      }
+      hal::hal_addr_t segment_end = segment.address + segment.memory_size;
+      if ((segment_end < elf_mem_base) || (segment_end > text_end_addr)) {
+        return false;
+      }
+      program_start = std::min(program_start, segment.address);
+      program_end = std::max(program_end, segment_end);
+    }
+
+    // Kernels that are still executing may be using the previous ELF.
+    if (!wait_for_idle(locker)) {
       return false;
     }
-    hal::hal_addr_t segment_end = segment.address + segment.memory_size;
-    if ((segment_end < elf_mem_base) || (segment_end > text_end_addr)) {
+    RefSiMemoryWrapper mem_device(device);
+    MemoryController loader_if(&mem_device);
+    resident_program_generation = 0;
+    if (!elf->load(loader_if) || !saveWritableSegments(*elf, locker)) {
       return false;
     }
-  }
-
-  // Load ELF into Spike's memory.
-  RefSiMemoryWrapper mem_device(device);
-  MemoryController loader_if(&mem_device);
-  if (!elf->load(loader_if)) {
-    return false;
+    resident_program_generation = refsi_program->generation;
+    resident_program_addr = program_start;
+    resident_program_size =
+        (program_end > program_start) ? (program_end - program_start) : 0;
+    program_loaded = true;
   }
   exec.kernel_entry = kernel_wrapper->symbol;
 
@@ -343,47 +510,64 @@ bool refsi_m1_hal_device::kernel_exec(hal::hal_program_t program,
   alignBuffer(packed_args, sizeof(uint64_t));
 
   // Allocate memory for the Kernel Uniform Block.
-  uint64_t kub_align = 256;
+  uint64_t kub_align = launch_buffer_align;
   alignBuffer(packed_args, kub_align);
   hal::hal_addr_t kub_size = packed_args.size();
-  hal::hal_addr_t kub_addr = mem_alloc(kub_size, kub_align, locker);
-  if (!kub_addr || !mem_write(kub_addr, packed_args.data(), kub_size, locker)) {
+  hal::hal_addr_t kub_addr = launch_buffer_alloc(kub_size, locker);
+  if (!kub_addr) {
+    return false;
+  } else if (!mem_write(kub_addr, packed_args.data(), kub_size, locker)) {
+    launch_buffer_free(kub_addr, kub_size, locker);
     return false;
   }
 
   // Allocate memory for performance counters. We need to allocate two sets of
   // performance counter registers, one captured before executing the kernel
   // and one after. The reported values for the counters will be the difference
-  // between the two sets of values.
+  // between the two sets of values. Each set holds the per-hart counters for
+  // every hart, followed by the global counters.
   hal::hal_addr_t counters_buffer_addr = hal::hal_nullptr;
   hal::hal_addr_t counters_io_addr = hal::hal_nullptr;
   uint32_t num_counters = REFSI_NUM_PER_HART_PERF_COUNTERS;
-  uint32_t counters_set_size = num_counters * sizeof(uint64_t) * max_harts;
+  uint32_t num_global_counters = REFSI_NUM_GLOBAL_PERF_COUNTERS;
+  uint32_t counters_set_size =
+      ((num_counters * max_harts) + num_global_counters) * sizeof(uint64_t);
   uint32_t counters_buffer_size = counters_set_size * 2;
   if (counters_enabled) {
     counters_io_addr = mem_map[PERF_COUNTERS].start_addr;
-    counters_buffer_addr =
-        mem_alloc(counters_buffer_size, sizeof(uint64_t), locker);
+    counters_buffer_addr = launch_buffer_alloc(counters_buffer_size, locker);
     if (!counters_buffer_addr) {
+      launch_buffer_free(kub_addr, kub_size, locker);
       return false;
     }
   }
 
   refsi_command_buffer cb;
 
-  // Start a 2D DMA transfer to copy scheduling info to all harts.
-  uint64_t config = REFSI_DMA_2D | REFSI_DMA_STRIDE_BOTH;
+  // Restore the initial contents of the program's writable segments, which
+  // the previous launch may have modified. This is part of loading the ELF
+  // otherwise.
+  if (!program_loaded) {
+    for (const writable_segment &segment : resident_writable_segments) {
+      cb.addWriteDMAReg(REFSI_REG_DMASRCADDR, segment.image_addr);
+      cb.addWriteDMAReg(REFSI_REG_DMADSTADDR, segment.addr);
+      cb.addWriteDMAReg(REFSI_REG_DMAXFERSIZE0, segment.size);
+      cb.addWriteDMAReg(REFSI_REG_DMACTRL, REFSI_DMA_1D | REFSI_DMA_START);
+    }
+  }
+
+  // Start a 2D DMA transfer to broadcast scheduling info to all harts.
+  uint64_t config = REFSI_DMA_2D | REFSI_DMA_STRIDE_DST | REFSI_DMA_BROADCAST;
   cb.addWriteDMAReg(REFSI_REG_DMASRCADDR, kub_addr + exec_offset);
   cb.addWriteDMAReg(REFSI_REG_DMADSTADDR, tcdm_hart_target);
   cb.addWriteDMAReg(REFSI_REG_DMAXFERSIZE0 + 0, exec_size);
-  cb.addWriteDMAReg(REFSI_REG_DMAXFERSIZE0 + 1, num_harts_per_core);
-  cb.addWriteDMAReg(REFSI_REG_DMAXFERSRCSTRIDE0 + 0,
-                    0 /* Copy the same data N times */);
+  cb.addWriteDMAReg(REFSI_REG_DMAXFERSIZE0 + 1, max_harts);
   cb.addWriteDMAReg(REFSI_REG_DMAXFERDSTSTRIDE0 + 0, tcdm_hart_size_per_hart);
   cb.addWriteDMAReg(REFSI_REG_DMACTRL, config | REFSI_DMA_START);
   cb.addLOAD_REG64(CMP_REG_SCRATCH, cb.getDMARegAddr(REFSI_REG_DMASTARTSEQ));
 
-  // Wait for the DMA transfer to finish.
+  // Wait for the DMA transfer to finish. Transfers complete in order, so this
+  // also waits for the writable segments to be restored.
   cb.addSTORE_REG64(CMP_REG_SCRATCH, cb.getDMARegAddr(REFSI_REG_DMADONESEQ));
 
   // Flush/invalidate the caches prior to executing the kernel. This is needed
@@ -391,13 +575,21 @@ bool refsi_m1_hal_device::kernel_exec(hal::hal_program_t program,
   // Otherwise the simulator's cache will likely contain instructions and data
   // from the previous ELF. Synchronising the caches is also needed after the
   // kernel finishes executing, so that global memory contains all the changes
-  // made by the kernel.
-  uint32_t cache_flags = CMP_CACHE_SYNC_ACC_DCACHE | CMP_CACHE_SYNC_ACC_ICACHE;
-  cb.addSYNC_CACHE(cache_flags);
+  // made by the kernel. The instruction cache only needs to be invalidated
+  // when a new ELF has been loaded. Passing the program's address range lets
+  // the device keep decoded instructions when the ELF that was loaded is
+  // identical to the one previously executed.
+  uint32_t cache_flags = CMP_CACHE_SYNC_ACC_DCACHE;
+  if (program_loaded) {
+    cache_flags |= CMP_CACHE_SYNC_ACC_ICACHE;
+  }
+  cb.addSYNC_CACHE(cache_flags, resident_program_addr, resident_program_size);
 
   uint64_t stack_top = tcdm_hart_base + tcdm_hart_size_per_hart;
   uint64_t return_addr = rom_base;
   if (!return_addr) {
+    launch_buffer_free(kub_addr, kub_size, locker);
+    launch_buffer_free(counters_buffer_addr, counters_buffer_size, locker);
     return false;
   }
   cb.addWRITE_REG64(CMP_REG_ENTRY_PT_FN, launch_kernel_addrs[work_dim - 1]);
@@ -411,21 +603,22 @@ bool refsi_m1_hal_device::kernel_exec(hal::hal_program_t program,
       cb.addCOPY_MEM64(counters_io_addr, dest_addr, num_counters, unit);
       dest_addr += (num_counters * sizeof(uint64_t));
     }
+    cb.addCOPY_MEM64(counters_io_addr + (num_counters * sizeof(uint64_t)),
+                     dest_addr, num_global_counters,
+                     REFSI_UNIT_ID(REFSI_UNIT_KIND_CMP, 0));
   }
   std::vector<uint64_t> extra_args;
   extra_args.push_back(0);                        // slice_id
   extra_args.push_back(kub_addr + kargs_offset);  // kernel arguments
   extra_args.push_back(tcdm_hart_base);           // execution state
-  uint64_t num_instances = wg.num_groups[0];
-  uint64_t num_slices = 0;
-  num_slices = (work_dim == 2) ? wg.num_groups[1] : 1;
-  num_slices =
-      (work_dim == 3) ? wg.num_groups[1] * wg.num_groups[2] : num_slices;
-  for (uint64_t i = 0; i < num_slices; i++) {
-    extra_args[0] = i;
-    cb.addRUN_INSTANCES(max_harts, num_instances, extra_args);
-  }
-  cb.addSYNC_CACHE(cache_flags);
+  // Run every slice of the N-D range with a single command. The slice ID
+  // (extra_args[0]) is filled in by the device for each instance.
+  uint64_t num_groups[3] = {wg.num_groups[0], 1, 1};
+  for (uint32_t i = 1; i < work_dim; i++) {
+    num_groups[i] = wg.num_groups[i];
+  }
+  cb.addRUN_NDRANGE(max_harts, num_groups, extra_args);
+  cb.addSYNC_CACHE(cache_flags, resident_program_addr, resident_program_size);
   if (counters_enabled) {
     // Read values from performance counters after the kernel has finished.
     hal::hal_addr_t dest_addr = counters_buffer_addr + counters_set_size;
@@ -434,37 +627,146 @@ bool refsi_m1_hal_device::kernel_exec(hal::hal_program_t program,
       cb.addCOPY_MEM64(counters_io_addr, dest_addr, num_counters, unit);
       dest_addr += (num_counters * sizeof(uint64_t));
     }
+    cb.addCOPY_MEM64(counters_io_addr + (num_counters * sizeof(uint64_t)),
+                     dest_addr, num_global_counters,
+                     REFSI_UNIT_ID(REFSI_UNIT_KIND_CMP, 0));
   }
   cb.addFINISH();
 
-  // Execute the command buffer.
-  if (refsi_success != cb.run(*this, locker)) {
+  // Start executing the command buffer. The kernel runs asynchronously, which
+  // lets the host prepare the next command while the kernel executes.
+  uint64_t fence = 0;
+  refsi_memory_access access = get_kernel_access(args, num_args);
+  if (refsi_success !=
+      cb.runAsync(*this, locker, fence, CMP_QUEUE_COMPUTE, access)) {
+    launch_buffer_free(kub_addr, kub_size, locker);
+    launch_buffer_free(counters_buffer_addr, counters_buffer_size, locker);
     return false;
   }
 
-  // Compute the difference between the 'before' and 'after' performance counter
-  // values.
-  if (counters_enabled) {
-    uint64_t *counters_before = (uint64_t *)refsiGetMappedAddress(
-        device, counters_buffer_addr, counters_buffer_size);
-    if (counters_before) {
-      uint64_t *counters_after = &counters_before[num_counters * max_harts];
-      for (uint32_t j = 0; j < max_harts; j++) {
-        for (uint32_t i = 0; i < num_counters; i++) {
+  // Once the kernel has finished, compute the difference between the 'before'
+  // and 'after' performance counter values and release the memory used by
+  // the kernel.
+  defer_until_fence(fence, [this, kub_addr, kub_size, counters_buffer_addr,
+                            counters_buffer_size, num_counters,
+                            num_global_counters,
+                            max_harts](refsi_locker &locker) {
+    if (counters_buffer_addr) {
+      uint64_t *counters_before = (uint64_t *)refsiGetMappedAddress(
+          device, counters_buffer_addr, counters_buffer_size);
+      if (counters_before) {
+        uint64_t *counters_after = &counters_before[(num_counters * max_harts) +
+                                                    num_global_counters];
+        for (uint32_t j = 0; j < max_harts; j++) {
+          for (uint32_t i = 0; i < num_counters; i++) {
+            uint64_t delta = counters_after[i] - counters_before[i];
+            hart_counter_data[i].set_value(j, delta);
+          }
+          counters_before += num_counters;
+          counters_after += num_counters;
+        }
+        for (uint32_t i = 0; i < num_global_counters; i++) {
           uint64_t delta = counters_after[i] - counters_before[i];
-          hart_counter_data[i].set_value(j, delta);
+          global_counter_data[i].set_value(0, delta);
         }
-        counters_before += num_counters;
-        counters_after += num_counters;
       }
     }
-  }
 
-  mem_free(kub_addr, locker);
-  mem_free(counters_buffer_addr, locker);
+    launch_buffer_free(kub_addr, kub_size, locker);
+    launch_buffer_free(counters_buffer_addr, counters_buffer_size, locker);
+  });
   return true;
 }
 
+// Launch buffers are grouped in power-of-two size classes, starting at the
+// alignment of the buffers.
+static hal::hal_size_t launch_buffer_size_class(hal::hal_size_t size) {
+  hal::hal_size_t size_class = refsi_m1_hal_device::launch_buffer_align;
+  while (size_class < size) {
+    size_class *= 2;
+  }
+  return size_class;
+}
+
+hal::hal_addr_t refsi_m1_hal_device::launch_buffer_alloc(hal::hal_size_t size,
+                                                         refsi_locker &locker) {
+  hal::hal_size_t size_class = launch_buffer_size_class(size);
+  auto it = launch_buffer_pool.find(size_class);
+  if ((it != launch_buffer_pool.end()) && !it->second.empty()) {
+    hal::hal_addr_t addr = it->second.back();
+    it->second.pop_back();
+    return addr;
+  }
+  return mem_alloc(size_class, launch_buffer_align, locker);
+}
+
+void refsi_m1_hal_device::launch_buffer_free(hal::hal_addr_t addr,
+                                             hal::hal_size_t size,
+                                             refsi_locker &locker) {
+  if (!addr) {
+    return;
+  }
+  // Keep a few buffers of each size class around for the next launches and
+  // return the others to the device allocator.
+  std::vector<hal::hal_addr_t> &free_list =
+      launch_buffer_pool[launch_buffer_size_class(size)];
+  if (free_list.size() < max_pooled_launch_buffers) {
+    free_list.push_back(addr);
+  } else {
+    mem_free(addr, locker);
+  }
+}
+
+bool refsi_m1_hal_device::mem_fill(hal::hal_addr_t dst, const void *pattern,
+                                   hal::hal_size_t pattern_size,
+                                   hal::hal_size_t size) {
+  // Patterns that do not fit in the DMA fill registers are written by the host.
+  if (!pattern || (pattern_size == 0) ||
+      (pattern_size > REFSI_DMA_MAX_FILL_PATTERN_SIZE)) {
+    return refsi_hal_device::mem_fill(dst, pattern, pattern_size, size);
+  }
+
+  refsi_locker locker(hal_lock);
+
+  if (hal_debug()) {
+    fprintf(stderr,
+            "refsi_hal_device::mem_fill(dst=0x%08lx, pattern_size=%ld, "
+            "size=%ld)\n",
+            dst, pattern_size, size);
+  }
+
+  refsi_command_buffer cb;
+
+  // Start a 1D DMA transfer to fill the buffer with the pattern.
+  const size_t num_pattern_regs =
+      REFSI_DMA_MAX_FILL_PATTERN_SIZE / sizeof(uint64_t);
+  uint64_t pattern_regs[num_pattern_regs] = {};
+  memcpy(pattern_regs, pattern, pattern_size);
+  uint64_t config = REFSI_DMA_1D | REFSI_DMA_STRIDE_NONE | REFSI_DMA_FILL;
+  cb.addWriteDMAReg(REFSI_REG_DMADSTADDR, dst);
+  cb.addWriteDMAReg(REFSI_REG_DMAXFERSIZE0, size);
+  cb.addWriteDMAReg(REFSI_REG_DMAFILLSIZE, pattern_size);
+  for (size_t i = 0; (i * sizeof(uint64_t)) < pattern_size; i++) {
+    cb.addWriteDMAReg(REFSI_REG_DMAFILLPATTERN0 + i, pattern_regs[i]);
+  }
+  cb.addWriteDMAReg(REFSI_REG_DMACTRL, config | REFSI_DMA_START);
+  cb.addLOAD_REG64(CMP_REG_SCRATCH, cb.getDMARegAddr(REFSI_REG_DMASTARTSEQ));
+
+  // Wait for the DMA transfer to finish.
+  cb.addSTORE_REG64(CMP_REG_SCRATCH, cb.getDMARegAddr(REFSI_REG_DMADONESEQ));
+
+  // Start executing the command buffer on the copy queue. Unlike the generic
+  // implementation, the pattern is not written by the host so the device does
+  // not need to be idle. The fill still runs after earlier commands on the copy
+  // queue, and after earlier work on other queues that accesses the buffer.
+  uint64_t fence = 0;
+  refsi_memory_access access;
+  access.any = false;
+  access.writes.push_back({dst, size});
+  return refsi_success ==
+         cb.runAsync(*this, locker, fence, CMP_QUEUE_COPY, access);
+}
+
 bool refsi_m1_hal_device::mem_copy(hal::hal_addr_t dst, hal::hal_addr_t src,
                                    hal::hal_size_t size) {
   refsi_locker locker(hal_lock);
@@ -489,7 +791,15 @@ bool refsi_m1_hal_device::mem_copy(hal::hal_addr_t dst, hal::hal_addr_t src,
   // Wait for the DMA transfer to finish.
   cb.addSTORE_REG64(CMP_REG_SCRATCH, cb.getDMARegAddr(REFSI_REG_DMADONESEQ));
 
-  // Execute the command buffer. Do not update the host performance counters,
-  // since the data is not leaving the device.
-  return refsi_success == cb.run(*this, locker);
+  // Start executing the command buffer on the copy queue. Do not update the
+  // host performance counters, since the data is not leaving the device. Later
+  // commands that access either buffer wait for the copy queue's semaphore, so
+  // they will see the result of the copy.
+  uint64_t fence = 0;
+  refsi_memory_access access;
+  access.any = false;
+  access.reads.push_back({src, size});
+  access.writes.push_back({dst, size});
+  return refsi_success ==
+         cb.runAsync(*this, locker, fence, CMP_QUEUE_COPY, access);
 }